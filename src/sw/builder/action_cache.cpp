@@ -0,0 +1,492 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "action_cache.h"
+
+#include <nlohmann/json.hpp>
+#include <primitives/exceptions.h>
+#include <primitives/lock.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+#ifdef __APPLE__
+#include <sys/clonefile.h>
+#endif
+
+#include <limits>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "action_cache");
+
+#define ACTION_CACHE_FORMAT_VERSION 2
+
+namespace sw
+{
+
+static const String action_root_placeholder = "<root>";
+static const uint64_t unknown_size = std::numeric_limits<uint64_t>::max();
+
+static String to_hex(uint64_t v)
+{
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)v);
+    return buf;
+}
+
+static bool reflink(const path &from, const path &to)
+{
+#if defined(__linux__)
+    int src = ::open(from.c_str(), O_RDONLY);
+    if (src == -1)
+        return false;
+    int dst = ::open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dst == -1)
+    {
+        ::close(src);
+        return false;
+    }
+    bool ok = ioctl(dst, FICLONE, src) == 0;
+    ::close(dst);
+    ::close(src);
+    error_code ec;
+    if (!ok)
+        fs::remove(to, ec);
+    else
+        fs::permissions(to, fs::status(from).permissions(), ec);
+    return ok;
+#elif defined(__APPLE__)
+    return clonefile(from.c_str(), to.c_str(), 0) == 0;
+#else
+    return false;
+#endif
+}
+
+// to must not exist
+// files are never hardlinked, tools may modify their outputs in place and blobs with them
+static void copy_file_fast(const path &from, const path &to)
+{
+    if (reflink(from, to))
+        return;
+    fs::copy_file(from, to);
+}
+
+static void touch(const path &p)
+{
+    error_code ec;
+    fs::last_write_time(p, fs::file_time_type::clock::now(), ec);
+}
+
+String toRelativeActionPath(const String &in, const path &root)
+{
+    if (root.empty())
+        return in;
+    auto s = in;
+    for (auto &r : { normalize_path(root), root.u8string() })
+    {
+        size_t p = 0;
+        while ((p = s.find(r, p)) != s.npos)
+        {
+            auto e = p + r.size();
+            // whole directory names only
+            if (e != s.size() && s[e] != '/' && s[e] != '\\')
+            {
+                p = e;
+                continue;
+            }
+            s.replace(p, r.size(), action_root_placeholder);
+            p += action_root_placeholder.size();
+        }
+    }
+    return s;
+}
+
+String fromRelativeActionPath(const String &in, const path &root)
+{
+    auto s = in;
+    auto r = normalize_path(root);
+    size_t p = 0;
+    while ((p = s.find(action_root_placeholder, p)) != s.npos)
+    {
+        s.replace(p, action_root_placeholder.size(), r);
+        p += r.size();
+    }
+    return s;
+}
+
+static path toAbsoluteActionPath(const path &p, const path &root)
+{
+    auto s = normalize_path(p);
+    auto n = action_root_placeholder.size();
+    if (root.empty() || s.compare(0, n, action_root_placeholder) != 0)
+        return p;
+    if (s.size() == n)
+        return root;
+    if (s[n] != '/')
+        return p;
+    return root / fs::u8path(s.substr(n + 1));
+}
+
+ActionCacheEntry ActionCacheEntry::toRelative(const path &root) const
+{
+    auto e = *this;
+    for (auto &o : e.outputs)
+        o.file = fs::u8path(toRelativeActionPath(normalize_path(o.file), root));
+    e.implicit_inputs.clear();
+    for (auto &i : implicit_inputs)
+        e.implicit_inputs.insert(fs::u8path(toRelativeActionPath(normalize_path(i), root)));
+    return e;
+}
+
+ActionCacheEntry ActionCacheEntry::toAbsolute(const path &root) const
+{
+    auto e = *this;
+    for (auto &o : e.outputs)
+        o.file = toAbsoluteActionPath(o.file, root);
+    e.implicit_inputs.clear();
+    for (auto &i : implicit_inputs)
+        e.implicit_inputs.insert(toAbsoluteActionPath(i, root));
+    return e;
+}
+
+ActionCache::ActionCache(const path &in_root, uint64_t max_size)
+    : max_size(max_size)
+    , root(in_root / std::to_string(ACTION_CACHE_FORMAT_VERSION))
+{
+}
+
+ActionCache::~ActionCache()
+{
+    if (hits == 0 && misses == 0 && stores == 0 && stored_size == 0)
+        return;
+    try
+    {
+        flush();
+    }
+    catch (std::exception &e)
+    {
+        LOG_WARN(logger, "Cannot update action cache: " << e.what());
+    }
+}
+
+path ActionCache::getEntryFilename(uint64_t key) const
+{
+    auto h = to_hex(key);
+    return root / "ac" / h.substr(0, 2) / h;
+}
+
+path ActionCache::getBlobFilename(uint64_t hash, int64_t size) const
+{
+    auto h = to_hex(hash);
+    return root / "cas" / h.substr(0, 2) / (h + "-" + std::to_string(size));
+}
+
+path ActionCache::getStatsFilename() const
+{
+    return root / "stats.json";
+}
+
+path ActionCache::getTemporaryFilename() const
+{
+    auto tmp = root / "tmp" / unique_path();
+    fs::create_directories(tmp.parent_path());
+    return tmp;
+}
+
+std::optional<ActionCacheEntry> ActionCache::loadEntry(uint64_t key) const
+{
+    auto fn = getEntryFilename(key);
+    if (!fs::exists(fn))
+        return {};
+    auto j = nlohmann::json::parse(read_file(fn));
+    ActionCacheEntry e;
+    for (auto &o : j["outputs"])
+    {
+        ActionCacheEntry::Output out;
+        out.file = fs::u8path(o["file"].get<String>());
+        out.hash = o["hash"].get<uint64_t>();
+        out.size = o["size"].get<int64_t>();
+        e.outputs.push_back(out);
+    }
+    for (auto &i : j["implicit_inputs"])
+        e.implicit_inputs.insert(fs::u8path(i.get<String>()));
+    if (j.contains("out"))
+        e.out = j["out"].get<String>();
+    if (j.contains("err"))
+        e.err = j["err"].get<String>();
+    touch(fn);
+    return e;
+}
+
+void ActionCache::saveEntry(uint64_t key, const ActionCacheEntry &e) const
+{
+    nlohmann::json j;
+    j["outputs"] = nlohmann::json::array();
+    for (auto &o : e.outputs)
+    {
+        nlohmann::json jo;
+        jo["file"] = normalize_path(o.file);
+        jo["hash"] = o.hash;
+        jo["size"] = o.size;
+        j["outputs"].push_back(jo);
+    }
+    j["implicit_inputs"] = nlohmann::json::array();
+    for (auto &i : e.implicit_inputs)
+        j["implicit_inputs"].push_back(normalize_path(i));
+    if (!e.out.empty())
+        j["out"] = e.out;
+    if (!e.err.empty())
+        j["err"] = e.err;
+
+    // other processes must never see partial entry
+    auto fn = getEntryFilename(key);
+    auto tmp = getTemporaryFilename();
+    auto s = j.dump();
+    write_file(tmp, s);
+    fs::create_directories(fn.parent_path());
+    fs::rename(tmp, fn);
+    stored_size += s.size();
+}
+
+bool ActionCache::hasBlob(uint64_t hash, int64_t size) const
+{
+    return fs::exists(getBlobFilename(hash, size));
+}
+
+String ActionCache::readBlob(uint64_t hash, int64_t size) const
+{
+    auto b = getBlobFilename(hash, size);
+    touch(b);
+    return read_file(b);
+}
+
+void ActionCache::storeBlob(uint64_t hash, int64_t size, const String &data) const
+{
+    if ((int64_t)data.size() != size)
+        throw SW_RUNTIME_ERROR("Blob size mismatch");
+    auto b = getBlobFilename(hash, size);
+    if (fs::exists(b))
+    {
+        touch(b);
+        return;
+    }
+    auto tmp = getTemporaryFilename();
+    write_file(tmp, data);
+    fs::create_directories(b.parent_path());
+    fs::rename(tmp, b);
+    stored_size += size;
+}
+
+void ActionCache::storeBlob(uint64_t hash, int64_t size, const path &from) const
+{
+    auto b = getBlobFilename(hash, size);
+    if (fs::exists(b))
+    {
+        touch(b);
+        return;
+    }
+    auto tmp = getTemporaryFilename();
+    copy_file_fast(from, tmp);
+    fs::create_directories(b.parent_path());
+    fs::rename(tmp, b);
+    stored_size += size;
+}
+
+std::optional<ActionCacheEntry> ActionCache::find(uint64_t inputs_key, const GetKey &get_key, const path &root)
+{
+    auto e = loadEntry(inputs_key);
+    if (!e)
+    {
+        misses++;
+        return {};
+    }
+    e = loadEntry(get_key(inputs_key, e->toAbsolute(root).implicit_inputs));
+    if (!e)
+    {
+        misses++;
+        return {};
+    }
+    return e->toAbsolute(root);
+}
+
+void ActionCache::store(uint64_t inputs_key, uint64_t key, const ActionCacheEntry &e, const path &root)
+{
+    for (auto &o : e.outputs)
+        storeBlob(o.hash, o.size, o.file);
+
+    // implicit inputs only
+    ActionCacheEntry e1;
+    e1.implicit_inputs = e.implicit_inputs;
+    saveEntry(inputs_key, e1.toRelative(root));
+    saveEntry(key, e.toRelative(root));
+    stores++;
+}
+
+bool ActionCache::restore(const ActionCacheEntry &e)
+{
+    for (auto &o : e.outputs)
+    {
+        if (!hasBlob(o.hash, o.size))
+        {
+            misses++;
+            return false;
+        }
+    }
+    for (auto &o : e.outputs)
+    {
+        auto b = getBlobFilename(o.hash, o.size);
+        fs::create_directories(o.file.parent_path());
+        // old output is replaced at once, readers never see partial file
+        auto tmp = o.file.parent_path() / unique_path();
+        try
+        {
+            copy_file_fast(b, tmp);
+            fs::rename(tmp, o.file);
+        }
+        catch (...)
+        {
+            error_code ec;
+            fs::remove(tmp, ec);
+            throw;
+        }
+        // restored output must be newer than its inputs
+        touch(o.file);
+        touch(b);
+    }
+    hits++;
+    return true;
+}
+
+void ActionCache::readCounters(ActionCacheStats &s, uint64_t *size) const
+{
+    if (size)
+        *size = unknown_size;
+    if (fs::exists(getStatsFilename()))
+    {
+        auto j = nlohmann::json::parse(read_file(getStatsFilename()));
+        s.hits = j["hits"].get<uint64_t>();
+        s.misses = j["misses"].get<uint64_t>();
+        s.stores = j["stores"].get<uint64_t>();
+        if (size && j.contains("size"))
+            *size = j["size"].get<uint64_t>();
+    }
+    s.hits += hits;
+    s.misses += misses;
+    s.stores += stores;
+}
+
+ActionCacheStats ActionCache::getStats() const
+{
+    ActionCacheStats s;
+    readCounters(s);
+
+    auto count = [&s](const path &dir, uint64_t &n)
+    {
+        if (!fs::exists(dir))
+            return;
+        for (auto &f : fs::recursive_directory_iterator(dir))
+        {
+            if (!f.is_regular_file())
+                continue;
+            n++;
+            s.size += f.file_size();
+        }
+    };
+    count(root / "ac", s.entries);
+    count(root / "cas", s.blobs);
+    return s;
+}
+
+// returns size of the cache known from stats, it is replaced with the passed one
+uint64_t ActionCache::saveStats(std::optional<uint64_t> new_size)
+{
+    fs::create_directories(root);
+    ScopedFileLock lk(root / "stats");
+    ActionCacheStats s;
+    uint64_t size;
+    readCounters(s, &size);
+    auto added = stored_size.exchange(0);
+    if (new_size)
+        size = *new_size;
+    else if (size != unknown_size)
+        size += added;
+    nlohmann::json j;
+    j["hits"] = s.hits;
+    j["misses"] = s.misses;
+    j["stores"] = s.stores;
+    // unknown until the first trim
+    if (size != unknown_size)
+        j["size"] = size;
+    write_file(getStatsFilename(), j.dump(2));
+    hits = 0;
+    misses = 0;
+    stores = 0;
+    return size;
+}
+
+void ActionCache::flush()
+{
+    if (saveStats() > max_size)
+        trim(max_size);
+}
+
+void ActionCache::trim(uint64_t max_size)
+{
+    struct Info
+    {
+        fs::file_time_type mtime;
+        uint64_t size;
+        path p;
+    };
+    std::vector<Info> files;
+    uint64_t total = 0;
+    for (auto &dir : { root / "ac", root / "cas" })
+    {
+        if (!fs::exists(dir))
+            continue;
+        for (auto &f : fs::recursive_directory_iterator(dir))
+        {
+            if (!f.is_regular_file())
+                continue;
+            files.push_back({ f.last_write_time(), f.file_size(), f.path() });
+            total += files.back().size;
+        }
+    }
+    if (total <= max_size)
+    {
+        saveStats(total);
+        return;
+    }
+
+    // least recently used first
+    std::sort(files.begin(), files.end(), [](const auto &a, const auto &b) { return a.mtime < b.mtime; });
+    size_t n = 0;
+    for (auto &f : files)
+    {
+        if (total <= max_size)
+            break;
+        error_code ec;
+        fs::remove(f.p, ec);
+        if (ec)
+            continue;
+        total -= f.size;
+        n++;
+    }
+    // files stored by other processes during the walk are not counted until the next trim
+    saveStats(total);
+    LOG_DEBUG(logger, "Action cache trimmed: " << n << " files removed");
+}
+
+void ActionCache::clear()
+{
+    error_code ec;
+    fs::remove_all(root / "ac", ec);
+    fs::remove_all(root / "cas", ec);
+    fs::remove_all(root / "tmp", ec);
+    saveStats(0);
+}
+
+}
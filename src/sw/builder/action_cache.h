@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+#include <atomic>
+#include <functional>
+#include <optional>
+
+namespace sw
+{
+
+/// Replaces root directory in paths and command arguments with a placeholder.
+/// Keys and saved entries do not depend on location of the project this way,
+/// so the same commands of different checkouts share the cache.
+SW_BUILDER_API
+String toRelativeActionPath(const String &, const path &root);
+/// replaces the placeholder with root
+SW_BUILDER_API
+String fromRelativeActionPath(const String &, const path &root);
+
+struct SW_BUILDER_API ActionCacheEntry
+{
+    struct Output
+    {
+        path file;
+        uint64_t hash = 0;
+        int64_t size = 0;
+    };
+
+    std::vector<Output> outputs;
+    Files implicit_inputs;
+    String out;
+    String err;
+
+    /// paths of outputs and implicit inputs as they are saved
+    ActionCacheEntry toRelative(const path &root) const;
+    ActionCacheEntry toAbsolute(const path &root) const;
+};
+
+struct ActionCacheStats
+{
+    // accumulated over all runs
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t stores = 0;
+
+    // current contents
+    uint64_t entries = 0;
+    uint64_t blobs = 0;
+    uint64_t size = 0;
+};
+
+/// Local content-addressed cache of command outputs shared by all builds of the user.
+///
+/// Actions are looked up in two steps, because implicit inputs are known only after execution:
+///   command + explicit inputs content -> implicit inputs list
+///   command + all inputs content -> outputs, stdout, stderr
+/// Output files are stored once per content in blob storage.
+/// Entries are saved with paths relative to root of the command (see toRelativeActionPath()).
+///
+/// Total size is tracked in stats file by counting stored bytes,
+/// cache directories are walked only when it goes over the limit.
+struct SW_BUILDER_API ActionCache
+{
+    // key of the second step from the first key and implicit inputs
+    using GetKey = std::function<uint64_t(uint64_t inputs_key, const Files &implicit_inputs)>;
+
+    uint64_t max_size;
+
+    ActionCache(const path &root, uint64_t max_size);
+    ActionCache(const ActionCache &) = delete;
+    ActionCache &operator=(const ActionCache &) = delete;
+    ~ActionCache();
+
+    const path &getRoot() const { return root; }
+
+    std::optional<ActionCacheEntry> find(uint64_t inputs_key, const GetKey &, const path &root);
+    void store(uint64_t inputs_key, uint64_t key, const ActionCacheEntry &, const path &root);
+    /// puts cached outputs in place, returns false if something is missing
+    bool restore(const ActionCacheEntry &);
+
+    // low level api, used by remote cache
+    std::optional<ActionCacheEntry> loadEntry(uint64_t key) const;
+    void saveEntry(uint64_t key, const ActionCacheEntry &) const;
+    bool hasBlob(uint64_t hash, int64_t size) const;
+    String readBlob(uint64_t hash, int64_t size) const;
+    void storeBlob(uint64_t hash, int64_t size, const String &data) const;
+    void storeBlob(uint64_t hash, int64_t size, const path &from) const;
+
+    ActionCacheStats getStats() const;
+    /// removes least recently used files until cache fits into the size
+    void trim(uint64_t max_size);
+    void clear();
+    /// saves counters, trims cache when recorded size is over max_size
+    void flush();
+
+private:
+    path root;
+    std::atomic<uint64_t> hits{ 0 };
+    std::atomic<uint64_t> misses{ 0 };
+    std::atomic<uint64_t> stores{ 0 };
+    mutable std::atomic<uint64_t> stored_size{ 0 }; // bytes written since the last save of stats
+
+    path getEntryFilename(uint64_t key) const;
+    path getBlobFilename(uint64_t hash, int64_t size) const;
+    path getStatsFilename() const;
+    path getTemporaryFilename() const;
+    void readCounters(ActionCacheStats &, uint64_t *size = nullptr) const;
+    uint64_t saveStats(std::optional<uint64_t> size = {});
+};
+
+}
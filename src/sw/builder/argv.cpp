@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "argv.h"
+
+#include <cstring>
+
+namespace sw
+{
+
+ArgvBuilder::ArgvBuilder(const Strings &args)
+{
+    size_t sz = 0;
+    for (auto &a : args)
+        sz += a.size() + 1;
+    reserve(args.size(), sz);
+    for (auto &a : args)
+        push_back(a);
+}
+
+void ArgvBuilder::reserve(size_t n, size_t total_size)
+{
+    buffer.reserve(total_size);
+    argv.reserve(n + 1);
+}
+
+void ArgvBuilder::push_back(std::string_view s)
+{
+    auto sz = buffer.size();
+    buffer.resize(sz + s.size() + 1);
+    memcpy(buffer.data() + sz, s.data(), s.size());
+    buffer[sz + s.size()] = 0;
+    n_args++;
+}
+
+char *const *ArgvBuilder::data()
+{
+    // pointers are made at the end, buffer may move while it grows
+    argv.clear();
+    for (size_t i = 0, n = 0; n < n_args; n++)
+    {
+        argv.push_back(buffer.data() + i);
+        i += strlen(buffer.data() + i) + 1;
+    }
+    argv.push_back(nullptr);
+    return argv.data();
+}
+
+}
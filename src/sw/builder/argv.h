@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+#include <string_view>
+
+namespace sw
+{
+
+/// Null terminated argv with all strings in one buffer.
+///
+/// After reserve() any number of arguments is added without allocations,
+/// so a link with thousands of arguments allocates a constant number of times.
+struct SW_BUILDER_API ArgvBuilder
+{
+    ArgvBuilder() = default;
+    ArgvBuilder(const Strings &args);
+
+    void reserve(size_t n_args, size_t total_size);
+    void push_back(std::string_view);
+
+    /// valid until the next push_back()
+    char *const *data();
+    size_t size() const { return n_args; }
+    bool empty() const { return n_args == 0; }
+
+private:
+    std::vector<char> buffer;
+    std::vector<char *> argv;
+    size_t n_args = 0;
+};
+
+}
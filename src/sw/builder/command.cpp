@@ -21,12 +21,18 @@
 #define BOOST_THREAD_VERSION 5
 #include "command.h"
 
+#include "action_cache.h"
 #include "command_storage.h"
+#include "deps_parser.h"
 #include "file.h"
 #include "file_storage.h"
 #include "jumppad.h"
 #include "os.h"
+#include "process_launcher.h"
 #include "program.h"
+#include "remote_action_cache.h"
+#include "remote_executor.h"
+#include "stable_hash.h"
 #include "sw_context.h"
 
 #include <sw/manager/settings.h>
@@ -51,7 +57,8 @@ DECLARE_STATIC_LOGGER(logger, "command");
 namespace sw
 {
 
-static Files process_deps_msvc(builder::Command &c)
+template <class F>
+static void process_deps_msvc(builder::Command &c, F &&add)
 {
     // deps are placed into command output,
     // so we can't skip this filtering
@@ -62,120 +69,32 @@ static Files process_deps_msvc(builder::Command &c)
     if (prefix.empty())
         throw SW_RUNTIME_ERROR("msvc prefix is not set");
 
-    Files deps;
-    auto perform = [&deps, &prefix](auto &text, bool out)
-    {
-        std::deque<String> lines;
-        boost::split(lines, text, boost::is_any_of("\n"));
-        text.clear();
-        if (out)
-        {
-            // remove filename
-            lines.pop_front();
-        }
-
-        for (auto &line : lines)
-        {
-            if (line.find(prefix) != 0)
-            {
-                text += line + "\n";
-                continue;
-            }
-            auto include = line.substr(prefix.size());
-            boost::trim(include);
-            //if (fs::exists(include)) // slow check? but correct?
-            deps.insert(include);
-        }
-    };
-
     // on errors msvc puts everything to stderr instead of stdout
     // https://docs.microsoft.com/en-us/cpp/build/reference/showincludes-list-include-files?view=vs-2019
     // link says only stderr used for show includes
     // but we do not see it
-    perform(c.out.text, true); // remove?
-    perform(c.err.text, false);
-
-    return deps;
+    parse_deps_msvc(c.out.text, prefix, true, add); // remove filename
+    parse_deps_msvc(c.err.text, prefix, false, add);
 }
 
-static Files process_deps_gnu(builder::Command &c, const path &deps_file)
+template <class F>
+static void process_deps_gnu(const path &deps_file, F &&add)
 {
     if (deps_file.empty())
-        return {};
+        return;
     if (!fs::exists(deps_file))
     {
         LOG_DEBUG(logger, "Missing deps file: " + normalize_path(deps_file));
-        return {};
+        return;
     }
 
-    static const std::regex space_r("[^\\\\] ");
-
-    // deps file is a make in form
-    // target: dependencies
-    // deps are split by spaces on several lines with \ at the end of each line except the last one
-    //
-    // example:
-    //
-    // file.o: dep1.cpp dep2.cpp \
-            //  dep1.h dep2.h \
-    //  dep3.h \
-    //  dep4.h
-//
-
     auto f = read_file(deps_file);
-
-    // skip target
-    //  use exactly ": " because on windows target is 'C:/path/to/file: '
-    //                                           skip up to this space ^
-    f = f.substr(f.find(": ") + 1);
-
-    FilesOrdered files;
-
-    enum
-    {
-        EMPTY,
-        FILE,
-    };
-    int state = EMPTY;
-    auto p = f.c_str();
-    auto begin = p;
-    while (*p)
-    {
-        switch (state)
-        {
-        case EMPTY:
-            if (isspace(*p) || *p == '\\')
-                break;
-            state = FILE;
-            begin = p;
-            break;
-        case FILE:
-            if (!isspace(*p))
-                break;
-            if (*(p - 1) == '\\')
-                break;
-            String s(begin, p);
-            if (!s.empty())
-            {
-                boost::replace_all(s, "\\ ", " ");
-                if (pystring::endswith(s, "\\\n")) // protobuf does not put space after filename
-                    s.resize(s.size() - 2);
-                files.push_back(fs::u8path(s));
-            }
-            state = EMPTY;
-            break;
-        }
-        p++;
-    }
-
-    Files deps;
 #ifndef _WIN32
-    for (auto &f : files)
-        deps.insert(f);
+    parse_deps_gnu(f, add);
 #else
-    for (auto &f2 : files)
+    parse_deps_gnu(f, [&add](std::string_view p)
     {
-        auto f3 = normalize_path(f2);
+        auto f3 = normalize_path(fs::u8path(p.begin(), p.end()));
 #ifdef CPPAN_OS_WINDOWS_NO_CYGWIN
         static const String cyg = "/cygdrive/";
         if (f3.find(cyg) == 0)
@@ -184,11 +103,9 @@ static Files process_deps_gnu(builder::Command &c, const path &deps_file)
             f3 = toupper(f3[0]) + ":" + f3.substr(1);
         }
 #endif
-        //if (!fs::exists(fs::u8path(f3)))
-        deps.insert(fs::u8path(f3));
-    }
+        add(f3);
+    });
 #endif
-    return deps;
 }
 
 CommandNode::CommandNode()
@@ -208,6 +125,11 @@ CommandNode::~CommandNode()
 {
 }
 
+CommandNode::Duration CommandNode::getEstimatedDuration() const
+{
+    return Duration(100);
+}
+
 namespace builder
 {
 
@@ -237,8 +159,8 @@ static String getCommandId(const Command &c)
         s += "env:\n";
         for (auto &[k, v] : c.environment)
             s += k + "\n" + v + "\n";
-        for (auto &a : c.arguments)
-            s += a->toString() + "\n";
+        for (auto &a : c.getRenderedArguments())
+            s += a + "\n";
         s.resize(s.size() - 1);
     }
     return s;
@@ -271,11 +193,13 @@ bool Command::isOutdated() const
         return true;
     }
 
+    // read only, this is called for all commands before execution,
+    // records are created only for executed ones
     auto k = getHash();
-    auto r = command_storage->insert(k);
-    if (r.second)
+    auto r = command_storage->find(k);
+    if (!r)
     {
-        // we have insertion, no previous value available
+        // no previous value available
         // so outdated
         if (isExplainNeeded())
             EXPLAIN_OUTDATED("command", true, "new command (command_storage = " + normalize_path(command_storage->root) + "): " + print(), getCommandId(*this));
@@ -283,12 +207,35 @@ bool Command::isOutdated() const
     }
     else
     {
-        ((Command*)(this))->mtime = r.first->mtime;
-        ((Command*)(this))->implicit_inputs = r.first->getImplicitInputs(command_storage->getInternalStorage());
-        return isTimeChanged();
+        auto c = (Command*)(this);
+        c->mtime = r->mtime;
+        c->implicit_input_ids = r->getImplicitInputIds(command_storage->getInternalStorage());
+        // records without hash were written in time mode
+        if (use_content_hash && r->inputs_hash)
+        {
+            c->implicit_inputs = getImplicitInputs();
+            return isContentChanged(*r);
+        }
+        if (!isTimeChanged())
+            return false;
+        // needed for execution, up to date commands do not make files
+        c->implicit_inputs = getImplicitInputs();
+        return true;
     }
 }
 
+Files Command::getImplicitInputs() const
+{
+    if (!implicit_inputs.empty() || implicit_input_ids.empty() || !command_storage)
+        return implicit_inputs;
+    auto &s = command_storage->getInternalStorage();
+    Files files;
+    files.reserve(implicit_input_ids.size());
+    for (auto id : implicit_input_ids)
+        files.insert(s.paths.get(id));
+    return files;
+}
+
 bool Command::isTimeChanged() const
 {
     try
@@ -299,9 +246,7 @@ bool Command::isTimeChanged() const
                std::any_of(outputs.begin(), outputs.end(), [this](const auto &i) {
                    return check_if_file_newer(i, "output", false);
                }) ||
-               std::any_of(implicit_inputs.begin(), implicit_inputs.end(), [this](const auto &i) {
-                   return check_if_file_newer(i, "implicit input", true);
-               });
+               isImplicitInputChanged();
     }
     catch (std::exception &e)
     {
@@ -311,6 +256,261 @@ bool Command::isTimeChanged() const
     }
 }
 
+bool Command::isImplicitInputChanged() const
+{
+    // no files, paths are used only for explanation
+    auto &s = command_storage->getInternalStorage();
+    auto &file_storage = getContext().getFileStorage();
+
+    // popular headers are checked by many commands at once,
+    // so do not wait for them while other files are not checked
+    std::vector<std::pair<FileData *, const path *>> files;
+    files.reserve(implicit_input_ids.size());
+    for (auto id : implicit_input_ids)
+        files.emplace_back(&s.getFileData(id, file_storage), &s.paths.get(id));
+    refreshFiles(files);
+
+    for (auto &[d, p] : files)
+    {
+        if (d->last_write_time != fs::file_time_type::min() && d->last_write_time <= mtime)
+            continue;
+        return check_if_file_newer(*p, "implicit input", true);
+    }
+    return false;
+}
+
+bool Command::isContentChanged(const CommandRecord &r) const
+{
+    // restored checkouts and caches have new mtimes,
+    // so outputs must only exist and inputs must have the same content
+    for (auto &o : outputs)
+    {
+        File f(o, getContext().getFileStorage());
+        f.isChanged();
+        if (f.getFileData().last_write_time != fs::file_time_type::min())
+            continue;
+        if (isExplainNeeded())
+            EXPLAIN_OUTDATED("command", true, "output is missing " + normalize_path(o), getCommandId(*this));
+        return true;
+    }
+
+    uint64_t h;
+    try
+    {
+        h = getInputsHash();
+    }
+    catch (std::exception &e)
+    {
+        // missing input etc.
+        if (isExplainNeeded())
+            EXPLAIN_OUTDATED("command", true, String("cannot hash inputs: ") + e.what(), getCommandId(*this));
+        return true;
+    }
+    if (h == r.inputs_hash)
+        return false;
+    if (isExplainNeeded())
+        EXPLAIN_OUTDATED("command", true, "inputs content changed (command_storage = " + normalize_path(command_storage->root) + ")", getCommandId(*this));
+    return true;
+}
+
+uint64_t Command::getContentHash(const Files &files, const path &root) const
+{
+    // order independent, files are unordered
+    uint64_t h = 0;
+    for (auto &p : files)
+    {
+        File f(p, getContext().getFileStorage());
+        f.isChanged();
+        if (f.getFileData().last_write_time == fs::file_time_type::min())
+            throw SW_RUNTIME_ERROR("file is missing: " + normalize_path(p));
+        auto fh = stable_hash(toRelativeActionPath(normalize_path(p), root));
+        stable_hash_combine(fh, command_storage->getFileHash(p, f.getFileData()));
+        h += fh;
+    }
+    return h;
+}
+
+uint64_t Command::getInputsHash() const
+{
+    return getContentHash(inputs) + getContentHash(implicit_inputs);
+}
+
+bool Command::isActionCacheable() const
+{
+    return (use_action_cache || remote_cache) && command_storage && !always && !do_not_save_command && !outputs.empty();
+}
+
+static path common_directory(const path &a, const path &b)
+{
+    path r;
+    for (auto i = a.begin(), j = b.begin(); i != a.end() && j != b.end() && *i == *j; ++i, ++j)
+        r /= *i;
+    return r;
+}
+
+// Common directory of outputs, inputs and working directory,
+// like project dir for local builds or package dir in storage.
+// Program is usually outside of it.
+path Command::getActionRoot() const
+{
+    path prog = getProgram();
+    auto r = outputs.begin()->parent_path();
+    for (auto &o : outputs)
+        r = common_directory(r, o.parent_path());
+    for (auto &i : inputs)
+    {
+        if (i != prog)
+            r = common_directory(r, i.parent_path());
+    }
+    if (!working_directory.empty())
+        r = common_directory(r, working_directory);
+    // nothing in common except system wide dirs
+    if (r == r.root_path())
+        return {};
+    return r;
+}
+
+uint64_t Command::getActionHash(const path &root) const
+{
+    // same as getHash1(), but paths are relative
+    auto rel = [&root](const String &s) { return stable_hash(toRelativeActionPath(s, root)); };
+
+    uint64_t h = 0;
+    stable_hash_combine(h, rel(getProgram()));
+    UnorderedHash args;
+    for (auto &a : getRenderedArguments())
+        args.add(toRelativeActionPath(a, root));
+    stable_hash_combine(h, args.get());
+    for (auto f : { &in.file, &out.file, &err.file })
+        stable_hash_combine(h, rel(normalize_path(*f)));
+    stable_hash_combine(h, rel(normalize_path(working_directory)));
+    for (auto &[k, v] : environment)
+    {
+        stable_hash_combine(h, stable_hash(k));
+        stable_hash_combine(h, rel(v));
+    }
+    return h;
+}
+
+uint64_t Command::getActionKey(const path &root) const
+{
+    auto h = getActionHash(root);
+    stable_hash_combine(h, getContentHash(inputs, root));
+    return h;
+}
+
+uint64_t Command::getActionKey(const path &root, uint64_t inputs_key, const Files &implicit_inputs) const
+{
+    auto h = inputs_key;
+    stable_hash_combine(h, getContentHash(implicit_inputs, root));
+    return h;
+}
+
+bool Command::restoreFromActionCache()
+{
+    if (!isActionCacheable())
+        return false;
+
+    auto root = getActionRoot();
+    auto get_key = [this, &root](uint64_t k, const Files &implicit_inputs)
+    {
+        return getActionKey(root, k, implicit_inputs);
+    };
+    // same action key means same output paths relative to the root
+    auto check_outputs = [this](const ActionCacheEntry &e)
+    {
+        std::unordered_set<String> outs;
+        for (auto &o : outputs)
+            outs.insert(normalize_path(o));
+        for (auto &o : e.outputs)
+        {
+            if (outs.find(normalize_path(o.file)) == outs.end())
+                return false;
+        }
+        for (auto &d : getGeneratedDirs())
+            fs::create_directories(d);
+        return true;
+    };
+
+    std::optional<ActionCacheEntry> e;
+    bool remote = false;
+    try
+    {
+        auto k = getActionKey(root);
+        if (use_action_cache)
+        {
+            auto &ac = getContext().getActionCache();
+            e = ac.find(k, get_key, root);
+            if (e && !(check_outputs(*e) && ac.restore(*e)))
+                e.reset();
+        }
+        if (!e && remote_cache)
+        {
+            e = remote_cache->find(k, get_key, root);
+            if (e && !(check_outputs(*e) && remote_cache->restore(*e)))
+                e.reset();
+            remote = !!e;
+        }
+    }
+    catch (std::exception &ex)
+    {
+        // missing implicit input, broken entry etc.
+        LOG_DEBUG(logger, "Cannot restore command from action cache: " << getName() << ": " << ex.what());
+        return false;
+    }
+    if (!e)
+        return false;
+
+    implicit_inputs = e->implicit_inputs;
+    implicit_input_ids.clear(); // they are from the previous execution
+    out.text = e->out;
+    err.text = e->err;
+    LOG_TRACE(logger, "Restored from " << (remote ? "remote " : "") << "action cache: " << getName());
+    printOutputs();
+
+    // keep local copy
+    if (remote && use_action_cache)
+        storeToActionCache(false);
+    return true;
+}
+
+void Command::storeToActionCache(bool upload)
+{
+    if (!isActionCacheable())
+        return;
+
+    try
+    {
+        ActionCacheEntry e;
+        for (auto &o : outputs)
+        {
+            if (!fs::is_regular_file(o))
+                return;
+            File f(o, getContext().getFileStorage());
+            ActionCacheEntry::Output out;
+            out.file = o;
+            out.hash = command_storage->getFileHash(o, f.getFileData());
+            out.size = f.getFileData().size;
+            e.outputs.push_back(out);
+        }
+        e.implicit_inputs = implicit_inputs;
+        e.out = out.text;
+        e.err = err.text;
+
+        auto root = getActionRoot();
+        auto k = getActionKey(root);
+        auto k2 = getActionKey(root, k, implicit_inputs);
+        if (use_action_cache)
+            getContext().getActionCache().store(k, k2, e, root);
+        if (upload && remote_cache)
+            remote_cache->store(k, k2, e, root);
+    }
+    catch (std::exception &e)
+    {
+        LOG_DEBUG(logger, "Cannot store command in action cache: " << getName() << ": " << e.what());
+    }
+}
+
 size_t Command::getHash() const
 {
     if (hash != 0)
@@ -320,38 +520,37 @@ size_t Command::getHash() const
 
 size_t Command::getHash1() const
 {
-    size_t h = 0;
-    hash_combine(h, std::hash<path>()(getProgram()));
+    // hash is stored in command storage, so it must not change between runs and platforms
+    auto path_hash = [](const path &p) { return stable_hash(p.u8string()); };
+
+    uint64_t h = 0;
+    stable_hash_combine(h, stable_hash(getProgram()));
 
-    // must sort arguments first
+    // arguments are hashed in any order
     // because some command may generate args in unspecified order
     // actually no, we do not allow unspecified order anymore
     // actually we have different deps order -> different defs, idir order, libs order
     // FIXME: ^
-    std::set<String> args_sorted;
-    Strings sa;
-    for (auto &a : arguments)
-        args_sorted.insert(a->toString());
-    for (auto &a : args_sorted)
-        hash_combine(h, std::hash<String>()(a));
-    //for (auto &a : arguments)
-        //hash_combine(h, std::hash<String>()(a->toString()));
+    UnorderedHash args;
+    for (auto &a : getRenderedArguments())
+        args.add(a);
+    stable_hash_combine(h, args.get());
 
     // redirections are also considered as arguments
     if (!in.file.empty())
-        hash_combine(h, std::hash<path>()(in.file));
+        stable_hash_combine(h, path_hash(in.file));
     if (!out.file.empty())
-        hash_combine(h, std::hash<path>()(out.file));
+        stable_hash_combine(h, path_hash(out.file));
     if (!err.file.empty())
-        hash_combine(h, std::hash<path>()(err.file));
+        stable_hash_combine(h, path_hash(err.file));
 
-    hash_combine(h, std::hash<path>()(working_directory));
+    stable_hash_combine(h, path_hash(working_directory));
 
     // read other env vars? some of them may have influence
     for (auto &[k, v] : environment)
     {
-        hash_combine(h, std::hash<String>()(k));
-        hash_combine(h, std::hash<String>()(v));
+        stable_hash_combine(h, stable_hash(k));
+        stable_hash_combine(h, stable_hash(v));
     }
 
     // command may depend on files not listed on the command line (dlls)?
@@ -401,6 +600,22 @@ void Command::addImplicitInput(const Files &files)
         addImplicitInput(f);
 }
 
+void Command::addImplicitInputFromDeps(std::string_view p)
+{
+    if (p.empty())
+        return;
+    if (!command_storage)
+    {
+        implicit_inputs.insert(fs::u8path(p.begin(), p.end()));
+        return;
+    }
+    // known paths are not allocated again
+    auto &s = command_storage->getInternalStorage();
+    auto id = s.paths.intern(s.getPathHash(p), p);
+    if (implicit_inputs.insert(s.paths.get(id)).second)
+        implicit_input_ids.push_back(id);
+}
+
 void Command::addOutput(const path &p)
 {
     if (p.empty())
@@ -472,12 +687,16 @@ void Command::prepare()
     if (!getProgram().empty() && !File(getProgram(), getContext().getFileStorage()).isGeneratedAtAll() &&
         !path(getProgram()).is_absolute() && !fs::exists(getProgram()))
     {
-        auto new_prog = resolveExecutable(getProgram());
+        auto new_prog = getContext().getProcessLauncher().resolveProgram(getProgram());
         if (new_prog.empty())
             throw SW_RUNTIME_ERROR("passed program '" + getProgram() + "' is not resolved (missing): " + getCommandId(*this));
         setProgram(new_prog);
     }
 
+    // arguments are not changed after this point
+    getRenderedArguments();
+    arguments_rendered = true;
+
     // extra check
     //if (!program)
         //throw SW_RUNTIME_ERROR("empty program: " + getCommandId(*this));
@@ -548,10 +767,43 @@ void Command::execute0(std::error_code *ec)
 
     if (!beforeCommand())
         return;
-    execute1(ec); // main thing
+    auto t0 = Clock::now();
+    if (restoreFromActionCache())
+    {
+        execution_time = Clock::now() - t0;
+        afterCommand();
+        return;
+    }
+    try
+    {
+        execute1(ec); // main thing
+    }
+    catch (...)
+    {
+        execution_time = Clock::now() - t0;
+        afterFailedCommand();
+        throw;
+    }
+    execution_time = Clock::now() - t0;
     if (ec && *ec)
+    {
+        afterFailedCommand();
         return;
+    }
     afterCommand();
+    storeToActionCache();
+}
+
+static CommandExecutionRecord makeExecutionRecord(const Command &c, bool ok)
+{
+    CommandExecutionRecord e;
+    e.duration = std::chrono::duration_cast<CommandRecord::Duration>(c.execution_time).count();
+    e.peak_rss = c.peak_rss;
+    if (c.exit_code)
+        e.exit_code = c.exit_code.value();
+    else if (!ok)
+        e.exit_code = -1;
+    return e;
 }
 
 bool Command::beforeCommand()
@@ -569,8 +821,7 @@ bool Command::beforeCommand()
 
     if (!isOutdated())
     {
-        executed_ = true;
-        (*current_command)++;
+        markUpToDate();
         return false;
     }
 
@@ -587,6 +838,14 @@ bool Command::beforeCommand()
     return true;
 }
 
+void Command::markUpToDate()
+{
+    executed_ = true;
+    up_to_date_ = true;
+    if (current_command)
+        (*current_command)++;
+}
+
 void Command::afterCommand()
 {
     // command executed successfully
@@ -623,14 +882,32 @@ void Command::afterCommand()
     // sometimes, implicit input was not created before it is registered with File(fn) - configureFile() etc.
     // in this case here we have fr.last_write_time == min()
     // so, we must register this file again
-    for (auto &i : implicit_inputs)
+    // ids are set when all implicit inputs come from deps parsers
+    auto &s = command_storage->getInternalStorage();
+    bool use_ids = !implicit_input_ids.empty() && implicit_input_ids.size() == implicit_inputs.size();
+    if (use_ids)
     {
-        File f(i, getContext().getFileStorage());
-        auto &fr = f.getFileData();
-        if (fr.last_write_time == fs::file_time_type::min())
+        for (auto id : implicit_input_ids)
+        {
+            auto &fr = s.getFileData(id, getContext().getFileStorage());
+            if (fr.last_write_time == fs::file_time_type::min())
+            {
+                fr.refreshed = FileData::RefreshType::Unrefreshed;
+                fr.isChanged(s.paths.get(id));
+            }
+        }
+    }
+    else
+    {
+        for (auto &i : implicit_inputs)
         {
-            fr.refreshed = FileData::RefreshType::Unrefreshed;
-            f.isChanged();
+            File f(i, getContext().getFileStorage());
+            auto &fr = f.getFileData();
+            if (fr.last_write_time == fs::file_time_type::min())
+            {
+                fr.refreshed = FileData::RefreshType::Unrefreshed;
+                f.isChanged();
+            }
         }
     }
 
@@ -647,7 +924,46 @@ void Command::afterCommand()
     auto &r = *command_storage->insert(k).first;
     r.hash = k;
     r.mtime = mtime;
-    r.setImplicitInputs(implicit_inputs, command_storage->getInternalStorage());
+    if (use_ids)
+        r.setImplicitInputs(implicit_input_ids, s);
+    else
+        r.setImplicitInputs(implicit_inputs, s);
+    r.inputs_hash = 0;
+    if (use_content_hash)
+    {
+        try
+        {
+            r.inputs_hash = getInputsHash();
+        }
+        catch (std::exception &e)
+        {
+            // command will be checked by time next time
+            LOG_DEBUG(logger, "Cannot hash inputs of command " << getName() << ": " << e.what());
+        }
+    }
+
+    auto e = makeExecutionRecord(*this, true);
+    if (auto avg = r.getAverageDuration(); avg && avg->count() > 1000 && e.duration > 2 * avg->count())
+    {
+        LOG_DEBUG(logger, "Command is much slower than usual (" << e.duration / 1000.0 << " s. vs "
+            << avg->count() / 1000.0 << " s. on average): " << getName());
+    }
+    r.addExecution(e);
+
+    command_storage->async_command_log(r);
+}
+
+void Command::afterFailedCommand()
+{
+    if (!command_storage)
+        return;
+
+    // keep failures in history too
+    // new record has minimal mtime, so command stays outdated
+    auto k = getHash();
+    auto &r = *command_storage->insert(k).first;
+    r.hash = k;
+    r.addExecution(makeExecutionRecord(*this, false));
     command_storage->async_command_log(r);
 }
 
@@ -656,14 +972,44 @@ path Command::getResponseFilename() const
     return unique_path() += ".rsp";
 }
 
+const Strings &Command::getRenderedArguments() const
+{
+    if (!arguments_rendered || rendered_arguments.size() != arguments.size())
+    {
+        rendered_arguments.clear();
+        rendered_arguments.reserve(arguments.size());
+        for (auto &a : arguments)
+            rendered_arguments.push_back(a->toString());
+    }
+    return rendered_arguments;
+}
+
+ArgvBuilder Command::getArgv() const
+{
+    // response file arguments are few, others are rendered already
+    if (!rsp_args.empty())
+    {
+        Strings args;
+        for (auto &a : rsp_args)
+            args.push_back(a->toString());
+        return args;
+    }
+    return getRenderedArguments();
+}
+
 String Command::getResponseFileContents(bool showIncludes) const
 {
+    auto &ra = getRenderedArguments();
+    size_t sz = 0;
+    for (size_t i = getFirstResponseFileArgument(); i < ra.size(); i++)
+        sz += ra[i].size() + 3; // quotes and new line
     String rsp;
-    for (auto a = arguments.begin() + getFirstResponseFileArgument(); a != arguments.end(); a++)
+    rsp.reserve(sz);
+    for (size_t i = getFirstResponseFileArgument(); i < ra.size(); i++)
     {
-        if (!showIncludes && (*a)->toString() == "-showIncludes")
+        if (!showIncludes && ra[i] == "-showIncludes")
             continue;
-        rsp += (*a)->quote(protect_args_with_quotes ? QuoteType::SimpleAndEscape : QuoteType::Escape);
+        rsp += arguments[i]->quote(protect_args_with_quotes ? QuoteType::SimpleAndEscape : QuoteType::Escape);
         rsp += "\n";
     }
     if (!rsp.empty())
@@ -743,7 +1089,7 @@ void Command::execute1(std::error_code *ec)
 
     if (ec)
     {
-        Base::execute(*ec);
+        executeProcess(*ec, rsp_file);
         if (ec)
         {
             // TODO: save error string
@@ -754,7 +1100,7 @@ void Command::execute1(std::error_code *ec)
     else
     {
         std::error_code ec;
-        Base::execute(ec);
+        executeProcess(ec, rsp_file);
         if (ec)
         {
             auto err = make_error_string();
@@ -771,6 +1117,34 @@ void Command::execute1(std::error_code *ec)
     printOutputs();
 }
 
+bool Command::isRemotelyExecutable() const
+{
+    // redirections are not supported
+    if (!(in.file.empty() && out.file.empty() && err.file.empty() && !in.inherit && !out.inherit && !err.inherit))
+        return false;
+    // only implicit inputs of the previous run are sent, they are unknown for new commands
+    return deps_processor == DepsProcessor::Undefined || !implicit_inputs.empty();
+}
+
+void Command::executeProcess(std::error_code &ec, const path &rsp_file)
+{
+    if (remote_executor && isRemotelyExecutable())
+    {
+        Files additional_inputs;
+        if (!rsp_file.empty())
+            additional_inputs.insert(rsp_file);
+        if (remote_executor->execute(*this, additional_inputs))
+            return;
+    }
+    if (sw::Settings::get_user_settings().use_process_launcher && ProcessLauncher::isSupported())
+    {
+        auto argv = getArgv();
+        if (getContext().getProcessLauncher().execute(*this, argv, ec, &peak_rss))
+            return;
+    }
+    Base::execute(ec);
+}
+
 void Command::printOutputs()
 {
     if (!show_output)
@@ -1046,16 +1420,28 @@ void Command::postProcess(bool ok)
 {
     // clear deps, otherwise they will stack up
     implicit_inputs.clear();
+    implicit_input_ids.clear();
+
+    String normalized;
+    auto add = [this, &normalized](std::string_view p)
+    {
+        if (p.find('\\') != p.npos)
+        {
+            normalized = normalize_path(fs::u8path(p.begin(), p.end()));
+            p = normalized;
+        }
+        addImplicitInputFromDeps(p);
+    };
 
     switch (deps_processor)
     {
     case DepsProcessor::Msvc:
         // process anyway to filter out deps
-        addImplicitInput(process_deps_msvc(*this));
+        process_deps_msvc(*this, add);
         break;
     case DepsProcessor::Gnu:
         if (ok)
-            addImplicitInput(process_deps_gnu(*this, deps_file));
+            process_deps_gnu(deps_file, add);
         break;
     case DepsProcessor::Custom:
     {
@@ -1100,8 +1486,9 @@ bool Command::needsResponseFile(size_t selected_size) const
 {
     // 3 = 1 + 2 = space + quotes
     size_t sz = getProgram().size() + 3;
-    for (auto a = arguments.begin() + getFirstResponseFileArgument(); a != arguments.end(); a++)
-        sz += (*a)->toString().size() + 3;
+    auto &ra = getRenderedArguments();
+    for (size_t i = getFirstResponseFileArgument(); i < ra.size(); i++)
+        sz += ra[i].size() + 3;
 
     if (use_response_files)
     {
@@ -1216,6 +1603,22 @@ bool Command::lessDuringExecution(const CommandNode &in) const
     return dependent_commands.size() > dependent_commands.size();
 }
 
+CommandNode::Duration Command::getEstimatedDuration() const
+{
+    if (command_storage)
+    {
+        if (auto r = command_storage->find(getHash()))
+        {
+            if (auto d = r->getAverageDuration())
+                return *d;
+        }
+    }
+
+    // no history, so make a rough guess from the command shape:
+    // links have many inputs, compilations have many implicit inputs (headers)
+    return Duration(100 + 20 * inputs.size() + implicit_inputs.size());
+}
+
 void Command::onBeforeRun() noexcept
 {
     tid = std::this_thread::get_id();
@@ -1269,9 +1672,17 @@ void CommandSequence::execute1(std::error_code *ec)
 
 size_t CommandSequence::getHash1() const
 {
-    size_t h = 0;
+    uint64_t h = 0;
+    for (auto &c : commands)
+        stable_hash_combine(h, c->getHash());
+    return h;
+}
+
+uint64_t CommandSequence::getActionHash(const path &root) const
+{
+    uint64_t h = 0;
     for (auto &c : commands)
-        hash_combine(h, c->getHash());
+        stable_hash_combine(h, c->getActionHash(root));
     return h;
 }
 
@@ -1327,10 +1738,7 @@ void BuiltinCommand::execute1(std::error_code *ec)
 {
     // add try catch?
 
-    Strings sa;
-    for (auto &a : arguments)
-        sa.push_back(a->toString());
-
+    auto &sa = getRenderedArguments();
     auto start = getFirstResponseFileArgument();
     jumppad_call(
         sa[start + 0],
@@ -1348,21 +1756,15 @@ size_t BuiltinCommand::getHash1() const
     // 3: function name
     // 4: version
 
-    size_t h = 0;
-
-    // must sort arguments first
+    // arguments are hashed in any order
     // because some command may generate args in unspecified order
-    std::set<String> args_sorted;
-
     // we ignore args 0-2 inclusive, so our start arg is 3
-    auto start = 3;
-    for (auto a = arguments.begin() + start; a != arguments.end(); a++)
-        args_sorted.insert((*a)->toString());
-
-    for (auto &a : args_sorted)
-        hash_combine(h, std::hash<String>()(a));
-
-    return h;
+    size_t start = 3;
+    auto &ra = getRenderedArguments();
+    UnorderedHash h;
+    for (auto i = start; i < ra.size(); i++)
+        h.add(ra[i]);
+    return h.get();
 }
 
 String getInternalCallBuiltinFunctionName()
@@ -18,11 +18,14 @@
 
 #pragma once
 
+#include "argv.h"
 #include "node.h"
+#include "path_table.h"
 
 #include <primitives/command.h>
 #include <primitives/executor.h>
 
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 
@@ -32,10 +35,14 @@ namespace sw
 struct Program;
 struct SwBuilderContext;
 struct CommandStorage;
+struct CommandRecord;
+struct RemoteActionCache;
+struct RemoteExecutor;
 
 struct SW_BUILDER_API CommandNode : std::enable_shared_from_this<CommandNode>
 {
     using SPtr = std::shared_ptr<CommandNode>;
+    using Duration = std::chrono::milliseconds;
 
     std::unordered_set<SPtr> dependencies;
 
@@ -56,6 +63,8 @@ struct SW_BUILDER_API CommandNode : std::enable_shared_from_this<CommandNode>
     virtual void prepare() = 0; // some internal preparations, command may not be executed still
     //virtual void markForExecution() {} // not command can be sure, it will be executed
     virtual bool lessDuringExecution(const CommandNode &) const = 0;
+    // used by schedulers, returns best guess of execution time
+    virtual Duration getEstimatedDuration() const;
 
     void clear()
     {
@@ -156,6 +165,10 @@ public:
     bool remove_outputs_before_execution = false; // was true
     bool protect_args_with_quotes = true;
     bool always = false;
+    bool use_content_hash = false; // compare inputs by content instead of time
+    bool use_action_cache = false; // restore outputs from local action cache
+    RemoteActionCache *remote_cache = nullptr;
+    RemoteExecutor *remote_executor = nullptr; // run process on distributed build server
     bool do_not_save_command = false;
     bool silent = false; // no log record
     bool show_output = false; // no command output
@@ -166,6 +179,8 @@ public:
     std::thread::id tid;
     Clock::time_point t_begin;
     Clock::time_point t_end;
+    Clock::duration execution_time{}; // measured around the whole execution, builtin commands too
+    uint64_t peak_rss = 0; // bytes, 0 when unknown
 
     // cs
     path command_storage_root; // used during deserialization to restore command_storage
@@ -190,9 +205,15 @@ public:
     void execute(std::error_code &ec) override;
     void clean() const;
     bool isExecuted() const { return pid != -1 || executed_; }
+    bool isUpToDate() const { return up_to_date_; } // was not executed because nothing changed
+    void markUpToDate();
 
     String getName(bool short_name = false) const override;
     size_t getHash() const override;
+    /// hash of command line for action cache, paths under root are replaced (see toRelativeActionPath())
+    virtual uint64_t getActionHash(const path &root) const;
+    /// common directory of outputs, inputs and working directory, empty if there is none
+    path getActionRoot() const;
 
     virtual bool isOutdated() const;
     bool needsResponseFile() const;
@@ -211,16 +232,23 @@ public:
     path redirectStdout(const path &p, bool append = false);
     path redirectStderr(const path &p, bool append = false);
     Files getGeneratedDirs() const; // used by generators
+    /// implicit inputs are made from command storage record when command is up to date
+    Files getImplicitInputs() const;
     void addInputOutputDeps();
     path writeCommand(const path &basename, bool print_name = true) const;
 
     bool lessDuringExecution(const CommandNode &rhs) const override;
+    Duration getEstimatedDuration() const override;
 
     void onBeforeRun() noexcept override;
     void onEnd() noexcept override;
 
     path getResponseFilename() const;
     virtual String getResponseFileContents(bool showIncludes = false) const;
+    /// toString() of arguments, made once after prepare()
+    const Strings &getRenderedArguments() const;
+    /// what is passed to the process, response file is used after execution is started
+    ArgvBuilder getArgv() const;
     int getFirstResponseFileArgument() const;
 
     Arguments &getArguments() override;
@@ -235,6 +263,8 @@ public:
 protected:
     bool prepared = false;
     bool executed_ = false;
+    bool up_to_date_ = false;
+    bool arguments_rendered = false;
 
     virtual bool check_if_file_newer(const path &, const String &what, bool throw_on_missing) const;
 
@@ -243,15 +273,31 @@ private:
     mutable size_t hash = 0;
     Arguments rsp_args;
     mutable String log_string;
+    mutable Strings rendered_arguments;
+    // implicit inputs from command storage, files are made only when command is outdated
+    std::vector<PathTable::Id> implicit_input_ids;
 
     void execute0(std::error_code *ec);
+    void addImplicitInputFromDeps(std::string_view normalized_path);
     virtual void execute1(std::error_code *ec = nullptr);
+    bool isRemotelyExecutable() const;
+    void executeProcess(std::error_code &ec, const path &rsp_file);
     virtual size_t getHash1() const;
 
     void postProcess(bool ok = true);
     bool beforeCommand();
     void afterCommand();
+    void afterFailedCommand();
     bool isTimeChanged() const;
+    bool isImplicitInputChanged() const;
+    bool isContentChanged(const CommandRecord &) const;
+    uint64_t getInputsHash() const;
+    uint64_t getContentHash(const Files &, const path &root = {}) const;
+    bool isActionCacheable() const;
+    uint64_t getActionKey(const path &root) const;
+    uint64_t getActionKey(const path &root, uint64_t inputs_key, const Files &implicit_inputs) const;
+    bool restoreFromActionCache();
+    void storeToActionCache(bool upload = true);
     void printLog() const;
     size_t getHashAndSave() const;
     String makeErrorString();
@@ -281,6 +327,7 @@ private:
 
     void execute1(std::error_code *ec = nullptr) override;
     size_t getHash1() const override;
+    uint64_t getActionHash(const path &root) const override;
     void prepare() override;
 };
 
@@ -0,0 +1,387 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "command_db.h"
+
+#include <primitives/exceptions.h>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "command_db");
+
+#define COMMAND_DB_MAGIC 0x42445753 // SWDB
+
+namespace sw
+{
+
+static_assert(std::is_trivially_copyable_v<CommandExecutionRecord>);
+
+static int64_t to_int(const fs::file_time_type &t)
+{
+    return t.time_since_epoch().count();
+}
+
+static fs::file_time_type from_int(int64_t v)
+{
+    return fs::file_time_type(fs::file_time_type::duration(v));
+}
+
+CommandDb::CommandDb(const path &fn, uint32_t version)
+    : fn(fn)
+{
+    using namespace boost::interprocess;
+
+    try
+    {
+        m = file_mapping(fn.string().c_str(), read_write);
+        r = mapped_region(m, read_write);
+    }
+    catch (interprocess_exception &)
+    {
+        // no in place updates then
+        m = file_mapping(fn.string().c_str(), read_only);
+        r = mapped_region(m, read_only);
+    }
+
+    if (r.get_size() < sizeof(Header))
+        throw SW_RUNTIME_ERROR("Bad command db: " + normalize_path(fn));
+    auto &h = header();
+    if (h.magic != COMMAND_DB_MAGIC || h.version != version)
+        throw SW_RUNTIME_ERROR("Bad command db version: " + normalize_path(fn));
+    auto sz = sizeof(Header) +
+        h.n_files * sizeof(FileEntry) +
+        h.n_groups * sizeof(GroupEntry) +
+        h.n_commands * sizeof(CommandEntry) +
+        (h.n_group_files + h.n_delta_files) * sizeof(uint32_t) +
+        h.strings_size;
+    if (sz != r.get_size())
+        throw SW_RUNTIME_ERROR("Bad command db size: " + normalize_path(fn));
+}
+
+const CommandDb::FileEntry *CommandDb::files() const
+{
+    return (const FileEntry *)((const char *)r.get_address() + sizeof(Header));
+}
+
+const CommandDb::GroupEntry *CommandDb::groups() const
+{
+    return (const GroupEntry *)(files() + header().n_files);
+}
+
+CommandDb::CommandEntry *CommandDb::commands() const
+{
+    return (CommandEntry *)(groups() + header().n_groups);
+}
+
+const uint32_t *CommandDb::groupFiles() const
+{
+    return (const uint32_t *)(commands() + header().n_commands);
+}
+
+const uint32_t *CommandDb::deltaFiles() const
+{
+    return groupFiles() + header().n_group_files;
+}
+
+const char *CommandDb::strings() const
+{
+    return (const char *)(deltaFiles() + header().n_delta_files);
+}
+
+const CommandDb::CommandEntry *CommandDb::findCommand(size_t hash) const
+{
+    auto b = commands();
+    auto e = b + header().n_commands;
+    auto i = std::lower_bound(b, e, hash, [](const auto &c, auto h) { return c.hash < h; });
+    if (i == e || i->hash != hash)
+        return nullptr;
+    return i;
+}
+
+const CommandDb::FileEntry *CommandDb::findFile(size_t path_hash) const
+{
+    auto b = files();
+    auto e = b + header().n_files;
+    auto i = std::lower_bound(b, e, path_hash, [](const auto &f, auto h) { return f.path_hash < h; });
+    if (i == e || i->path_hash != path_hash)
+        return nullptr;
+    return i;
+}
+
+uint32_t CommandDb::findGroup(uint64_t hash) const
+{
+    auto b = groups();
+    auto e = b + header().n_groups;
+    auto i = std::lower_bound(b, e, hash, [](const auto &g, auto h) { return g.hash < h; });
+    if (i == e || i->hash != hash)
+        return no_group;
+    return (uint32_t)(i - b);
+}
+
+std::string_view CommandDb::getPath(const FileEntry &f) const
+{
+    return { strings() + f.offset, f.length };
+}
+
+DepGroupPtr CommandDb::readGroup(uint32_t index) const
+{
+    if (index >= header().n_groups)
+        throw SW_RUNTIME_ERROR("Bad dep group index: " + std::to_string(index));
+    auto &e = groups()[index];
+    auto g = std::make_shared<DepGroup>();
+    g->hash = e.hash;
+    g->files.reserve(e.count);
+    // file table is sorted, so members are sorted too
+    for (uint64_t i = 0; i < e.count; i++)
+        g->files.push_back(files()[groupFiles()[e.offset + i]].path_hash);
+    return g;
+}
+
+void CommandDb::read(const CommandEntry &e, CommandRecord &rec, detail::Storage &s) const
+{
+    rec.hash = e.hash;
+    rec.mtime = from_int(e.mtime);
+    rec.inputs_hash = e.inputs_hash;
+    auto &ii = rec.implicit_inputs;
+    ii.group = e.group == no_group ? nullptr : s.getBaseDepGroup(e.group);
+    ii.added.clear();
+    ii.removed.clear();
+    auto d = deltaFiles() + e.delta;
+    for (uint32_t i = 0; i < e.n_added; i++)
+        ii.added.push_back(files()[*d++].path_hash);
+    for (uint32_t i = 0; i < e.n_removed; i++)
+        ii.removed.push_back(files()[*d++].path_hash);
+    rec.history.assign(e.history, e.history + std::min<size_t>(e.history_size, CommandRecord::max_history_size));
+}
+
+bool CommandDb::update(const CommandRecord &rec)
+{
+    if (r.get_mode() != boost::interprocess::read_write)
+        return false;
+    auto e = const_cast<CommandEntry *>(findCommand(rec.hash));
+    if (!e || rec.history.size() > CommandRecord::max_history_size)
+        return false;
+
+    // same encoding of implicit inputs, records read from here keep it
+    auto &ii = rec.implicit_inputs;
+    if (e->group == no_group ? ii.group != nullptr : !ii.group || groups()[e->group].hash != ii.group->hash)
+        return false;
+    if (e->n_added != ii.added.size() || e->n_removed != ii.removed.size())
+        return false;
+    auto d = deltaFiles() + e->delta;
+    for (auto h : ii.added)
+    {
+        if (files()[*d++].path_hash != h)
+            return false;
+    }
+    for (auto h : ii.removed)
+    {
+        if (files()[*d++].path_hash != h)
+            return false;
+    }
+
+    // mtime goes last, so partially written record stays outdated
+    std::copy(rec.history.begin(), rec.history.end(), e->history);
+    e->history_size = (uint32_t)rec.history.size();
+    e->inputs_hash = rec.inputs_hash;
+    e->mtime = to_int(rec.mtime);
+    return true;
+}
+
+void CommandDb::write(const path &fn, const CommandDb *base, detail::Storage &logs)
+{
+    // files
+    struct NewFile
+    {
+        uint64_t path_hash;
+        const FileEntry *base;
+        const path *p;
+    };
+    std::vector<NewFile> nf;
+    if (base)
+    {
+        nf.reserve(base->getNumberOfFiles() + logs.paths.size());
+        for (size_t i = 0; i < base->getNumberOfFiles(); i++)
+            nf.push_back({ base->files()[i].path_hash, &base->files()[i], nullptr });
+    }
+    for (PathTable::Id i = 0; i < logs.paths.size(); i++)
+    {
+        auto h = logs.paths.getHash(i);
+        auto &p = logs.paths.get(i);
+        if (!p.empty() && (!base || !base->findFile(h)))
+            nf.push_back({ h, nullptr, &p });
+    }
+    std::sort(nf.begin(), nf.end(), [](const auto &a, const auto &b) { return a.path_hash < b.path_hash; });
+
+    std::vector<FileEntry> files;
+    files.reserve(nf.size());
+    String strings;
+    for (auto &f : nf)
+    {
+        auto s = f.base ? String(base->getPath(*f.base)) : normalize_path(*f.p);
+        FileEntry e{};
+        e.path_hash = f.path_hash;
+        e.offset = strings.size();
+        e.length = s.size();
+        strings += s;
+        // logs contain newer records
+        if (auto i = logs.file_hashes.find(f.path_hash); i != logs.file_hashes.end())
+        {
+            e.mtime = to_int(i->second.mtime);
+            e.size = i->second.size;
+            e.hash = i->second.hash;
+        }
+        else if (f.base)
+        {
+            e.mtime = f.base->mtime;
+            e.size = f.base->size;
+            e.hash = f.base->hash;
+        }
+        else
+        {
+            e.mtime = to_int(fs::file_time_type::min());
+            e.size = -1;
+        }
+        files.push_back(e);
+    }
+
+    auto find_file = [&files](uint64_t h) -> int64_t
+    {
+        auto i = std::lower_bound(files.begin(), files.end(), h, [](const auto &f, auto h) { return f.path_hash < h; });
+        if (i == files.end() || i->path_hash != h)
+            return -1;
+        return i - files.begin();
+    };
+    // lost file records are skipped
+    auto add_files = [&find_file](const auto &from, auto &to)
+    {
+        uint32_t n = 0;
+        for (auto h : from)
+        {
+            auto i = find_file(h);
+            if (i == -1)
+                continue;
+            to.push_back((uint32_t)i);
+            n++;
+        }
+        return n;
+    };
+
+    // commands, merge sorted tables, log records replace base ones
+    std::vector<std::pair<size_t, CommandRecord *>> lc;
+    for (auto &[h, r] : logs.storage.snapshot())
+    {
+        if (r->hash)
+            lc.emplace_back(h, r);
+    }
+    std::sort(lc.begin(), lc.end());
+
+    std::vector<std::pair<const CommandRecord *, const CommandEntry *>> merged;
+    merged.reserve(lc.size() + (base ? base->getNumberOfCommands() : 0));
+    auto li = lc.begin();
+    for (size_t i = 0; base && i < base->getNumberOfCommands(); i++)
+    {
+        auto &c = base->commands()[i];
+        while (li != lc.end() && li->first < c.hash)
+            merged.emplace_back((li++)->second, nullptr);
+        if (li != lc.end() && li->first == c.hash)
+            merged.emplace_back((li++)->second, nullptr);
+        else
+            merged.emplace_back(nullptr, &c);
+    }
+    while (li != lc.end())
+        merged.emplace_back((li++)->second, nullptr);
+
+    // only referenced groups are kept
+    std::map<uint64_t, DepGroupPtr> used_groups;
+    for (auto &[r, c] : merged)
+    {
+        if (r && r->implicit_inputs.group)
+            used_groups.emplace(r->implicit_inputs.group->hash, r->implicit_inputs.group);
+        else if (c && c->group != no_group)
+            used_groups.emplace(base->groups()[c->group].hash, nullptr);
+    }
+
+    std::vector<GroupEntry> groups;
+    std::vector<uint32_t> group_files;
+    std::unordered_map<uint64_t, uint32_t> group_index;
+    groups.reserve(used_groups.size());
+    for (auto &[h, g] : used_groups)
+    {
+        if (!g)
+            g = base->readGroup(base->findGroup(h));
+        GroupEntry e{};
+        e.hash = h;
+        e.offset = group_files.size();
+        e.count = add_files(g->files, group_files);
+        group_index[h] = (uint32_t)groups.size();
+        groups.push_back(e);
+    }
+
+    std::vector<CommandEntry> commands;
+    std::vector<uint32_t> delta_files;
+    commands.reserve(merged.size());
+    for (auto &[r, c] : merged)
+    {
+        CommandEntry e{};
+        if (r)
+        {
+            e.hash = r->hash;
+            e.mtime = to_int(r->mtime);
+            e.inputs_hash = r->inputs_hash;
+            auto &ii = r->implicit_inputs;
+            e.group = ii.group ? group_index[ii.group->hash] : no_group;
+            e.delta = delta_files.size();
+            e.n_added = add_files(ii.added, delta_files);
+            e.n_removed = add_files(ii.removed, delta_files);
+            e.history_size = (uint32_t)std::min(r->history.size(), CommandRecord::max_history_size);
+            std::copy(r->history.end() - e.history_size, r->history.end(), e.history);
+        }
+        else
+        {
+            e = *c;
+            e.group = c->group == no_group ? no_group : group_index[base->groups()[c->group].hash];
+            e.delta = delta_files.size();
+            auto d = base->deltaFiles() + c->delta;
+            for (uint32_t i = 0; i < c->n_added + c->n_removed; i++)
+                delta_files.push_back((uint32_t)find_file(base->files()[d[i]].path_hash));
+        }
+        commands.push_back(e);
+    }
+
+    Header h{};
+    h.magic = COMMAND_DB_MAGIC;
+    h.version = COMMAND_DB_FORMAT_VERSION;
+    h.n_files = files.size();
+    h.n_groups = groups.size();
+    h.n_commands = commands.size();
+    h.n_group_files = group_files.size();
+    h.n_delta_files = delta_files.size();
+    h.strings_size = strings.size();
+
+    // readers always see complete file
+    auto tmp = path(fn) += ".tmp";
+    fs::create_directories(fn.parent_path());
+    {
+        ScopedFile f(tmp, "wb");
+        auto write = [&f, &tmp](const void *p, size_t sz)
+        {
+            if (sz && fwrite(p, sz, 1, f.getHandle()) != 1)
+                throw SW_RUNTIME_ERROR("Cannot write: " + normalize_path(tmp));
+        };
+        write(&h, sizeof(h));
+        write(files.data(), files.size() * sizeof(FileEntry));
+        write(groups.data(), groups.size() * sizeof(GroupEntry));
+        write(commands.data(), commands.size() * sizeof(CommandEntry));
+        write(group_files.data(), group_files.size() * sizeof(uint32_t));
+        write(delta_files.data(), delta_files.size() * sizeof(uint32_t));
+        write(strings.data(), strings.size());
+        if (fflush(f.getHandle()) != 0)
+            throw SW_RUNTIME_ERROR("Cannot write: " + normalize_path(tmp));
+    }
+    fs::rename(tmp, fn);
+
+    LOG_TRACE(logger, "Command db " << normalize_path(fn) << " is written: " << commands.size() << " commands, "
+        << groups.size() << " dep groups, " << files.size() << " files");
+}
+
+}
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include "command_storage.h"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#define COMMAND_DB_FORMAT_VERSION 12
+// versions since this one have the same layout and are converted,
+// but their path and dep group hashes were made by std::hash (and content hashes in version 10)
+#define COMMAND_DB_OLDEST_CONVERTED_FORMAT_VERSION 10
+
+namespace sw
+{
+
+/// Memory mapped base file of command storage.
+///
+/// Layout: header, file table sorted by path hash, dep group table sorted by group hash,
+/// command table sorted by command hash, group members and command deltas
+/// (indices in file table), string pool with paths.
+/// Commands refer to a shared dep group and keep only their difference from it.
+/// All tables have fixed size entries, so records are found by binary search
+/// and read only when requested.
+/// Newer records are kept in append logs and merged here by compaction.
+struct SW_BUILDER_API CommandDb
+{
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t n_files;
+        uint64_t n_groups;
+        uint64_t n_commands;
+        uint64_t n_group_files;
+        uint64_t n_delta_files;
+        uint64_t strings_size;
+    };
+
+    struct FileEntry
+    {
+        uint64_t path_hash;
+        uint64_t offset; // in string pool
+        uint64_t length;
+        // content info, size is -1 when file was not hashed
+        int64_t mtime;
+        int64_t size;
+        uint64_t hash;
+    };
+
+    struct GroupEntry
+    {
+        uint64_t hash;
+        uint64_t offset; // first index in group files table
+        uint64_t count;
+    };
+
+    static constexpr uint32_t no_group = ~0;
+
+    struct CommandEntry
+    {
+        uint64_t hash;
+        int64_t mtime;
+        uint64_t inputs_hash;
+        uint64_t delta; // first index in delta files table, added files go first
+        uint32_t group; // index in group table or no_group
+        uint32_t n_added;
+        uint32_t n_removed;
+        uint32_t history_size;
+        CommandExecutionRecord history[CommandRecord::max_history_size];
+    };
+
+    /// throws on bad file
+    CommandDb(const path &fn, uint32_t version = COMMAND_DB_FORMAT_VERSION);
+    CommandDb(const CommandDb &) = delete;
+    CommandDb &operator=(const CommandDb &) = delete;
+
+    const path &getFilename() const { return fn; }
+    size_t getNumberOfCommands() const { return header().n_commands; }
+    size_t getNumberOfFiles() const { return header().n_files; }
+    size_t getNumberOfGroups() const { return header().n_groups; }
+    const CommandEntry &getCommand(size_t index) const { return commands()[index]; }
+
+    const CommandEntry *findCommand(size_t hash) const;
+    const FileEntry *findFile(size_t path_hash) const;
+    /// returns index or no_group
+    uint32_t findGroup(uint64_t hash) const;
+    std::string_view getPath(const FileEntry &) const;
+
+    /// dep group is taken from storage, so it is shared with other records
+    void read(const CommandEntry &, CommandRecord &, detail::Storage &) const;
+    /// returns sorted path hashes
+    DepGroupPtr readGroup(uint32_t index) const;
+    /// updates record in place when its implicit inputs are the same,
+    /// returns false otherwise
+    bool update(const CommandRecord &);
+
+    /// writes new base file from the old one and records from logs
+    static void write(const path &fn, const CommandDb *base, detail::Storage &logs);
+
+private:
+    path fn;
+    boost::interprocess::file_mapping m;
+    boost::interprocess::mapped_region r;
+
+    const Header &header() const { return *(const Header *)r.get_address(); }
+    const FileEntry *files() const;
+    const GroupEntry *groups() const;
+    CommandEntry *commands() const;
+    const uint32_t *groupFiles() const;
+    const uint32_t *deltaFiles() const;
+    const char *strings() const;
+};
+
+}
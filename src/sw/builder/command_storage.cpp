@@ -18,24 +18,29 @@
 
 #include "command_storage.h"
 
+#include "command_db.h"
+#include "file.h"
 #include "file_storage.h"
+#include "stable_hash.h"
 #include "sw_context.h"
 
+#include <sw/manager/settings.h>
 #include <sw/manager/storage.h>
+#include <sw/support/hash.h>
 
-#include <boost/thread/lock_types.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
 #include <primitives/emitter.h>
 #include <primitives/executor.h>
 #include <primitives/date_time.h>
 #include <primitives/debug.h>
 #include <primitives/exceptions.h>
-#include <primitives/lock.h>
+#include <primitives/string.h>
 #include <primitives/symbol.h>
 
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "db_file");
 
-#define COMMAND_DB_FORMAT_VERSION 4
+#define LOG_RECORD_MAGIC 0x434c5753 // SWLC
 
 namespace sw
 {
@@ -50,20 +55,247 @@ static String getCurrentModuleNameHash()
     return shorten_hash(blake2b_512(getCurrentModuleName().u8string()), 12);
 }
 
-static path getDir(const path &root)
+static path getDir(const path &root, int version = COMMAND_DB_FORMAT_VERSION)
 {
-    return root / "db";
+    return root / "db" / std::to_string(version);
 }
 
-static path getCommandsDbFilename(const path &root)
+static path getCommandsDbFilename(const path &root, int version = COMMAND_DB_FORMAT_VERSION)
 {
-    return getDir(root) / std::to_string(COMMAND_DB_FORMAT_VERSION) / "commands.bin";
+    return getDir(root, version) / "commands.db";
 }
 
-static path getCommandsLogFileName(const path &root)
+// complete base file that was not moved in place yet
+static path getNewCommandsDbFilename(const path &root)
+{
+    return path(getCommandsDbFilename(root)) += ".new";
+}
+
+// names of log segments merged into new base file
+static path getNewCommandsDbSegmentsFilename(const path &root)
+{
+    return path(getNewCommandsDbFilename(root)) += ".segments";
+}
+
+static path getCompactionLockFilename(const path &root)
+{
+    return getDir(root) / "compact.lock";
+}
+
+static path getLogDir(const path &root, int version = COMMAND_DB_FORMAT_VERSION)
+{
+    return getDir(root, version) / "logs";
+}
+
+static String getFilesSuffix()
+{
+    return ".files";
+}
+
+static String getGroupsSuffix()
+{
+    return ".groups";
+}
+
+static path getSegmentLockFilename(const path &fn)
+{
+    return path(fn).replace_extension(".lock");
+}
+
+// new segment for every process and every compaction
+static String getSegmentName()
 {
     auto cfg = shorten_hash(blake2b_512(getCurrentModuleNameHash()), 12);
-    return getDir(root) / std::to_string(COMMAND_DB_FORMAT_VERSION) / ("cmd_log_" + cfg + ".bin");
+    return "cmd_log_" + cfg + "_" + unique_path("%%%%%%%%%%%%").u8string() + ".bin";
+}
+
+// all segments, older first
+static std::vector<path> getLogSegments(const path &root, int version = COMMAND_DB_FORMAT_VERSION)
+{
+    std::unordered_set<String> names;
+    for (auto &e : fs::directory_iterator(getLogDir(root, version)))
+    {
+        auto n = e.path().filename().u8string();
+        for (auto &suffix : { ".bin" + getFilesSuffix(), ".bin" + getGroupsSuffix(), String(".lock") })
+        {
+            if (n.size() > suffix.size() && n.compare(n.size() - suffix.size(), suffix.size(), suffix) == 0)
+            {
+                n = n.substr(0, n.size() - suffix.size()) + ".bin";
+                break;
+            }
+        }
+        if (n.size() > 4 && n.compare(n.size() - 4, 4, ".bin") == 0)
+            names.insert(n);
+    }
+
+    std::vector<std::pair<fs::file_time_type, path>> segments;
+    for (auto &n : names)
+    {
+        auto fn = getLogDir(root, version) / fs::u8path(n);
+        error_code ec;
+        auto t = fs::last_write_time(fn, ec);
+        segments.emplace_back(ec ? fs::file_time_type::min() : t, fn);
+    }
+    std::sort(segments.begin(), segments.end());
+
+    std::vector<path> v;
+    for (auto &[_, fn] : segments)
+        v.push_back(fn);
+    return v;
+}
+
+static void removeSegment(const path &fn)
+{
+    error_code ec;
+    fs::remove(fn, ec);
+    fs::remove(path(fn) += getFilesSuffix(), ec);
+    fs::remove(path(fn) += getGroupsSuffix(), ec);
+    fs::remove(getSegmentLockFilename(fn), ec);
+}
+
+static std::unique_ptr<boost::interprocess::file_lock> tryLock(const path &fn)
+{
+    using namespace boost::interprocess;
+
+    try
+    {
+        if (!fs::exists(fn))
+            ScopedFile f(fn, "ab"); // create
+        auto lk = std::make_unique<file_lock>(fn.string().c_str());
+        if (lk->try_lock())
+            return lk;
+    }
+    catch (interprocess_exception &)
+    {
+    }
+    return {};
+}
+
+// owner holds the lock while it writes to the segment
+static bool isSegmentClosed(const path &fn)
+{
+    auto lfn = getSegmentLockFilename(fn);
+    return !fs::exists(lfn) || tryLock(lfn);
+}
+
+/// Log files of one process.
+/// Owner keeps the lock file locked while it writes them.
+struct LogSegment
+{
+    path fn; // commands log, other logs have suffixes
+
+    LogSegment(const path &fn);
+    ~LogSegment();
+
+private:
+    std::unique_ptr<boost::interprocess::file_lock> lock;
+};
+
+LogSegment::LogSegment(const path &fn)
+    : fn(fn)
+{
+    // lock goes before any data
+    fs::create_directories(fn.parent_path());
+    lock = tryLock(getSegmentLockFilename(fn));
+    if (!lock)
+        throw SW_RUNTIME_ERROR("Cannot lock command log: " + normalize_path(fn));
+}
+
+LogSegment::~LogSegment() = default;
+
+// every log record is framed, so torn and damaged records are found and skipped
+struct LogRecordHeader
+{
+    uint32_t magic;
+    uint32_t size;
+    uint64_t checksum;
+};
+
+static uint64_t getChecksum(const void *data, size_t size)
+{
+    // FNV-1a, stable between builds
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto p = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void appendRecord(LogWriter::Context &ctx, int file, const std::vector<uint8_t> &v)
+{
+    LogRecordHeader h;
+    h.magic = LOG_RECORD_MAGIC;
+    h.size = (uint32_t)v.size();
+    h.checksum = getChecksum(v.data(), v.size());
+    ctx.append(file, h);
+    ctx.append(file, v.data(), v.size());
+}
+
+struct LogRecordReader
+{
+    const char *p;
+    const char *end;
+
+    template <class T>
+    void read(T &v)
+    {
+        if (sizeof(v) > (size_t)(end - p))
+            throw SW_RUNTIME_ERROR("Unexpected end of record");
+        memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+    }
+
+    void read(String &s)
+    {
+        auto e = (const char *)memchr(p, 0, end - p);
+        if (!e)
+            throw SW_RUNTIME_ERROR("Unexpected end of record");
+        s.assign(p, e);
+        p = e + 1;
+    }
+
+    bool eof() const { return p == end; }
+};
+
+template <class F>
+static void readLog(const path &fn, F &&f)
+{
+    if (!fs::exists(fn))
+        return;
+
+    auto data = read_file(fn);
+    size_t i = 0;
+    size_t skipped = 0;
+    while (i + sizeof(LogRecordHeader) <= data.size())
+    {
+        LogRecordHeader h;
+        memcpy(&h, &data[i], sizeof(h));
+        auto p = data.data() + i + sizeof(h);
+        if (h.magic != LOG_RECORD_MAGIC || h.size > data.size() - i - sizeof(h) || getChecksum(p, h.size) != h.checksum)
+        {
+            // torn or damaged record, look for the next one
+            i++;
+            skipped++;
+            continue;
+        }
+        LogRecordReader r{ p, p + h.size };
+        try
+        {
+            f(r);
+        }
+        catch (std::exception &e)
+        {
+            LOG_DEBUG(logger, "Bad record in " << normalize_path(fn) << ": " << e.what());
+        }
+        i += sizeof(h) + h.size;
+    }
+    // tail of live segment is skipped too
+    skipped += data.size() - i;
+    if (skipped)
+        LOG_DEBUG(logger, "Skipped " << skipped << " bytes of " << normalize_path(fn));
 }
 
 template <class T>
@@ -83,41 +315,159 @@ static void write_str(std::vector<uint8_t> &vec, const String &val)
     memcpy(&vec[vsz], &val[0], sz);
 }
 
+// record: path, then optional content info
+static void write_file_record(std::vector<uint8_t> &v, const String &s, const FileHashRecord *h)
+{
+    v.clear();
+    write_str(v, s);
+    if (!h)
+        return;
+    write_int(v, h->mtime);
+    write_int(v, h->size);
+    write_int(v, h->hash);
+}
+
+
+uint64_t DepGroup::getHash(const std::vector<size_t> &files)
+{
+    uint64_t h = files.size();
+    for (auto f : files)
+        stable_hash_combine(h, f);
+    return h;
+}
+
+size_t ImplicitInputs::size() const
+{
+    return (group ? group->files.size() - removed.size() : 0) + added.size();
+}
+
+std::vector<size_t> ImplicitInputs::get() const
+{
+    std::vector<size_t> v;
+    v.reserve(size());
+    forEach([&v](auto h) { v.push_back(h); });
+    if (!added.empty())
+        std::sort(v.begin(), v.end());
+    return v;
+}
+
+// returns size of difference, stops when it is larger than limit
+static size_t getDelta(const std::vector<size_t> &group, const std::vector<size_t> &files, size_t limit,
+    std::vector<size_t> *added = nullptr, std::vector<size_t> *removed = nullptr)
+{
+    size_t n = 0;
+    auto g = group.begin();
+    auto f = files.begin();
+    while (g != group.end() || f != files.end())
+    {
+        if (f == files.end() || (g != group.end() && *g < *f))
+        {
+            if (removed)
+                removed->push_back(*g);
+            g++;
+        }
+        else if (g == group.end() || *f < *g)
+        {
+            if (added)
+                added->push_back(*f);
+            f++;
+        }
+        else
+        {
+            g++;
+            f++;
+            continue;
+        }
+        if (++n > limit)
+            break;
+    }
+    return n;
+}
+
 Files CommandRecord::getImplicitInputs(detail::Storage &s) const
 {
     Files files;
-    for (auto &h : implicit_inputs)
-    {
-        boost::upgrade_lock lk(s.m_file_storage_by_hash);
-        auto i = s.file_storage_by_hash.find(h);
-        if (i == s.file_storage_by_hash.end())
-            throw SW_RUNTIME_ERROR("no such file");
-        auto p = i->second;
-        lk.unlock();
+    implicit_inputs.forEach([&s, &files](auto h)
+    {
+        auto &p = s.getFile(h);
         if (!p.empty())
             files.insert(p);
-    }
+    });
     return files;
 }
 
-void CommandRecord::setImplicitInputs(const Files &files, detail::Storage &s)
+std::vector<PathTable::Id> CommandRecord::getImplicitInputIds(detail::Storage &s) const
 {
-    implicit_inputs.clear(); // clear first!
+    std::vector<PathTable::Id> ids;
+    ids.reserve(implicit_inputs.size());
+    implicit_inputs.forEach([&s, &ids](auto h)
+    {
+        ids.push_back(s.getFileId(h));
+    });
+    return ids;
+}
 
+void CommandRecord::setImplicitInputs(const Files &files, detail::Storage &s)
+{
+    std::vector<PathTable::Id> ids;
+    ids.reserve(files.size());
     for (auto &f : files)
     {
         auto str = normalize_path(f);
-        auto h = std::hash<String>()(str);
-        implicit_inputs.insert(h);
+        ids.push_back(s.paths.intern(s.getPathHash(str), str));
+    }
+    setImplicitInputs(ids, s);
+}
 
-        boost::upgrade_lock lk(s.m_file_storage_by_hash);
-        auto i = s.file_storage_by_hash.find(h);
-        if (i == s.file_storage_by_hash.end())
+void CommandRecord::setImplicitInputs(const std::vector<PathTable::Id> &ids, detail::Storage &s)
+{
+    std::vector<size_t> v;
+    v.reserve(ids.size());
+    for (auto id : ids)
+        v.push_back(s.paths.getHash(id));
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+
+    // keep the same encoding, so record can be updated in place
+    if (v == implicit_inputs.get())
+        return;
+
+    // previous group of this command is the best candidate
+    if (implicit_inputs.group)
+    {
+        ImplicitInputs ii;
+        ii.group = implicit_inputs.group;
+        auto limit = v.size() / 4;
+        if (getDelta(ii.group->files, v, limit, &ii.added, &ii.removed) <= limit)
         {
-            boost::upgrade_to_unique_lock lk2(lk);
-            s.file_storage_by_hash[h] = fs::u8path(str);
+            implicit_inputs = std::move(ii);
+            return;
         }
     }
+    implicit_inputs = s.intern(v);
+}
+
+void CommandRecord::addExecution(const CommandExecutionRecord &e)
+{
+    if (history.size() >= max_history_size)
+        history.erase(history.begin(), history.begin() + (history.size() - max_history_size + 1));
+    history.push_back(e);
+}
+
+std::optional<CommandRecord::Duration> CommandRecord::getAverageDuration() const
+{
+    int64_t sum = 0;
+    int64_t n = 0;
+    for (auto &e : history)
+    {
+        if (e.exit_code != 0)
+            continue;
+        sum += e.duration;
+        n++;
+    }
+    if (n == 0)
+        return {};
+    return Duration(sum / n);
 }
 
 FileDb::FileDb(const SwBuilderContext &swctx)
@@ -125,7 +475,7 @@ FileDb::FileDb(const SwBuilderContext &swctx)
 {
 }
 
-void FileDb::write(std::vector<uint8_t> &v, const CommandRecord &f, const detail::Storage &s)
+void FileDb::write(std::vector<uint8_t> &v, const CommandRecord &f)
 {
     v.clear();
 
@@ -138,173 +488,302 @@ void FileDb::write(std::vector<uint8_t> &v, const CommandRecord &f, const detail
     write_int(v, f.hash);
     write_int(v, f.mtime);
 
-    auto n = f.implicit_inputs.size();
+    auto &ii = f.implicit_inputs;
+    write_int(v, ii.group ? ii.group->hash : 0);
+    auto n = ii.added.size();
+    write_int(v, n);
+    for (auto &h : ii.added)
+        write_int(v, h);
+    n = ii.removed.size();
     write_int(v, n);
-    for (auto &h : f.implicit_inputs)
-    {
-        boost::upgrade_lock lk(s.m_file_storage_by_hash);
-        auto i = s.file_storage_by_hash.find(h);
-        if (i == s.file_storage_by_hash.end())
-            throw SW_RUNTIME_ERROR("no such file");
-        auto p = i->second;
-        lk.unlock();
-        write_int(v, std::hash<String>()(normalize_path(p)));
+    for (auto &h : ii.removed)
+        write_int(v, h);
+
+    n = f.history.size();
+    write_int(v, n);
+    for (auto &e : f.history)
+    {
+        write_int(v, e.duration);
+        write_int(v, e.peak_rss);
+        write_int(v, e.exit_code);
     }
+
+    write_int(v, f.inputs_hash);
 }
 
-static String getFilesSuffix()
+
+void FileDb::write(std::vector<uint8_t> &v, const DepGroup &g)
 {
-    return ".files";
+    v.clear();
+    write_int(v, g.hash);
+    write_int(v, g.files.size());
+    for (auto &h : g.files)
+        write_int(v, h);
 }
 
-static void load(const path &fn, Files &files, std::unordered_map<size_t, path> &files2, ConcurrentCommandStorage &commands)
+// loads one log segment
+static void load(const path &fn, detail::Storage &s)
 {
     // files
-    if (fs::exists(path(fn) += getFilesSuffix()))
+    readLog(path(fn) += getFilesSuffix(), [&s](LogRecordReader &r)
     {
-        primitives::BinaryStream b;
-        b.load(path(fn) += getFilesSuffix());
-        while (!b.eof())
-        {
-            size_t sz; // record size
-            b.read(sz);
-            if (!b.has(sz))
-            {
-                fs::resize_file(path(fn) += getFilesSuffix(), b.index() - sizeof(sz));
-                break; // record is in bad shape
-            }
+        String str;
+        r.read(str);
+        auto h = s.getPathHash(str);
+        s.paths.intern(h, str);
 
-            if (sz == 0)
-                continue;
+        // content info, log contains newer records
+        if (!r.eof())
+        {
+            FileHashRecord fr;
+            r.read(fr.mtime);
+            r.read(fr.size);
+            r.read(fr.hash);
+            s.file_hashes[h] = fr;
+        }
+    });
 
-            // file
-            String s;
-            b.read(s);
-            auto p = fs::u8path(s);
-            files.insert(p);
+    auto has_file = [&s](size_t h)
+    {
+        return s.paths.find(h) != PathTable::npos || (s.db && s.db->findFile(h));
+    };
 
-            files2[std::hash<String>()(s)] = p;
+    // dep groups
+    readLog(path(fn) += getGroupsSuffix(), [&s, &has_file](LogRecordReader &r)
+    {
+        uint64_t h;
+        r.read(h);
+        size_t n;
+        r.read(n);
+        std::vector<size_t> files;
+        bool lost = false;
+        while (n--)
+        {
+            size_t fh;
+            r.read(fh);
+            files.push_back(fh);
+            lost |= !has_file(fh);
         }
-    }
+        // commands referring to this group will be rebuilt
+        if (!lost)
+            s.addDepGroup(std::move(files));
+    });
 
     // commands
-    if (fs::exists(fn))
+    readLog(fn, [&s, &has_file](LogRecordReader &b)
     {
-        primitives::BinaryStream b;
-        b.load(fn);
-        while (!b.eof())
-        {
-            size_t sz; // record size
-            b.read(sz);
-            if (!b.has(sz))
-            {
-                fs::resize_file(path(fn) += getFilesSuffix(), b.index() - sizeof(sz));
-                break; // record is in bad shape
-            }
+        CommandRecord r;
+        b.read(r.hash);
 
-            if (sz == 0)
-                continue;
+        //if (!std::is_trivially_copyable_v<decltype(r.mtime)>)
+            //throw SW_RUNTIME_ERROR("x");
 
+        b.read(r.mtime);
+
+        uint64_t gh;
+        b.read(gh);
+        size_t n;
+        b.read(n);
+        while (n--)
+        {
             size_t h;
             b.read(h);
+            if (has_file(h))
+                r.implicit_inputs.added.push_back(h);
+        }
+        b.read(n);
+        while (n--)
+        {
+            size_t h;
+            b.read(h);
+            r.implicit_inputs.removed.push_back(h);
+        }
 
-            auto r = commands.insert(h);
-            r.first->hash = h;
-
-            //if (!std::is_trivially_copyable_v<decltype(r.first->mtime)>)
-                //throw SW_RUNTIME_ERROR("x");
+        // log contains newer records, so replace history
+        b.read(n);
+        while (n--)
+        {
+            CommandExecutionRecord e;
+            b.read(e.duration);
+            b.read(e.peak_rss);
+            b.read(e.exit_code);
+            r.addExecution(e);
+        }
 
-            b.read(r.first->mtime);
+        b.read(r.inputs_hash);
 
-            size_t n;
-            b.read(n);
-            r.first->implicit_inputs.reserve(n);
-            while (n--)
+        if (gh)
+        {
+            r.implicit_inputs.group = s.getDepGroup(gh);
+            // lost group, command will be rebuilt
+            if (!r.implicit_inputs.group)
             {
-                b.read(h);
-                auto &f = files2[h];
-                if (!f.empty())
-                {
-                    //r.first->implicit_inputs.insert(files2[h]);
-                    r.first->implicit_inputs.insert(h);
-                }
+                *s.storage.insert(r.hash).first = CommandRecord{};
+                return;
             }
         }
-    }
+        *s.storage.insert(r.hash).first = std::move(r);
+    });
 }
 
-void FileDb::load(Files &files, std::unordered_map<size_t, path> &files2, ConcurrentCommandStorage &commands, const path &root) const
+// on Windows mapped file cannot be replaced, so it is done on the next run,
+// must be called under compaction lock
+static bool replaceBaseFile(const path &root)
 {
-    sw::load(getCommandsDbFilename(root), files, files2, commands);
-    sw::load(getCommandsLogFileName(root), files, files2, commands);
+    error_code ec;
+    fs::rename(getNewCommandsDbFilename(root), getCommandsDbFilename(root), ec);
+    if (ec)
+        return false;
+    auto list = getNewCommandsDbSegmentsFilename(root);
+    if (fs::exists(list))
+    {
+        for (auto &n : split_lines(read_file(list)))
+            removeSegment(getLogDir(root) / fs::u8path(n));
+        fs::remove(list, ec);
+    }
+    return true;
 }
 
-void FileDb::save(const Files &files, const detail::Storage &s, ConcurrentCommandStorage &commands, const path &root) const
+// One time conversion of older versions into the new base file.
+// Versions before them have other command hashes, their records would never be found.
+static void convertOldVersion(const path &root)
 {
-    std::vector<uint8_t> v;
+    auto version = COMMAND_DB_FORMAT_VERSION - 1;
+    while (version >= COMMAND_DB_OLDEST_CONVERTED_FORMAT_VERSION && !fs::exists(getDir(root, version)))
+        version--;
+    if (version < COMMAND_DB_OLDEST_CONVERTED_FORMAT_VERSION)
+        return;
+    // other process may be converting it
+    auto lk = tryLock(getCompactionLockFilename(root));
+    if (!lk || fs::exists(getCommandsDbFilename(root)) || !getLogSegments(root).empty())
+        return;
 
-    // files
+    try
     {
-        primitives::BinaryStream b(10'000'000); // reserve amount
-        for (auto &f : files)
+        detail::Storage old;
+        old.std_hashes = true;
+        auto fn = getCommandsDbFilename(root, version);
+        if (fs::exists(fn))
+            old.db = std::make_shared<CommandDb>(fn, version);
+        if (fs::exists(getLogDir(root, version)))
+        {
+            for (auto &fn : getLogSegments(root, version))
+                sw::load(fn, old);
+        }
+
+        // implicit inputs are interned again with new hashes,
+        // file content hashes are dropped, so files and commands are hashed again
+        detail::Storage s;
+        auto add = [&old, &s](const CommandRecord &r)
+        {
+            auto &nr = *s.storage.insert(r.hash).first;
+            nr.hash = r.hash;
+            nr.mtime = r.mtime;
+            nr.history = r.history;
+            nr.setImplicitInputs(r.getImplicitInputs(old), s);
+        };
+        for (auto &[h, r] : old.storage.snapshot())
         {
-            auto s = normalize_path(f);
-            auto sz = s.size() + 1;
-            b.write(sz);
-            b.write(s);
+            // lost records are not converted
+            if (r->hash)
+                add(*r);
         }
-        if (!b.empty())
+        for (size_t i = 0; old.db && i < old.db->getNumberOfCommands(); i++)
         {
-            auto p = getCommandsDbFilename(root) += getFilesSuffix();
-            fs::create_directories(p.parent_path());
-            b.save(p);
+            auto &e = old.db->getCommand(i);
+            // log records are newer
+            if (old.storage.find(e.hash))
+                continue;
+            CommandRecord r;
+            old.db->read(e, r, old);
+            add(r);
         }
+        CommandDb::write(getCommandsDbFilename(root), nullptr, s);
+    }
+    catch (std::exception &e)
+    {
+        LOG_WARN(logger, "Cannot convert command db of version " << version << ": " << e.what());
+        return;
     }
+    LOG_DEBUG(logger, "Command db is converted from version " << version);
 
-    // commands
+    // versions in between are not used anymore too
+    for (auto v = COMMAND_DB_OLDEST_CONVERTED_FORMAT_VERSION; v < COMMAND_DB_FORMAT_VERSION; v++)
     {
-        primitives::BinaryStream b(10'000'000); // reserve amount
-        for (const auto &[k, r] : commands)
+        error_code ec;
+        fs::remove_all(getDir(root, v), ec);
+    }
+}
+
+void FileDb::load(detail::Storage &s, const path &root) const
+{
+    fs::create_directories(getLogDir(root));
+    convertOldVersion(root);
+    if (fs::exists(getNewCommandsDbFilename(root)))
+    {
+        // skip when other process is compacting
+        if (auto lk = tryLock(getCompactionLockFilename(root)))
+            replaceBaseFile(root);
+    }
+
+    auto fn = getCommandsDbFilename(root);
+    if (fs::exists(fn))
+    {
+        try
         {
-            write(v, r, s);
-            auto sz = v.size();
-            b.write(sz);
-            b.write(v.data(), v.size());
+            s.db = std::make_shared<CommandDb>(fn);
         }
-        if (!b.empty())
+        catch (std::exception &e)
         {
-            auto p = getCommandsDbFilename(root);
-            fs::create_directories(p.parent_path());
-            b.save(p);
+            LOG_WARN(logger, "Cannot load command db, it will be recreated: " << e.what());
+            error_code ec;
+            fs::remove(fn, ec);
         }
     }
 
-    error_code ec;
-    fs::remove(getCommandsLogFileName(root), ec);
-    fs::remove(getCommandsLogFileName(root) += getFilesSuffix(), ec);
+    // segments of all processes, including running ones
+    for (auto &fn : getLogSegments(root))
+        sw::load(fn, s);
+    for (const auto &[h, r] : s.storage.snapshot())
+    {
+        s.logged.insert(h);
+        s.n_log_records++;
+    }
 }
 
-detail::FileHolder::FileHolder(const path &fn)
-    : /*lk(fn)
-    , */f(fn, "ab")
-    , fn(fn)
+void FileDb::compact(const path &root, const path &live_segment) const
 {
-    // goes first
-    // but maybe remove?
-    //if (setvbuf(f.getHandle(), NULL, _IONBF, 0) != 0)
-    //throw RUNTIME_EXCEPTION("Cannot disable log buffering");
+    // one process at a time
+    auto lk = tryLock(getCompactionLockFilename(root));
+    if (!lk)
+    {
+        LOG_DEBUG(logger, "Command db is compacted by other process");
+        return;
+    }
+    if (fs::exists(getNewCommandsDbFilename(root)) && !replaceBaseFile(root))
+        return;
 
-    // Opening a file in append mode doesn't set the file pointer to the file's
-    // end on Windows. Do that explicitly.
-    fseek(f.getHandle(), 0, SEEK_END);
-}
+    // base file may be replaced by other process after our load
+    detail::Storage logs;
+    if (fs::exists(getCommandsDbFilename(root)))
+        logs.db = std::make_shared<CommandDb>(getCommandsDbFilename(root));
 
-detail::FileHolder::~FileHolder()
-{
-    f.close();
+    // running processes keep their segments, they are merged again next time
+    String closed;
+    for (auto &fn : getLogSegments(root))
+    {
+        // lock of own segment must not be touched
+        if (fn == live_segment)
+            continue;
+        if (isSegmentClosed(fn))
+            closed += fn.filename().u8string() + "\n";
+        sw::load(fn, logs);
+    }
 
-    error_code ec; // remove ec? but multiple processes may be writing into this log? or not?
-    fs::remove(fn, ec);
+    write_file(getNewCommandsDbSegmentsFilename(root), closed);
+    CommandDb::write(getNewCommandsDbFilename(root), logs.db.get(), logs);
+    if (!replaceBaseFile(root))
+        LOG_DEBUG(logger, "Command db will be replaced on the next run");
 }
 
 CommandStorage::CommandStorage(const SwBuilderContext &swctx, const path &root)
@@ -312,7 +791,6 @@ CommandStorage::CommandStorage(const SwBuilderContext &swctx, const path &root)
     , root(root)
     , fdb(swctx)
 {
-    //lock = getLock();
     load(); // load early
 }
 
@@ -323,41 +801,68 @@ CommandStorage::~CommandStorage()
 
 void CommandStorage::async_command_log(const CommandRecord &r)
 {
-    static std::vector<uint8_t> v;
-
-    changed = true;
-    add_user();
-    swctx.getFileStorageExecutor().push([this, &r]
+    // record may be changed by other commands later
+    log->push([this, r](LogWriter::Context &ctx)
     {
+        static thread_local std::vector<uint8_t> v;
+
         auto &s = getInternalStorage();
 
+        // usual rebuild, nothing to append
+        if (s.in_place_updates && s.db && s.logged.find(r.hash) == s.logged.end() && s.db->update(r))
+            return;
+
+        // files and group go first, so segment is complete up to any record
+        auto write_file = [this, &s, &ctx](size_t h)
         {
-            // write record to vector v
-            fdb.write(v, r, s);
-
-            auto &l = s.getCommandLog(swctx, root);
-            auto sz = v.size();
-            fwrite(&sz, sizeof(sz), 1, l.f.getHandle());
-            fwrite(&v[0], sz, 1, l.f.getHandle());
-            fflush(l.f.getHandle());
+            if (s.db && s.db->findFile(h))
+                return;
+            if (!s.logged_files.insert(h).second)
+                return;
+            write_file_record(v, normalize_path(s.getFile(h)), nullptr);
+            appendRecord(ctx, files_log, v);
+        };
+        auto &ii = r.implicit_inputs;
+        for (auto h : ii.added)
+            write_file(h);
+
+        // group goes once per segment, groups of base file being replaced may be dropped from it
+        if (ii.group && s.logged_dep_groups.find(ii.group->hash) == s.logged_dep_groups.end() &&
+            !(s.in_place_updates && s.db && s.db->findGroup(ii.group->hash) != CommandDb::no_group))
+        {
+            for (auto h : ii.group->files)
+                write_file(h);
+            fdb.write(v, *ii.group);
+            appendRecord(ctx, groups_log, v);
+            s.logged_dep_groups.insert(ii.group->hash);
         }
 
+        // write record to vector v
+        fdb.write(v, r);
+        if (!v.empty())
         {
-            auto &l = s.getFileLog(swctx, root);
-            for (auto &f : r.getImplicitInputs(s))
-            {
-                auto r = s.file_storage.insert(f);
-                if (!r.second)
-                    continue;
-                auto s = normalize_path(f);
-                auto sz = s.size() + 1;
-                fwrite(&sz, sizeof(sz), 1, l.f.getHandle());
-                fwrite(&s[0], sz, 1, l.f.getHandle());
-                fflush(l.f.getHandle());
-            }
+            appendRecord(ctx, commands_log, v);
+            s.logged.insert(r.hash);
+            s.n_log_records++;
         }
 
-        free_user();
+        if (s.n_log_records >= getCompactionThreshold())
+            startCompaction(ctx);
+    });
+}
+
+void CommandStorage::async_file_log(const path &p, const FileHashRecord &h)
+{
+    log->push([this, p, h](LogWriter::Context &ctx)
+    {
+        static thread_local std::vector<uint8_t> v;
+
+        auto &s = getInternalStorage();
+        auto str = normalize_path(p);
+        s.logged_files.insert(s.getPathHash(str));
+
+        write_file_record(v, str, &h);
+        appendRecord(ctx, files_log, v);
     });
 }
 
@@ -369,63 +874,203 @@ void CommandStorage::add_user()
 void CommandStorage::free_user()
 {
     //--n_users;
-    //if (n_users == 0)
-        closeLogs(); // reduce number of open fds
 }
 
-void detail::Storage::closeLogs()
+void CommandStorage::save()
 {
-    commands.reset();
-    files.reset();
+    // writes everything, compaction may be started by the last records
+    log.reset();
+    if (compaction.valid())
+        compaction.wait();
+    // segment is closed now
+    segment.reset();
 }
 
-void CommandStorage::closeLogs()
+size_t CommandStorage::getCompactionThreshold() const
 {
-    s.closeLogs();
-    //save();
+    return std::max<size_t>(4096, s.db ? s.db->getNumberOfCommands() / 8 : 0);
 }
 
-void CommandStorage::save()
+void CommandStorage::startCompaction(LogWriter::Context &ctx)
 {
-    if (!changed)
-        return;
-    if (saved)
+    // once per run, new logs are compacted next time
+    if (compaction.valid())
         return;
-    // and save at the end
+
+    // base file is read by compaction now
+    s.in_place_updates = false;
+
+    // continue in new segment, the old one is closed and may be removed by compaction
+    ctx.closeFiles();
     try
     {
-        save1();
-        saved = true;
+        auto seg = std::make_unique<LogSegment>(getLogDir(root) / getSegmentName());
+        ctx.setFilename(commands_log, seg->fn);
+        ctx.setFilename(files_log, path(seg->fn) += getFilesSuffix());
+        ctx.setFilename(groups_log, path(seg->fn) += getGroupsSuffix());
+        segment = std::move(seg);
     }
     catch (std::exception &e)
     {
-        LOG_ERROR(logger, "Error during command db save: " << e.what());
+        LOG_WARN(logger, "Cannot start command db compaction: " << e.what());
+        return;
     }
-    lock.reset();
+    s.n_log_records = 0;
+    // new segment must be complete without the old one
+    s.logged_files.clear();
+    s.logged_dep_groups.clear();
+
+    compaction = std::async(std::launch::async, [this, live = segment->fn]
+    {
+        try
+        {
+            fdb.compact(root, live);
+        }
+        catch (std::exception &e)
+        {
+            LOG_WARN(logger, "Error during command db compaction: " << e.what());
+        }
+    });
 }
 
-detail::FileHolder &detail::Storage::getCommandLog(const SwBuilderContext &swctx, const path &root)
+void CommandStorage::load()
 {
-    if (!commands)
-        commands = std::make_unique<FileHolder>(getCommandsLogFileName(root));
-    return *commands;
+    fdb.load(s, root);
+
+    segment = std::make_unique<LogSegment>(getLogDir(root) / getSegmentName());
+
+    LogWriter::Options o;
+    o.sync_interval = std::chrono::milliseconds(Settings::get_user_settings().command_log_sync_interval);
+    log = std::make_unique<LogWriter>(o);
+    commands_log = log->addFile(segment->fn);
+    files_log = log->addFile(path(segment->fn) += getFilesSuffix());
+    groups_log = log->addFile(path(segment->fn) += getGroupsSuffix());
+
+    if (s.n_log_records >= getCompactionThreshold())
+        log->push([this](LogWriter::Context &ctx) { startCompaction(ctx); });
 }
 
-detail::FileHolder &detail::Storage::getFileLog(const SwBuilderContext &swctx, const path &root)
+size_t detail::Storage::getPathHash(std::string_view p) const
 {
-    if (!files)
-        files = std::make_unique<FileHolder>(getCommandsLogFileName(root) += getFilesSuffix());
-    return *files;
+    if (std_hashes)
+        return std::hash<std::string_view>()(p);
+    return stable_hash(p);
 }
 
-void CommandStorage::load()
+uint64_t detail::Storage::getDepGroupHash(const std::vector<size_t> &files) const
+{
+    if (!std_hashes)
+        return DepGroup::getHash(files);
+    size_t h = files.size();
+    for (auto f : files)
+        hash_combine(h, f);
+    return h;
+}
+
+PathTable::Id detail::Storage::getFileId(size_t h)
+{
+    auto id = paths.find(h);
+    if (id != PathTable::npos)
+        return id;
+    if (db)
+    {
+        if (auto f = db->findFile(h))
+            return paths.intern(h, db->getPath(*f));
+    }
+    throw SW_RUNTIME_ERROR("no such file");
+}
+
+FileData &detail::Storage::getFileData(PathTable::Id id, FileStorage &fs)
+{
+    if (auto d = paths.getFileData(id))
+        return *d;
+    auto &d = fs.registerFile(paths.get(id));
+    paths.setFileData(id, &d);
+    return d;
+}
+
+DepGroupPtr detail::Storage::getDepGroup(uint64_t hash)
+{
+    {
+        std::unique_lock lk(m_dep_groups);
+        auto i = dep_groups.find(hash);
+        if (i != dep_groups.end())
+            return i->second;
+    }
+    if (!db)
+        return {};
+    auto i = db->findGroup(hash);
+    if (i == CommandDb::no_group)
+        return {};
+    return getBaseDepGroup(i);
+}
+
+DepGroupPtr detail::Storage::getBaseDepGroup(uint32_t index)
 {
-    fdb.load(s.file_storage, s.file_storage_by_hash, s.storage, root);
+    std::unique_lock lk(m_dep_groups);
+    if (base_dep_groups.size() < db->getNumberOfGroups())
+        base_dep_groups.resize(db->getNumberOfGroups());
+    auto &g = base_dep_groups.at(index);
+    if (g)
+        return g;
+    g = db->readGroup(index);
+    return dep_groups.emplace(g->hash, g).first->second;
 }
 
-void CommandStorage::save1()
+DepGroupPtr detail::Storage::addDepGroup(std::vector<size_t> files)
 {
-    fdb.save(s.file_storage, s, s.storage, root);
+    auto g = std::make_shared<DepGroup>();
+    g->hash = getDepGroupHash(files);
+    g->files = std::move(files);
+    std::unique_lock lk(m_dep_groups);
+    return dep_groups.emplace(g->hash, g).first->second;
+}
+
+ImplicitInputs detail::Storage::intern(const std::vector<size_t> &files)
+{
+    static const size_t max_recent_groups = 8;
+
+    ImplicitInputs ii;
+    if (files.empty())
+        return ii;
+
+    // exact match
+    auto h = getDepGroupHash(files);
+    if (auto g = getDepGroup(h); g && g->files == files)
+    {
+        ii.group = g;
+        return ii;
+    }
+
+    // groups of neighbour commands, small difference is stored with the record
+    {
+        std::unique_lock lk(m_dep_groups);
+        DepGroupPtr best;
+        auto limit = files.size() / 4;
+        for (auto &g : recent_dep_groups)
+        {
+            auto n = getDelta(g->files, files, limit);
+            if (n > limit)
+                continue;
+            best = g;
+            if (n == 0)
+                break;
+            limit = n - 1; // look for better one
+        }
+        if (best)
+        {
+            ii.group = best;
+            getDelta(best->files, files, files.size(), &ii.added, &ii.removed);
+            return ii;
+        }
+    }
+
+    ii.group = addDepGroup(files);
+    std::unique_lock lk(m_dep_groups);
+    recent_dep_groups.push_back(ii.group);
+    if (recent_dep_groups.size() > max_recent_groups)
+        recent_dep_groups.erase(recent_dep_groups.begin());
+    return ii;
 }
 
 ConcurrentCommandStorage &CommandStorage::getStorage()
@@ -440,17 +1085,80 @@ detail::Storage &CommandStorage::getInternalStorage()
 
 std::pair<CommandRecord *, bool> CommandStorage::insert(size_t hash)
 {
+    if (auto r = find(hash))
+        return { r, false };
     return getStorage().insert(hash);
 }
 
-path CommandStorage::getLockFileName() const
+CommandRecord *CommandStorage::find(size_t hash)
 {
-    return root / "build";
+    if (auto r = getStorage().find(hash))
+        return r;
+    if (!s.db)
+        return nullptr;
+
+    // read from base file on first access
+    auto e = s.db->findCommand(hash);
+    if (!e)
+        return nullptr;
+    CommandRecord r;
+    s.db->read(*e, r, s);
+    return getStorage().insert(hash, std::move(r)).first;
 }
 
-std::unique_ptr<ScopedFileLock> CommandStorage::getLock() const
+CommandRecord::History CommandStorage::getHistory(size_t hash)
 {
-    return std::make_unique<ScopedFileLock>(getLockFileName());
+    auto r = find(hash);
+    if (!r)
+        return {};
+    return r->history;
+}
+
+uint64_t CommandStorage::getFileHash(const path &p, FileData &d)
+{
+    std::unique_lock lk(d.m_hash);
+    if (d.hash_write_time == d.last_write_time)
+        return d.hash;
+
+    // persistent cache
+    auto h = s.getPathHash(normalize_path(p));
+    int64_t sz = fs::file_size(p);
+    {
+        std::unique_lock lk2(s.m_file_hashes);
+        auto i = s.file_hashes.find(h);
+        if (i != s.file_hashes.end() && i->second.mtime == d.last_write_time && i->second.size == sz)
+        {
+            d.size = sz;
+            d.hash = i->second.hash;
+            d.hash_write_time = d.last_write_time;
+            return d.hash;
+        }
+    }
+    if (s.db)
+    {
+        auto f = s.db->findFile(h);
+        if (f && f->size == sz && f->mtime == d.last_write_time.time_since_epoch().count())
+        {
+            d.size = sz;
+            d.hash = f->hash;
+            d.hash_write_time = d.last_write_time;
+            return d.hash;
+        }
+    }
+
+    FileHashRecord r;
+    r.mtime = d.last_write_time;
+    r.size = sz;
+    r.hash = getFileContentHash(p);
+    d.size = r.size;
+    d.hash = r.hash;
+    d.hash_write_time = r.mtime;
+    {
+        std::unique_lock lk2(s.m_file_hashes);
+        s.file_hashes[h] = r;
+    }
+    async_file_log(p, r);
+    return r.hash;
 }
 
 }
@@ -19,64 +19,171 @@
 #pragma once
 
 #include "concurrent_map.h"
+#include "log_writer.h"
+#include "path_table.h"
 
-#include <boost/thread/shared_mutex.hpp>
 #include <primitives/lock.h>
 #include <primitives/templates.h>
 
 #include <atomic>
+#include <chrono>
+#include <future>
+#include <optional>
 
 namespace sw
 {
 
+struct CommandDb;
 struct CommandStorage;
+struct LogSegment;
+struct FileData;
+struct FileStorage;
 
 namespace detail
 {
 
 struct Storage;
 
-struct FileHolder
+}
+
+struct CommandExecutionRecord
+{
+    int64_t duration = 0; // wall time, ms
+    uint64_t peak_rss = 0; // bytes, 0 when unknown
+    int64_t exit_code = 0;
+};
+
+/// Sorted set of implicit inputs (path hashes) shared by many command records.
+/// Compile commands of one target usually have almost the same system and library headers.
+struct DepGroup
 {
-    ScopedFile f;
-    path fn;
+    uint64_t hash = 0; // of contents
+    std::vector<size_t> files;
 
-    FileHolder(const path &fn);
-    ~FileHolder();
+    static uint64_t getHash(const std::vector<size_t> &files);
 };
 
-}
+using DepGroupPtr = std::shared_ptr<const DepGroup>;
 
-struct CommandRecord
+/// Implicit inputs of a command: interned group plus small difference from it.
+struct SW_BUILDER_API ImplicitInputs
 {
+    DepGroupPtr group;
+    std::vector<size_t> added; // sorted, not in group
+    std::vector<size_t> removed; // sorted, in group
+
+    bool empty() const { return size() == 0; }
+    size_t size() const;
+    /// sorted path hashes
+    std::vector<size_t> get() const;
+
+    template <class F>
+    void forEach(F &&f) const
+    {
+        if (group)
+        {
+            auto r = removed.begin();
+            for (auto h : group->files)
+            {
+                while (r != removed.end() && *r < h)
+                    r++;
+                if (r == removed.end() || *r != h)
+                    f(h);
+            }
+        }
+        for (auto h : added)
+            f(h);
+    }
+};
+
+struct SW_BUILDER_API CommandRecord
+{
+    using Duration = std::chrono::milliseconds;
+    using History = std::vector<CommandExecutionRecord>;
+
+    // number of last executions we keep
+    static constexpr size_t max_history_size = 8;
+
     size_t hash = 0;
     fs::file_time_type mtime = fs::file_time_type::min();
     //Files implicit_inputs;
-    std::unordered_set<size_t> implicit_inputs;
+    ImplicitInputs implicit_inputs;
+    History history; // oldest first
+    uint64_t inputs_hash = 0; // content hash of all inputs, 0 when not computed
 
     Files getImplicitInputs(detail::Storage &) const;
     void setImplicitInputs(const Files &, detail::Storage &);
+    /// ids in storage path table
+    std::vector<PathTable::Id> getImplicitInputIds(detail::Storage &) const;
+    void setImplicitInputs(const std::vector<PathTable::Id> &, detail::Storage &);
+
+    void addExecution(const CommandExecutionRecord &);
+    /// average wall time of successful executions
+    std::optional<Duration> getAverageDuration() const;
 };
 
 using ConcurrentCommandStorage = ConcurrentMap<size_t, CommandRecord>;
+
+struct FileHashRecord
+{
+    fs::file_time_type mtime = fs::file_time_type::min();
+    int64_t size = -1;
+    uint64_t hash = 0;
+};
+
+// path hash -> content info
+using FileHashes = std::unordered_map<size_t, FileHashRecord>;
 struct SwBuilderContext;
 
 namespace detail
 {
 
-struct Storage
+struct SW_BUILDER_API Storage
 {
     ConcurrentCommandStorage storage;
-    std::unique_ptr<FileHolder> commands;
 
-    Files file_storage;
-    mutable boost::upgrade_mutex m_file_storage_by_hash;
-    std::unordered_map<size_t, path> file_storage_by_hash;
-    std::unique_ptr<FileHolder> files;
-
-    void closeLogs();
-    FileHolder &getCommandLog(const SwBuilderContext &swctx, const path &root);
-    FileHolder &getFileLog(const SwBuilderContext &swctx, const path &root);
+    // files of loaded and new records
+    PathTable paths;
+    // path hashes that are in logs, writer thread only
+    std::unordered_set<size_t> logged_files;
+
+    mutable std::mutex m_file_hashes;
+    FileHashes file_hashes;
+
+    // interned dep groups by content hash
+    mutable std::mutex m_dep_groups;
+    std::unordered_map<uint64_t, DepGroupPtr> dep_groups;
+    std::vector<DepGroupPtr> base_dep_groups; // by index in base file
+    std::vector<DepGroupPtr> recent_dep_groups; // candidates for delta encoding
+    // groups that are in logs or in base file
+    std::unordered_set<uint64_t> logged_dep_groups;
+
+    // path and dep group hashes of versions before 12 were made by std::hash, used for conversion
+    bool std_hashes = false;
+
+    // base file, records are read from it on demand
+    std::shared_ptr<CommandDb> db;
+    // commands that are in logs, they cannot be updated in base file
+    std::unordered_set<size_t> logged;
+    size_t n_log_records = 0;
+    bool in_place_updates = true;
+
+    /// stable hash of normalized path
+    size_t getPathHash(std::string_view) const;
+    uint64_t getDepGroupHash(const std::vector<size_t> &files) const;
+
+    /// throws if file is unknown, files from base file are interned on first access
+    PathTable::Id getFileId(size_t path_hash);
+    const path &getFile(size_t path_hash) { return paths.get(getFileId(path_hash)); }
+    /// registers file on first access, then it is taken from path table
+    FileData &getFileData(PathTable::Id, FileStorage &);
+
+    /// returns nullptr if group is unknown
+    DepGroupPtr getDepGroup(uint64_t hash);
+    DepGroupPtr getBaseDepGroup(uint32_t index);
+    DepGroupPtr addDepGroup(std::vector<size_t> files);
+    /// finds existing group for sorted files or makes a new one
+    ImplicitInputs intern(const std::vector<size_t> &files);
 };
 
 }
@@ -87,10 +194,13 @@ struct FileDb
 
     FileDb(const SwBuilderContext &swctx);
 
-    void load(Files &files, std::unordered_map<size_t, path> &files2, ConcurrentCommandStorage &commands, const path &root) const;
-    void save(const Files &files, const detail::Storage &, ConcurrentCommandStorage &commands, const path &root) const;
+    /// maps base file and loads log segments of all processes
+    void load(detail::Storage &, const path &root) const;
+    /// merges log segments into base file, closed segments are removed
+    void compact(const path &root, const path &live_segment) const;
 
-    static void write(std::vector<uint8_t> &, const CommandRecord &, const detail::Storage &);
+    static void write(std::vector<uint8_t> &, const CommandRecord &);
+    static void write(std::vector<uint8_t> &, const DepGroup &);
 };
 
 struct SW_BUILDER_API CommandStorage
@@ -109,24 +219,31 @@ struct SW_BUILDER_API CommandStorage
     void add_user();
     void free_user();
     std::pair<CommandRecord *, bool> insert(size_t hash);
+    /// returns nullptr if command was never executed
+    CommandRecord *find(size_t hash);
+    CommandRecord::History getHistory(size_t hash);
+    /// content hash of the file, rehashes it only when mtime or size is changed
+    uint64_t getFileHash(const path &, FileData &);
 
 private:
     FileDb fdb;
     detail::Storage s;
     std::atomic_int n_users{ 0 };
     std::mutex m;
-    std::unique_ptr<ScopedFileLock> lock;
-    bool saved = false;
-    bool changed = false;
+    // own log files, other processes and compactions do not touch them
+    std::unique_ptr<LogSegment> segment;
+    std::unique_ptr<LogWriter> log;
+    int commands_log = -1;
+    int files_log = -1;
+    int groups_log = -1;
+    std::future<void> compaction;
 
-    void closeLogs();
+    void async_file_log(const path &, const FileHashRecord &);
 
     void load();
     void save();
-    void save1();
-
-    std::unique_ptr<ScopedFileLock> getLock() const;
-    path getLockFileName() const;
+    size_t getCompactionThreshold() const;
+    void startCompaction(LogWriter::Context &);
 };
 
 }
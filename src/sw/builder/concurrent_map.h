@@ -18,43 +18,49 @@
 
 #pragma once
 
-#include <junction/ConcurrentMap_Leapfrog.h>
 #include <primitives/exceptions.h>
-#include <primitives/templates.h>
 
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <type_traits>
+#include <vector>
 
 namespace sw
 {
 
-using ConcurrentContext = junction::QSBR::Context;
-
+/// Concurrent hash map with integer keys and stable values.
+///
+/// Keys go to one of many shards, each with its own lock and open addressing table,
+/// so operations on different keys almost never wait for each other.
+/// Values are constructed in arenas of shards and are never moved,
+/// returned pointers stay valid until clear() or destruction.
+/// clear(), reserve() and destruction must not race with other calls.
 template <class K, class V>
 struct ConcurrentMap
 {
-    using MapType = junction::ConcurrentMap_Leapfrog<K, V*>;
-    //using MapType = std::unordered_map<K, V*>;
+    static_assert(std::is_integral_v<K>, "keys are hashes");
+
     using value_type = std::pair<K, V>;
     using insert_type = std::pair<V*, bool>;
 
-    ConcurrentMap()
-    {
-        clear();
-    }
+    ConcurrentMap() = default;
+    ConcurrentMap(const ConcurrentMap &) = delete;
+    ConcurrentMap &operator=(const ConcurrentMap &) = delete;
+    ~ConcurrentMap() = default;
 
-    ~ConcurrentMap()
+    void clear()
     {
-        // causes crashes
-        /*if (!map)
-            return;
-        for (auto i = getIterator(); i.isValid(); i.next())
-            delete i.getValue();
-        map.reset();*/
+        for (auto &sh : shards)
+            sh.clear();
     }
 
-    void clear()
+    /// prepares tables and arenas for n values
+    void reserve(size_t n)
     {
-        map = std::make_unique<MapType>();
+        auto per_shard = n / n_shards + 1;
+        for (auto &sh : shards)
+            sh.reserve(per_shard);
     }
 
     insert_type insert(const value_type &v)
@@ -62,114 +68,234 @@ struct ConcurrentMap
         return insert(v.first, v.second);
     }
 
-    template <class Deleter>
-    insert_type insert(K k, const V &v, Deleter &&d)
+    insert_type insert(K k)
     {
-        if (k == 0)
-            throw SW_RUNTIME_ERROR("ConcurrentMap: zero key");
-
-        //std::unique_lock lk(m);
-        return insert_no_lock(k, v, d);
+        return emplace(k);
     }
 
-    template <class Deleter>
-    insert_type insert_no_lock(K k, const V &v, Deleter &&d)
+    insert_type insert(K k, const V &v)
     {
-        if (k == 0)
-            throw SW_RUNTIME_ERROR("ConcurrentMap: zero key");
+        return emplace(k, v);
+    }
 
-        /*auto i = map->find(k);
-        if (i == map->end())
-        {
-            auto value = new V(v);
-            map->emplace(k, value);
-            return { value, true };
-        }
-        return { i->second, false };*/
+    insert_type insert(K k, V &&v)
+    {
+        return emplace(k, std::move(v));
+    }
 
-        auto i = map->insertOrFind(k);
-        auto value = i.getValue();
-        if (!value)
+    /// value is constructed only when key is new
+    template <class ... Args>
+    insert_type emplace(K k, Args && ... args)
+    {
+        auto h = mix(k);
+        auto &sh = getShard(h);
         {
-            value = new V(v);
-            auto oldValue = i.exchangeValue(value);
-            if (oldValue)
-            {
-                *value = *oldValue;
-                std::forward<Deleter>(d)(oldValue);
-                return { value, false };
-            }
-            return { value, true };
+            std::shared_lock lk(sh.m);
+            if (auto v = sh.find(k, h))
+                return { v, false };
         }
-        return { value, false };
+        std::unique_lock lk(sh.m);
+        if (auto v = sh.find(k, h))
+            return { v, false };
+        return { sh.add(k, h, std::forward<Args>(args)...), true };
     }
 
-    insert_type insert(K k, const V &v = V())
+    V &operator[](K k)
     {
-        if constexpr (std::is_pointer_v<V>)
-            return insert(k, v, [](auto *v)
-        {
-            junction::DefaultQSBR.enqueue(&V::destroy, v);
-        });
-        else
-            return insert(k, v, [](auto *v) {});
+        return *insert(k).first;
     }
 
-    insert_type insert_ptr(K k, const V &v = V())
+    V *find(K k) const
     {
-        if constexpr (std::is_pointer_v<V>)
-            return insert(k, v, [](auto *v) { delete *v; });
-        else
-            return insert(k, v, [](auto *v) {});
+        auto h = mix(k);
+        auto &sh = getShard(h);
+        std::shared_lock lk(sh.m);
+        return sh.find(k, h);
     }
 
-    V &operator[](K k)
+    size_t size() const
     {
-        return *insert(k).first;
+        size_t n = 0;
+        for (auto &sh : shards)
+        {
+            std::shared_lock lk(sh.m);
+            n += sh.n;
+        }
+        return n;
     }
 
-    const V &operator[](K k) const
+    /// Entries present at one moment, for saving and other full scans.
+    /// All shards are locked while entries are copied, so inserts made
+    /// during the call are either all seen or not.
+    std::vector<std::pair<K, V*>> snapshot() const
     {
-        return *insert(k).first;
+        std::vector<std::shared_lock<std::shared_mutex>> locks;
+        locks.reserve(n_shards);
+        size_t n = 0;
+        for (auto &sh : shards)
+        {
+            locks.emplace_back(sh.m);
+            n += sh.n;
+        }
+        std::vector<std::pair<K, V*>> v;
+        v.reserve(n);
+        for (auto &sh : shards)
+        {
+            for (auto &s : sh.slots)
+            {
+                if (s.value)
+                    v.emplace_back(s.key, s.value);
+            }
+        }
+        return v;
     }
 
-    auto getIterator()
+private:
+    static constexpr size_t n_shards = 64;
+
+    struct Slot
     {
-        return typename MapType::Iterator(*map);
-    }
+        K key{};
+        V *value = nullptr; // empty slot, so any key is allowed
+    };
 
-    struct end_iterator {};
-    struct iterator
+    // values of one shard, chunks are never reallocated
+    struct Arena
     {
-        typename MapType::Iterator i;
+        struct Chunk
+        {
+            V *p;
+            size_t size;
+            size_t used;
+        };
+        std::vector<Chunk> chunks;
+
+        Arena() = default;
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+        ~Arena() { clear(); }
+
+        void clear()
+        {
+            std::allocator<V> a;
+            for (auto &c : chunks)
+            {
+                for (size_t i = 0; i < c.used; i++)
+                    c.p[i].~V();
+                a.deallocate(c.p, c.size);
+            }
+            chunks.clear();
+        }
 
-        iterator(typename MapType::Iterator i) : i(i) {}
+        // next values go to one chunk
+        void reserve(size_t n)
+        {
+            if (!chunks.empty() && chunks.back().size - chunks.back().used >= n)
+                return;
+            chunks.push_back({ std::allocator<V>().allocate(n), n, 0 });
+        }
 
-        bool operator!=(const end_iterator &e) const { return i.isValid(); }
-        std::pair<K, V&> operator*() { return { i.getKey(), *i.getValue() }; }
-        void operator++() { i.next(); }
+        template <class ... Args>
+        V *allocate(Args && ... args)
+        {
+            if (chunks.empty() || chunks.back().used == chunks.back().size)
+                reserve(chunks.empty() ? 16 : std::min<size_t>(chunks.back().size * 2, 4096));
+            auto &c = chunks.back();
+            auto v = new (c.p + c.used) V(std::forward<Args>(args)...);
+            c.used++;
+            return v;
+        }
     };
 
-    iterator begin() { return getIterator(); }
-    end_iterator end() { return {}; }
+    struct alignas(64) Shard
+    {
+        mutable std::shared_mutex m;
+        std::vector<Slot> slots; // power of two
+        size_t n = 0;
+        Arena values;
 
-    // for usual maps
-    //iterator begin() { return map->begin(); }
-    //iterator end() { return map->end(); }
+        V *find(K k, size_t h) const
+        {
+            if (slots.empty())
+                return nullptr;
+            auto mask = slots.size() - 1;
+            for (auto i = h & mask;; i = (i + 1) & mask)
+            {
+                auto &s = slots[i];
+                if (!s.value)
+                    return nullptr;
+                if (s.key == k)
+                    return s.value;
+            }
+        }
 
-    //auto begin() const { return map->begin(); }
-    //auto end() const { return map->end(); }
+        template <class ... Args>
+        V *add(K k, size_t h, Args && ... args)
+        {
+            // at most half full, probes stay short
+            if ((n + 1) * 2 > slots.size())
+                rehash(std::max<size_t>(slots.size() * 2, 16));
+            // value first, table is not changed if constructor throws
+            auto v = values.allocate(std::forward<Args>(args)...);
+            auto mask = slots.size() - 1;
+            auto i = h & mask;
+            while (slots[i].value)
+                i = (i + 1) & mask;
+            slots[i] = { k, v };
+            n++;
+            return v;
+        }
 
+        void rehash(size_t size)
+        {
+            std::vector<Slot> old(size);
+            old.swap(slots);
+            auto mask = slots.size() - 1;
+            for (auto &s : old)
+            {
+                if (!s.value)
+                    continue;
+                auto i = mix(s.key) & mask;
+                while (slots[i].value)
+                    i = (i + 1) & mask;
+                slots[i] = s;
+            }
+        }
+
+        void reserve(size_t count)
+        {
+            std::unique_lock lk(m);
+            size_t size = 16;
+            while (size < count * 2)
+                size *= 2;
+            if (size > slots.size())
+                rehash(size);
+            if (count > n)
+                values.reserve(count - n);
+        }
 
-    /*for (auto i = getIterator(); i.isValid(); i.next())
+        void clear()
+        {
+            std::unique_lock lk(m);
+            slots.clear();
+            slots.shrink_to_fit();
+            n = 0;
+            values.clear();
+        }
+    };
+
+    Shard shards[n_shards];
+
+    // keys may be small numbers or hashes with weak low bits
+    static size_t mix(K k)
     {
-        b.write(i.getKey());
-        b.write(*i.getValue()->mtime);
-    }*/
+        uint64_t h = (uint64_t)k * 0x9E3779B97F4A7C15ULL;
+        return (size_t)(h ^ (h >> 32));
+    }
 
-private:
-    std::unique_ptr<MapType> map;
-    //std::mutex m;
+    // high bits select shard, low bits select slot
+    Shard &getShard(size_t h) { return shards[(h >> 26) % n_shards]; }
+    const Shard &getShard(size_t h) const { return shards[(h >> 26) % n_shards]; }
 };
 
 template <class V>
@@ -185,37 +311,25 @@ struct ConcurrentHashMap : ConcurrentMapSimple<V>
 
     using Base::insert;
 
-    insert_type insert(const K &k, const V &v = V())
+    insert_type insert(const K &k)
     {
-        return insert(value_type{ k, v });
+        return Base::insert(std::hash<K>()(k));
     }
 
-    insert_type insert(const value_type &v)
+    insert_type insert(const K &k, const V &v)
     {
-        return Base::insert(std::hash<K>()(v.first), v.second);
+        return Base::insert(std::hash<K>()(k), v);
     }
 
-    V &operator[](const K &k)
+    insert_type insert(const value_type &v)
     {
-        return *insert(k).first;
+        return Base::insert(std::hash<K>()(v.first), v.second);
     }
 
-    const V &operator[](const K &k) const
+    V &operator[](const K &k)
     {
         return *insert(k).first;
     }
 };
 
-SW_BUILDER_API
-SW_DECLARE_GLOBAL_STATIC_FUNCTION(ConcurrentContext, getConcurrentContext);
-
-SW_BUILDER_API
-ConcurrentContext createConcurrentContext();
-
-SW_BUILDER_API
-void destroyConcurrentContext(ConcurrentContext ctx);
-
-SW_BUILDER_API
-void updateConcurrentContext();
-
 }
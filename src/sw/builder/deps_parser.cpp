@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "deps_parser.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SW_DEPS_PARSER_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace sw
+{
+
+static bool is_gnu_special(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\\';
+}
+
+#ifdef SW_DEPS_PARSER_SSE2
+static int first_bit(unsigned mask)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, mask);
+    return (int)i;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+const char *find_deps_gnu_special(const char *p, const char *end)
+{
+#ifdef SW_DEPS_PARSER_SSE2
+    // paths are long, check 16 bytes at once
+    const auto space = _mm_set1_epi8(' ');
+    const auto tab = _mm_set1_epi8('\t');
+    const auto cr = _mm_set1_epi8('\r');
+    const auto lf = _mm_set1_epi8('\n');
+    const auto bs = _mm_set1_epi8('\\');
+    for (; end - p >= 16; p += 16)
+    {
+        auto v = _mm_loadu_si128((const __m128i *)p);
+        auto m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)), _mm_cmpeq_epi8(v, bs)));
+        if (auto mask = (unsigned)_mm_movemask_epi8(m))
+            return p + first_bit(mask);
+    }
+#endif
+    for (; p < end; p++)
+    {
+        if (is_gnu_special(*p))
+            return p;
+    }
+    return end;
+}
+
+}
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+#include <cstring>
+#include <string_view>
+
+namespace sw
+{
+
+/// Scanners of dependency lists written by compilers.
+///
+/// Paths are passed to callback as views that are valid only during the call.
+/// They point into input text, only escaped paths are copied into a scratch string.
+
+/// returns the first of ' ', '\t', '\r', '\n', '\\' in [p, end) or end
+SW_BUILDER_API
+const char *find_deps_gnu_special(const char *p, const char *end);
+
+/// GNU make rule from -MD/-MMD in form 'target: deps'.
+/// Deps are split by spaces on several lines with backslash at the end of each line except the last one,
+/// spaces in paths are escaped with backslash.
+template <class F>
+void parse_deps_gnu(std::string_view text, F &&f)
+{
+    // skip target
+    //  use exactly ": " because on windows target is 'C:/path/to/file: '
+    //                                           skip up to this space ^
+    if (auto pos = text.find(": "); pos != text.npos)
+        text.remove_prefix(pos + 1);
+
+    String scratch;
+    auto p = text.data();
+    auto end = p + text.size();
+    while (p < end)
+    {
+        if (isspace((unsigned char)*p) || *p == '\\')
+        {
+            p++;
+            continue;
+        }
+
+        auto begin = p;
+        bool escaped = false;
+        while (1)
+        {
+            p = find_deps_gnu_special(p, end);
+            if (p == end || *p != '\\')
+                break;
+            if (p + 1 == end)
+                break;
+            if (p[1] == ' ')
+            {
+                escaped = true;
+                p += 2;
+                continue;
+            }
+            // line continuation right after filename (protobuf does not put space there)
+            if (p[1] == '\n' || p[1] == '\r')
+                break;
+            // windows separators
+            p++;
+        }
+
+        std::string_view file(begin, p - begin);
+        if (escaped)
+        {
+            scratch.clear();
+            for (size_t i = 0; i < file.size(); i++)
+            {
+                if (file[i] == '\\' && i + 1 < file.size() && file[i + 1] == ' ')
+                    continue;
+                scratch += file[i];
+            }
+            file = scratch;
+        }
+        f(file);
+    }
+}
+
+/// Takes /showIncludes lines out of compiler output.
+/// Lines that start with prefix are removed from text in place, their paths are passed to callback.
+/// cl.exe prints name of the source file as the first line of stdout, it is removed too.
+template <class F>
+void parse_deps_msvc(String &text, std::string_view prefix, bool skip_first_line, F &&f)
+{
+    auto p = text.data();
+    auto end = p + text.size();
+    auto out = p; // kept lines are moved here, paths are passed before they are overwritten
+    if (skip_first_line)
+    {
+        auto eol = (char *)memchr(p, '\n', end - p);
+        p = eol ? eol + 1 : end;
+    }
+    while (p < end)
+    {
+        auto eol = (char *)memchr(p, '\n', end - p);
+        auto next = eol ? eol + 1 : end;
+        std::string_view line(p, (eol ? eol : end) - p);
+        if (line.size() >= prefix.size() && memcmp(line.data(), prefix.data(), prefix.size()) == 0)
+        {
+            line.remove_prefix(prefix.size());
+            while (!line.empty() && isspace((unsigned char)line.front()))
+                line.remove_prefix(1);
+            while (!line.empty() && isspace((unsigned char)line.back()))
+                line.remove_suffix(1);
+            f(line);
+        }
+        else
+        {
+            if (out != p)
+                memmove(out, p, next - p);
+            out += next - p;
+        }
+        p = next;
+    }
+    text.resize(out - text.data());
+}
+
+}
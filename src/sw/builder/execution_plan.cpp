@@ -23,6 +23,11 @@
 #include <nlohmann/json.hpp>
 #include <primitives/exceptions.h>
 
+#include <queue>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "explan");
+
 namespace sw
 {
 
@@ -63,12 +68,15 @@ void ExecutionPlan::execute(Executor &e) const
     if (commands.empty())
         return;
 
+    // completion tracking
+    // every job reports here when finished, main thread sleeps until all pushed jobs are done
     std::mutex m;
-    std::vector<Future<void>> fs;
-    std::vector<Future<void>> all;
+    std::condition_variable cv;
+    size_t n_pushed = 0; // under m
+    size_t n_done = 0; // under m
+    std::vector<std::exception_ptr> eptrs; // under m
     std::atomic_bool stopped = false;
     interrupted = false;
-    std::atomic_int running = 0;
     std::atomic_int64_t askip_errors = skip_errors;
 
     bool build_commands = dynamic_cast<builder::Command *>(*commands.begin());
@@ -86,24 +94,144 @@ void ExecutionPlan::execute(Executor &e) const
             static_cast<builder::Command*>(c)->show_output |= show_output;
             static_cast<builder::Command*>(c)->write_output_to_file |= write_output_to_file;
             static_cast<builder::Command*>(c)->always |= build_always;
+            static_cast<builder::Command*>(c)->use_content_hash |= content_hash;
+            static_cast<builder::Command*>(c)->use_action_cache |= action_cache;
+            if (remote_cache)
+                static_cast<builder::Command*>(c)->remote_cache = remote_cache;
+            if (remote_executor)
+                static_cast<builder::Command*>(c)->remote_executor = remote_executor;
         }
         //c->markForExecution();
     }
 
+    // workers change history of commands, so estimates are taken once before execution
+    Priorities estimates;
+    if (scheduling == SchedulingMode::CriticalPath || show_progress || !progress_status_file.empty())
+    {
+        estimates.reserve(commands.size());
+        for (auto &c : commands)
+            estimates[c] = c->getEstimatedDuration();
+    }
+
+    // commands that are up to date by their own files
+    // they are skipped without going through executor when all their deps are up to date too
+    USet up_to_date;
+    if (build_commands && prefetch_file_info && !build_always)
+        up_to_date = checkOutdated(e);
+    auto is_up_to_date = [&up_to_date](PtrT c)
+    {
+        if (up_to_date.find(c) == up_to_date.end())
+            return false;
+        return std::all_of(c->dependencies.begin(), c->dependencies.end(), [](const auto &d)
+        {
+            return static_cast<builder::Command *>(d.get())->isUpToDate();
+        });
+    };
+
+    std::unique_ptr<ExecutionProgress> progress;
+    if (show_progress || !progress_status_file.empty())
+    {
+        progress = std::make_unique<ExecutionProgress>(e.numberOfThreads());
+        progress->print = show_progress;
+        progress->status_file = progress_status_file;
+        progress->start(commands, estimates, build_commands && prefetch_file_info && !build_always ? &up_to_date : nullptr);
+    }
+
+    // priority scheduling
+    // executor is fifo, so every pushed job takes the best command from the ready queue
+    auto priorities = scheduling == SchedulingMode::CriticalPath ? getBottomLevels(estimates) : Priorities{};
+    auto get_priority = [&priorities](PtrT c)
+    {
+        auto i = priorities.find(c);
+        return i == priorities.end() ? Duration{ 0 } : i->second;
+    };
+    auto less_priority = [&get_priority](PtrT c1, PtrT c2)
+    {
+        return get_priority(c1) < get_priority(c2);
+    };
+    std::priority_queue<PtrT, VecT, decltype(less_priority)> ready(less_priority);
+
     std::function<void(PtrT)> run;
-    run = [this, &askip_errors, &e, &run, &fs, &all, &m, &running, &stopped](T *c)
+    auto run_and_report = [&run, &m, &cv, &n_pushed, &n_done, &eptrs](PtrT c)
+    {
+        std::exception_ptr eptr;
+        try
+        {
+            run(c);
+        }
+        catch (...)
+        {
+            eptr = std::current_exception();
+        }
+        std::unique_lock<std::mutex> lk(m);
+        if (eptr)
+            eptrs.push_back(eptr);
+        // notify under lock, main thread destroys cv right after wake up
+        if (++n_done == n_pushed)
+            cv.notify_all();
+    };
+    auto push = [this, &e, &run_and_report, &m, &ready](PtrT c)
+    {
+        if (scheduling == SchedulingMode::CriticalPath)
+        {
+            ready.push(c);
+            e.push([&run_and_report, &m, &ready]
+            {
+                PtrT c;
+                {
+                    std::unique_lock<std::mutex> lk(m);
+                    c = ready.top();
+                    ready.pop();
+                }
+                run_and_report(c);
+            });
+        }
+        else
+            e.push([&run_and_report, c] {run_and_report(c); });
+    };
+    std::function<void(PtrT)> schedule; // call under lock
+    schedule = [&push, &is_up_to_date, &progress, &n_pushed, &n_done](PtrT c)
+    {
+        // worklist, chains of up to date commands may be long
+        VecT work{ c };
+        while (!work.empty())
+        {
+            auto c = work.back();
+            work.pop_back();
+            ++n_pushed;
+            if (!is_up_to_date(c))
+            {
+                push(c);
+                continue;
+            }
+            static_cast<builder::Command *>(c)->markUpToDate();
+            if (progress)
+                progress->onCommandFinished(*c, false, {});
+            ++n_done;
+            for (auto &d : c->dependent_commands)
+            {
+                if (--d->dependencies_left == 0)
+                    work.push_back((T *)d.get());
+            }
+        }
+    };
+
+    run = [this, &askip_errors, &schedule, &m, &stopped, &progress, build_commands](T *c)
     {
         if (stopped || interrupted)
             return;
         try
         {
-            running++;
+            auto t0 = Clock::now();
             c->execute();
-            running--;
+            if (progress)
+            {
+                bool executed = !build_commands || !static_cast<builder::Command *>(c)->isUpToDate();
+                progress->onCommandFinished(*c, executed, std::chrono::duration_cast<Duration>(Clock::now() - t0));
+            }
         }
         catch (...)
         {
-            running--;
             if (--askip_errors < 1)
                 stopped = true;
             if (throw_on_errors)
@@ -114,8 +242,7 @@ void ExecutionPlan::execute(Executor &e) const
             if (--d->dependencies_left == 0)
             {
                 std::unique_lock<std::mutex> lk(m);
-                fs.push_back(e.push([&run, d] {run((T *)d.get()); }));
-                all.push_back(fs.back());
+                schedule((T *)d.get());
             }
         }
 
@@ -131,6 +258,20 @@ void ExecutionPlan::execute(Executor &e) const
     // TODO: check non-outdated commands and lower total_commands
     // total_commands -= non outdated;
 
+    // predicted makespan is bounded by the critical path and by the total work spread over all threads
+    Duration predicted{ 0 };
+    if (scheduling == SchedulingMode::CriticalPath)
+    {
+        Duration total{ 0 };
+        for (auto &c : commands)
+        {
+            predicted = std::max(predicted, get_priority(c));
+            total += estimates.at(c);
+        }
+        predicted = std::max(predicted, total / (Duration::rep)std::max<size_t>(e.numberOfThreads(), 1));
+    }
+    auto t_start = Clock::now();
+
     // run commands without deps
     {
         std::unique_lock<std::mutex> lk(m);
@@ -139,44 +280,30 @@ void ExecutionPlan::execute(Executor &e) const
             if (!c->dependencies.empty())
                 //continue;
                 break;
-            fs.push_back(e.push([&run, c] {run(c); }));
-            all.push_back(fs.back());
+            schedule(c);
         }
     }
 
-    // wait for all commands until exception
-    int i = 0;
-    auto sz = commands.size();
-    std::vector<std::exception_ptr> eptrs;
-    while (i != sz)
+    // wait for all jobs
+    // dependents are pushed before the job reports, so n_done == n_pushed means nothing is running
+    // and nothing more will be pushed (all commands are done or we were stopped)
+    size_t i;
     {
-        std::vector<Future<void>> fs2;
-        {
-            std::unique_lock<std::mutex> lk(m);
-            fs2 = fs;
-            fs.clear();
-        }
-        for (auto &f : fs2)
-        {
-            i++;
-            f.wait();
-        }
-        if (stopped || fs2.empty() || interrupted)
-            break;
+        std::unique_lock<std::mutex> lk(m);
+        cv.wait(lk, [&n_pushed, &n_done] { return n_done == n_pushed; });
+        i = n_done;
     }
+    auto sz = commands.size();
+    if (progress)
+        progress->stop();
 
-    // wait other jobs to finish or it will crash
-    while (running)
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-    // gather exceptions
-    for (auto &f : all)
+    if (scheduling == SchedulingMode::CriticalPath)
     {
-        if (f.state->eptr)
-            eptrs.push_back(f.state->eptr);
+        auto actual = std::chrono::duration_cast<Duration>(Clock::now() - t_start);
+        LOG_INFO(logger, "Critical path scheduling: predicted makespan = " << predicted.count() / 1000.0
+            << " s., actual = " << actual.count() / 1000.0 << " s.");
     }
 
-    // ... or it will crash here in throw
     if (!eptrs.empty() && throw_on_errors)
         throw support::ExceptionVector(eptrs);
 
@@ -190,6 +317,45 @@ void ExecutionPlan::execute(Executor &e) const
     }
 }
 
+ExecutionPlan::USet ExecutionPlan::checkOutdated(Executor &e) const
+{
+    // Check commands in parallel batches.
+    // This refreshes file info (stat) of all inputs, outputs and implicit inputs
+    // in parallel, instead of doing it lazily in every worker right before execution.
+    // Commands are checked again during execution if any of their deps is outdated.
+    static constexpr size_t batch_size = 64;
+
+    std::vector<uint8_t> outdated(commands.size(), 1);
+    std::vector<Future<void>> fs;
+    for (size_t b = 0; b < commands.size(); b += batch_size)
+    {
+        fs.push_back(e.push([this, &outdated, b]
+        {
+            auto end = std::min(b + batch_size, commands.size());
+            for (auto i = b; i < end; i++)
+            {
+                try
+                {
+                    outdated[i] = static_cast<builder::Command *>(commands[i])->isOutdated();
+                }
+                catch (...)
+                {
+                    // errors will be reported during execution
+                }
+            }
+        }));
+    }
+    waitAndGet(fs);
+
+    USet up_to_date;
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        if (!outdated[i])
+            up_to_date.insert(commands[i]);
+    }
+    return up_to_date;
+}
+
 void ExecutionPlan::saveChromeTrace(const path &p) const
 {
     // calculate minimal time
@@ -363,6 +529,44 @@ ExecutionPlan::Graph ExecutionPlan::getGraph(const VecT &v, GraphMapping &gm)
     return g;
 }
 
+ExecutionPlan::Priorities ExecutionPlan::getBottomLevels(const Priorities &durations) const
+{
+    // bottom level = longest path (by estimated durations) from command to any sink
+    // we walk the plan in reverse topological order, so all dependents are ready before the command
+    Priorities bl;
+    bl.reserve(commands.size());
+    std::unordered_map<PtrT, size_t> n_dependents;
+    n_dependents.reserve(commands.size());
+    std::deque<PtrT> q;
+    for (auto &c : commands)
+    {
+        auto n = c->dependent_commands.size();
+        n_dependents[c] = n;
+        if (n == 0)
+            q.push_back(c);
+    }
+    while (!q.empty())
+    {
+        auto c = q.front();
+        q.pop_front();
+        Duration d{ 0 };
+        for (auto &dc : c->dependent_commands)
+        {
+            auto i = bl.find((PtrT)dc.get());
+            if (i != bl.end())
+                d = std::max(d, i->second);
+        }
+        bl[c] = d + durations.at(c);
+        for (auto &dep : c->dependencies)
+        {
+            auto i = n_dependents.find((PtrT)dep.get());
+            if (i != n_dependents.end() && --i->second == 0)
+                q.push_back(i->first);
+        }
+    }
+    return bl;
+}
+
 void ExecutionPlan::transitiveReduction()
 {
     auto gm = getGraphMapping(commands);
@@ -493,32 +697,68 @@ void ExecutionPlan::prepare(USet &cmds)
 
 void ExecutionPlan::init(USet &cmds)
 {
-    while (!cmds.empty())
+    // Kahn's algorithm: O(V+E)
+    // we count only deps that are present in the input set
+
+    // assign indices
+    std::unordered_map<PtrT, size_t> idx;
+    idx.reserve(cmds.size());
+    VecT v(cmds.begin(), cmds.end());
+    for (size_t i = 0; i < v.size(); i++)
+        idx[v[i]] = i;
+
+    // in degrees and reverse edges (dependency -> its dependents)
+    std::vector<size_t> n_deps(v.size());
+    Vec<VecT> dependents(v.size());
+    for (size_t i = 0; i < v.size(); i++)
     {
-        bool added = false;
-        for (auto it = cmds.begin(); it != cmds.end();)
+        for (auto &d : v[i]->dependencies)
         {
-            // count number of deps
-            auto n = std::count_if((*it)->dependencies.begin(), (*it)->dependencies.end(),
-                [this, &cmds](auto &d) { return cmds.find(d.get()) != cmds.end(); });
-            if (n)
-            {
-                it++;
+            auto it = idx.find((PtrT)d.get());
+            if (it == idx.end())
                 continue;
-            }
-            added = true;
-            commands.push_back(*it);
-            it = cmds.erase(it);
+            n_deps[i]++;
+            dependents[it->second].push_back(v[i]);
         }
-        if (!added)
+    }
+
+    // fifo keeps level order: commands without deps go first
+    std::deque<size_t> ready;
+    for (size_t i = 0; i < v.size(); i++)
+    {
+        if (n_deps[i] == 0)
+            ready.push_back(i);
+    }
+
+    commands.reserve(v.size());
+    while (!ready.empty())
+    {
+        auto i = ready.front();
+        ready.pop_front();
+        commands.push_back(v[i]);
+        for (auto &d : dependents[i])
         {
-            // We failed with stupid algorithm, now we must perform smarter.
-            // Shall we?
-            unprocessed_commands.insert(unprocessed_commands.end(), cmds.begin(), cmds.end());
-            unprocessed_commands_set = cmds;
-            return;
+            auto j = idx[d];
+            if (--n_deps[j] == 0)
+                ready.push_back(j);
+        }
+    }
+
+    if (commands.size() != v.size())
+    {
+        // cycles: everything left has non-zero in degree
+        // (commands in cycles and commands that depend on them)
+        for (size_t i = 0; i < v.size(); i++)
+        {
+            if (n_deps[i] == 0)
+                continue;
+            unprocessed_commands.push_back(v[i]);
+            unprocessed_commands_set.insert(v[i]);
         }
+        cmds = unprocessed_commands_set;
+        return;
     }
+    cmds.clear();
 
     // setup
 
@@ -19,13 +19,14 @@
 #pragma once
 
 #include "command.h"
+#include "progress.h"
 
 #include <iso646.h> // for #include <boost/graph/transitive_reduction.hpp>
 #include <boost/graph/graph_traits.hpp>
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/strong_components.hpp>
-#include <boost/graph/transitive_reduction.hpp>
-#include <boost/graph/graph_utility.hpp> // dumping graphs
+#include <boost/graph/transitive_reduction.hpp>
+#include <boost/graph/graph_utility.hpp> // dumping graphs
 #include <boost/graph/graphviz.hpp>      // generating pictures
 
 #include <chrono>
@@ -54,14 +55,32 @@ struct SW_BUILDER_API ExecutionPlan
     using StrongComponents = std::vector<size_t>;
 
     using Clock = std::chrono::steady_clock;
+    using Duration = T::Duration;
+    using Priorities = std::unordered_map<PtrT, Duration>;
+
+    enum class SchedulingMode
+    {
+        // ready commands are started in order they become ready
+        Fifo,
+        // ready command with the longest path to the end of the build goes first
+        CriticalPath,
+    };
 
 public:
     int64_t skip_errors = 0;
+    SchedulingMode scheduling = SchedulingMode::Fifo;
     bool throw_on_errors = true;
     bool build_always = false;
+    bool content_hash = false; // use content hashes of inputs for up to date checks
+    bool action_cache = false; // restore command outputs from local action cache
+    RemoteActionCache *remote_cache = nullptr;
+    RemoteExecutor *remote_executor = nullptr; // send commands to distributed build server
     bool silent = false;
     bool show_output = false;
     bool write_output_to_file = false;
+    bool show_progress = false;
+    bool prefetch_file_info = true; // check commands in parallel before execution
+    path progress_status_file;
 
     ExecutionPlan(USet &cmds);
     ExecutionPlan(const ExecutionPlan &rhs) = delete;
@@ -77,8 +96,10 @@ public:
     void stop(bool interrupt_running_commands = false);
 
     // functions for builder::Command's
-    static Commands load(const path &, const SwBuilderContext &, int type = 0);
-    void save(const path &, int type = 0) const;
+    // see ExecutionPlanFile for the format
+    /// all commands are decoded at once, execution checks every one of them
+    static Commands load(const path &, const SwBuilderContext &);
+    void save(const path &) const;
 
     void saveChromeTrace(const path &) const;
     void setTimeLimit(const Clock::duration &);
@@ -128,6 +149,8 @@ private:
 
     static GraphMapping getGraphMapping(const VecT &v);
     static Graph getGraph(const VecT &v, GraphMapping &gm);
+    Priorities getBottomLevels(const Priorities &durations) const;
+    USet checkOutdated(Executor &) const;
     void transitiveReduction();
     static std::tuple<Graph, VertexMap> transitiveReduction(const Graph &g);
     static void prepare(USet &cmds);
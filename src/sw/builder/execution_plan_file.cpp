@@ -0,0 +1,432 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "execution_plan_file.h"
+
+#include "command_storage.h"
+
+#include <primitives/exceptions.h>
+
+#include <algorithm>
+#include <fstream>
+
+#define EXECUTION_PLAN_MAGIC 0x50455753 // SWEP
+
+namespace sw
+{
+
+namespace
+{
+
+enum : uint64_t
+{
+    InInherit               = 1 << 0,
+    OutInherit              = 1 << 1,
+    ErrInherit              = 1 << 2,
+    OutAppend               = 1 << 3,
+    ErrAppend               = 1 << 4,
+    Detached                = 1 << 5,
+    CreateNewConsole        = 1 << 6,
+    ProtectArgsWithQuotes   = 1 << 7,
+    Always                  = 1 << 8,
+    RemoveOutputs           = 1 << 9,
+    HasCommandStorage       = 1 << 10,
+};
+
+uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+struct RecordWriter
+{
+    String records;
+    String pool;
+    std::vector<uint64_t> string_offsets{ 0 };
+    std::unordered_map<String, uint64_t> ids;
+
+    RecordWriter()
+    {
+        // empty string
+        string_offsets.push_back(0);
+        ids[{}] = 0;
+    }
+
+    void varint(uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            records += (char)(v | 0x80);
+            v >>= 7;
+        }
+        records += (char)v;
+    }
+
+    uint64_t getId(const String &s)
+    {
+        auto [i, inserted] = ids.emplace(s, string_offsets.size() - 1);
+        if (inserted)
+        {
+            pool += s;
+            string_offsets.push_back(pool.size());
+        }
+        return i->second;
+    }
+
+    void string(const String &s)
+    {
+        varint(getId(s));
+    }
+
+    void string(const path &p)
+    {
+        string(p.u8string());
+    }
+
+    void files(const Files &files)
+    {
+        // unordered, but files are usually taken from the same places, so sort them for stable output
+        Strings v;
+        v.reserve(files.size());
+        for (auto &f : files)
+            v.push_back(f.u8string());
+        std::sort(v.begin(), v.end());
+        varint(v.size());
+        for (auto &f : v)
+            string(f);
+    }
+
+    void command(const builder::Command &c)
+    {
+        string(c.name);
+        string(c.working_directory);
+        varint(c.environment.size());
+        for (auto &[k, v] : c.environment)
+        {
+            string(k);
+            string(v);
+        }
+        varint(c.arguments.size());
+        for (auto &a : c.arguments)
+            string(a->toString());
+        string(c.in.file);
+        string(c.in.text);
+        string(c.out.file);
+        string(c.err.file);
+
+        uint64_t flags = 0;
+        auto set = [&flags](bool v, uint64_t f)
+        {
+            if (v)
+                flags |= f;
+        };
+        set(c.in.inherit, InInherit);
+        set(c.out.inherit, OutInherit);
+        set(c.err.inherit, ErrInherit);
+        set(c.out.append, OutAppend);
+        set(c.err.append, ErrAppend);
+        set(c.detached, Detached);
+        set(c.create_new_console, CreateNewConsole);
+        set(c.protect_args_with_quotes, ProtectArgsWithQuotes);
+        set(c.always, Always);
+        set(c.remove_outputs_before_execution, RemoveOutputs);
+        set(c.command_storage, HasCommandStorage);
+        varint(flags);
+
+        string(c.command_storage ? c.command_storage->root : c.command_storage_root);
+        varint((uint64_t)c.deps_processor);
+        string(c.deps_module);
+        string(c.deps_function);
+        string(c.deps_file);
+        string(c.msvc_prefix);
+        varint(zigzag(c.first_response_file_argument));
+        varint(zigzag(c.strict_order));
+
+        files(c.output_dirs);
+        files(c.inputs);
+        files(c.outputs);
+    }
+};
+
+struct RecordReader
+{
+    const ExecutionPlanFile &f;
+    const char *p;
+    const char *end;
+
+    uint64_t varint()
+    {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (p == end)
+                throw SW_RUNTIME_ERROR("Bad execution plan record: " + normalize_path(f.getFilename()));
+            auto b = (uint8_t)*p++;
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return v;
+        }
+        throw SW_RUNTIME_ERROR("Bad execution plan record: " + normalize_path(f.getFilename()));
+    }
+
+    String string()
+    {
+        return String(f.getString(varint()));
+    }
+
+    path file()
+    {
+        auto s = f.getString(varint());
+        return fs::u8path(s.begin(), s.end());
+    }
+
+    void files(Files &files)
+    {
+        auto n = varint();
+        files.reserve(n);
+        while (n--)
+            files.insert(file());
+    }
+
+    void command(builder::Command &c)
+    {
+        c.name = string();
+        c.working_directory = file();
+        auto n = varint();
+        while (n--)
+        {
+            auto k = string();
+            c.environment[k] = string();
+        }
+        n = varint();
+        while (n--)
+            c.arguments.push_back(std::make_unique<primitives::command::SimpleArgument>(string()));
+        c.in.file = file();
+        c.in.text = string();
+        c.out.file = file();
+        c.err.file = file();
+
+        auto flags = varint();
+        c.in.inherit = flags & InInherit;
+        c.out.inherit = flags & OutInherit;
+        c.err.inherit = flags & ErrInherit;
+        c.out.append = flags & OutAppend;
+        c.err.append = flags & ErrAppend;
+        c.detached = flags & Detached;
+        c.create_new_console = flags & CreateNewConsole;
+        c.protect_args_with_quotes = flags & ProtectArgsWithQuotes;
+        c.always = flags & Always;
+        c.remove_outputs_before_execution = flags & RemoveOutputs;
+
+        auto root = file();
+        if (flags & HasCommandStorage)
+            c.command_storage_root = root;
+        c.deps_processor = (builder::Command::DepsProcessor)varint();
+        c.deps_module = file();
+        c.deps_function = string();
+        c.deps_file = file();
+        c.msvc_prefix = string();
+        c.first_response_file_argument = (int)unzigzag(varint());
+        c.strict_order = (int)unzigzag(varint());
+
+        files(c.output_dirs);
+        files(c.inputs);
+        files(c.outputs);
+    }
+};
+
+}
+
+ExecutionPlanFile::ExecutionPlanFile(const path &fn)
+    : fn(fn)
+{
+    using namespace boost::interprocess;
+
+    try
+    {
+        m = file_mapping(fn.string().c_str(), read_only);
+        r = mapped_region(m, read_only);
+    }
+    catch (interprocess_exception &e)
+    {
+        throw SW_RUNTIME_ERROR("Cannot read file: " + normalize_path(fn) + ": " + e.what());
+    }
+
+    if (r.get_size() < sizeof(Header))
+        throw SW_RUNTIME_ERROR("Bad execution plan: " + normalize_path(fn));
+    auto &h = header();
+    if (h.magic != EXECUTION_PLAN_MAGIC || h.version != EXECUTION_PLAN_FORMAT_VERSION)
+        throw SW_RUNTIME_ERROR("Bad execution plan version: " + normalize_path(fn));
+    auto sz = sizeof(Header) +
+        (h.n_strings + 1) * sizeof(uint64_t) +
+        (h.n_commands + 1) * sizeof(uint64_t) * 2 +
+        h.n_dependencies * sizeof(uint32_t) +
+        h.records_size +
+        h.strings_size;
+    if (sz != r.get_size())
+        throw SW_RUNTIME_ERROR("Bad execution plan size: " + normalize_path(fn));
+    if (recordOffsets()[h.n_commands] != h.records_size ||
+        dependencyOffsets()[h.n_commands] != h.n_dependencies ||
+        stringOffsets()[h.n_strings] != h.strings_size)
+        throw SW_RUNTIME_ERROR("Bad execution plan: " + normalize_path(fn));
+}
+
+const uint64_t *ExecutionPlanFile::stringOffsets() const
+{
+    return (const uint64_t *)((const char *)r.get_address() + sizeof(Header));
+}
+
+const uint64_t *ExecutionPlanFile::recordOffsets() const
+{
+    return stringOffsets() + header().n_strings + 1;
+}
+
+const uint64_t *ExecutionPlanFile::dependencyOffsets() const
+{
+    return recordOffsets() + header().n_commands + 1;
+}
+
+const uint32_t *ExecutionPlanFile::dependencies() const
+{
+    return (const uint32_t *)(dependencyOffsets() + header().n_commands + 1);
+}
+
+const char *ExecutionPlanFile::records() const
+{
+    return (const char *)(dependencies() + header().n_dependencies);
+}
+
+const char *ExecutionPlanFile::strings() const
+{
+    return records() + header().records_size;
+}
+
+std::string_view ExecutionPlanFile::getString(size_t i) const
+{
+    if (i >= header().n_strings)
+        throw SW_RUNTIME_ERROR("Bad string in execution plan: " + normalize_path(fn));
+    auto b = stringOffsets()[i];
+    auto e = stringOffsets()[i + 1];
+    if (b > e || e > header().strings_size)
+        throw SW_RUNTIME_ERROR("Bad string in execution plan: " + normalize_path(fn));
+    return { strings() + b, e - b };
+}
+
+path ExecutionPlanFile::getWorkingDirectory() const
+{
+    auto s = getString(header().working_directory);
+    return fs::u8path(s.begin(), s.end());
+}
+
+std::shared_ptr<builder::Command> ExecutionPlanFile::getCommand(size_t i) const
+{
+    if (i >= getNumberOfCommands())
+        throw SW_RUNTIME_ERROR("Bad command in execution plan: " + normalize_path(fn));
+    auto b = recordOffsets()[i];
+    auto e = recordOffsets()[i + 1];
+    if (b > e || e > header().records_size)
+        throw SW_RUNTIME_ERROR("Bad command in execution plan: " + normalize_path(fn));
+
+    auto c = std::make_shared<builder::Command>();
+    RecordReader rr{ *this, records() + b, records() + e };
+    rr.command(*c);
+    return c;
+}
+
+size_t ExecutionPlanFile::getNumberOfDependencies(size_t i) const
+{
+    if (i >= getNumberOfCommands())
+        throw SW_RUNTIME_ERROR("Bad command in execution plan: " + normalize_path(fn));
+    auto b = dependencyOffsets()[i];
+    auto e = dependencyOffsets()[i + 1];
+    if (b > e || e > header().n_dependencies)
+        throw SW_RUNTIME_ERROR("Bad dependencies in execution plan: " + normalize_path(fn));
+    return e - b;
+}
+
+const uint32_t *ExecutionPlanFile::getDependencies(size_t i) const
+{
+    getNumberOfDependencies(i); // check
+    return dependencies() + dependencyOffsets()[i];
+}
+
+void ExecutionPlanFile::write(const path &fn, const path &working_directory, const std::vector<builder::Command *> &commands)
+{
+    RecordWriter w;
+    auto cwd = w.getId(working_directory.u8string());
+
+    std::unordered_map<const CommandNode *, uint32_t> idx;
+    idx.reserve(commands.size());
+    for (size_t i = 0; i < commands.size(); i++)
+        idx[commands[i]] = (uint32_t)i;
+
+    std::vector<uint64_t> record_offsets{ 0 };
+    std::vector<uint64_t> dependency_offsets{ 0 };
+    std::vector<uint32_t> deps;
+    record_offsets.reserve(commands.size() + 1);
+    dependency_offsets.reserve(commands.size() + 1);
+    for (auto c : commands)
+    {
+        w.command(*c);
+        record_offsets.push_back(w.records.size());
+
+        auto first = deps.size();
+        for (auto &d : c->dependencies)
+        {
+            auto i = idx.find(d.get());
+            if (i != idx.end())
+                deps.push_back(i->second);
+        }
+        std::sort(deps.begin() + first, deps.end());
+        dependency_offsets.push_back(deps.size());
+    }
+
+    Header h{};
+    h.magic = EXECUTION_PLAN_MAGIC;
+    h.version = EXECUTION_PLAN_FORMAT_VERSION;
+    h.n_strings = w.string_offsets.size() - 1;
+    h.n_commands = commands.size();
+    h.n_dependencies = deps.size();
+    h.records_size = w.records.size();
+    h.strings_size = w.pool.size();
+    h.working_directory = cwd;
+
+    fs::create_directories(fn.parent_path());
+    // plan is mapped by readers, never write it in place,
+    // other processes may write the same plan
+    auto tmp = fn.parent_path() / unique_path();
+    try
+    {
+        std::ofstream ofs(tmp, std::ios_base::out | std::ios_base::binary);
+        if (!ofs)
+            throw SW_RUNTIME_ERROR("Cannot write file: " + normalize_path(tmp));
+        auto write = [&ofs](const void *p, size_t sz)
+        {
+            ofs.write((const char *)p, sz);
+        };
+        write(&h, sizeof(h));
+        write(w.string_offsets.data(), w.string_offsets.size() * sizeof(uint64_t));
+        write(record_offsets.data(), record_offsets.size() * sizeof(uint64_t));
+        write(dependency_offsets.data(), dependency_offsets.size() * sizeof(uint64_t));
+        write(deps.data(), deps.size() * sizeof(uint32_t));
+        write(w.records.data(), w.records.size());
+        write(w.pool.data(), w.pool.size());
+        if (!ofs)
+            throw SW_RUNTIME_ERROR("Cannot write file: " + normalize_path(tmp));
+        ofs.close();
+        fs::rename(tmp, fn);
+    }
+    catch (...)
+    {
+        error_code ec;
+        fs::remove(tmp, ec);
+        throw;
+    }
+}
+
+}
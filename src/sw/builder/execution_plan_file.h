@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include "command.h"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#define EXECUTION_PLAN_FORMAT_VERSION 1
+
+namespace sw
+{
+
+/// Memory mapped saved execution plan.
+///
+/// Layout: header, string offsets, record offsets, dependency offsets,
+/// dependencies (indices of commands), command records, string pool.
+/// Paths, arguments and other strings are kept once in the pool, records refer to them
+/// by index, index 0 is an empty string. Records are varint encoded.
+/// Offset tables have fixed size entries, so commands are decoded only when requested.
+struct SW_BUILDER_API ExecutionPlanFile
+{
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t n_strings;
+        uint64_t n_commands;
+        uint64_t n_dependencies;
+        uint64_t records_size;
+        uint64_t strings_size;
+        uint64_t working_directory; // string index
+    };
+
+    /// throws on bad file
+    ExecutionPlanFile(const path &fn);
+    ExecutionPlanFile(const ExecutionPlanFile &) = delete;
+    ExecutionPlanFile &operator=(const ExecutionPlanFile &) = delete;
+
+    const path &getFilename() const { return fn; }
+    size_t getNumberOfCommands() const { return header().n_commands; }
+    size_t getNumberOfStrings() const { return header().n_strings; }
+
+    std::string_view getString(size_t index) const;
+    path getWorkingDirectory() const;
+
+    /// creates command from its record, context and command storage are not set,
+    /// other records are not decoded
+    std::shared_ptr<builder::Command> getCommand(size_t index) const;
+    /// indices of commands this one depends on
+    size_t getNumberOfDependencies(size_t index) const;
+    const uint32_t *getDependencies(size_t index) const;
+
+    /// explicit dependencies on commands from the list are saved
+    static void write(const path &fn, const path &working_directory, const std::vector<builder::Command *> &);
+
+private:
+    path fn;
+    boost::interprocess::file_mapping m;
+    boost::interprocess::mapped_region r;
+
+    const Header &header() const { return *(const Header *)r.get_address(); }
+    const uint64_t *stringOffsets() const;
+    const uint64_t *recordOffsets() const;
+    const uint64_t *dependencyOffsets() const;
+    const uint32_t *dependencies() const;
+    const char *records() const;
+    const char *strings() const;
+};
+
+}
@@ -20,11 +20,15 @@
 
 #include "command.h"
 #include "file_storage.h"
+#include "stable_hash.h"
 
 #include <sw/manager/settings.h>
+#include <sw/support/hash.h>
 
 #include <primitives/executor.h>
+#include <primitives/templates.h>
 
+#include <condition_variable>
 #include <fstream>
 #include <sstream>
 
@@ -72,8 +76,9 @@ FileData::FileData(const FileData &rhs)
 FileData &FileData::operator=(const FileData &rhs)
 {
     last_write_time = rhs.last_write_time;
-    //size = rhs.size;
-    //hash = rhs.hash;
+    size = rhs.size;
+    hash = rhs.hash;
+    hash_write_time = rhs.hash_write_time;
     //flags = rhs.flags;
 
     refreshed = rhs.refreshed.load();
@@ -115,6 +120,50 @@ const FileData &File::getFileData() const
     return *data;
 }
 
+namespace
+{
+
+// Threads waiting for refresh() of other threads sleep here.
+// Many file datas share one slot, so woken up threads recheck their files.
+struct RefreshSlot
+{
+    std::mutex m;
+    std::condition_variable cv;
+    std::atomic<int> waiters{ 0 };
+};
+
+RefreshSlot refresh_slots[64];
+
+RefreshSlot &getRefreshSlot(const FileData *d)
+{
+    return refresh_slots[((uintptr_t)d >> 6) % std::size(refresh_slots)];
+}
+
+}
+
+void FileData::setRefreshed(RefreshType r)
+{
+    refreshed = r;
+    // both sides are seq_cst: either waiter sees new state or we see the waiter
+    auto &s = getRefreshSlot(this);
+    if (s.waiters == 0)
+        return;
+    // waiter is not between its check and wait() when we hold the lock
+    std::unique_lock lk(s.m);
+    s.cv.notify_all();
+}
+
+void FileData::waitRefreshed() const
+{
+    auto &s = getRefreshSlot(this);
+    s.waiters++;
+    {
+        std::unique_lock lk(s.m);
+        s.cv.wait(lk, [this] { return refreshed != FileData::RefreshType::InProcess; });
+    }
+    s.waiters--;
+}
+
 void FileData::refresh(const path &file)
 {
     FileData::RefreshType r = FileData::RefreshType::Unrefreshed;
@@ -122,33 +171,89 @@ void FileData::refresh(const path &file)
         return;
 
     bool changed = false;
-    auto s = fs::status(file);
-    if (s.type() != fs::file_type::regular)
+    try
     {
-        if (s.type() != fs::file_type::not_found)
-            LOG_TRACE(logger, "checking for non-regular file: " << file);
-        // we skip non regular files at the moment
-        last_write_time = fs::file_time_type::min();
-        changed = true;
-    }
-    else
-    {
-        auto t = fs::last_write_time(file);
-        if (t > last_write_time)
+        auto s = fs::status(file);
+        if (s.type() != fs::file_type::regular)
         {
-            last_write_time = t;
+            if (s.type() != fs::file_type::not_found)
+                LOG_TRACE(logger, "checking for non-regular file: " << file);
+            // we skip non regular files at the moment
+            last_write_time = fs::file_time_type::min();
             changed = true;
         }
+        else
+        {
+            auto t = fs::last_write_time(file);
+            if (t > last_write_time)
+            {
+                last_write_time = t;
+                changed = true;
+            }
+        }
+    }
+    catch (...)
+    {
+        // do not leave waiters sleeping, next caller will try again
+        setRefreshed(FileData::RefreshType::Unrefreshed);
+        throw;
+    }
+
+    setRefreshed(changed ? FileData::RefreshType::Changed : FileData::RefreshType::NotChanged);
+}
+
+static const size_t content_hash_block_size = 64 * 1024;
+
+uint64_t getFileContentHash(const path &p)
+{
+    ScopedFile f(p, "rb");
+    std::vector<char> buf(content_hash_block_size);
+    uint64_t h = 0;
+    while (auto n = fread(buf.data(), 1, buf.size(), f.getHandle()))
+        h = stable_hash(buf.data(), n, h);
+    if (ferror(f.getHandle()))
+        throw SW_RUNTIME_ERROR("Cannot read file: " + normalize_path(p));
+    return h;
+}
+
+uint64_t getContentHash(std::string_view s)
+{
+    uint64_t h = 0;
+    for (size_t i = 0; i < s.size(); i += content_hash_block_size)
+        h = stable_hash(s.substr(i, content_hash_block_size), h);
+    return h;
+}
+
+bool FileData::isChanged(const path &file)
+{
+    while (1)
+    {
+        auto r = refreshed.load();
+        if (r == FileData::RefreshType::Unrefreshed)
+            refresh(file);
+        else if (r == FileData::RefreshType::InProcess)
+            waitRefreshed();
+        else
+            return r == FileData::RefreshType::Changed;
     }
+}
 
-    refreshed = changed ? FileData::RefreshType::Changed : FileData::RefreshType::NotChanged;
+void refreshFiles(const std::vector<std::pair<FileData *, const path *>> &files)
+{
+    std::vector<const std::pair<FileData *, const path *> *> busy;
+    for (auto &f : files)
+    {
+        f.first->refresh(*f.second);
+        if (f.first->refreshed == FileData::RefreshType::InProcess)
+            busy.push_back(&f);
+    }
+    for (auto f : busy)
+        f->first->isChanged(*f->second);
 }
 
 bool File::isChanged() const
 {
-    while (data->refreshed < FileData::RefreshType::NotChanged)
-        data->refresh(file);
-    return data->refreshed == FileData::RefreshType::Changed;
+    return data->isChanged(file);
 }
 
 std::optional<String> File::isChanged(const fs::file_time_type &in, bool throw_on_missing)
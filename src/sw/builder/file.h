@@ -49,8 +49,14 @@ struct FileData
     };
 
     fs::file_time_type last_write_time = fs::file_time_type::min();
-    //int64_t size = -1;
-    //String hash;
+
+    // content info, computed lazily in content hash mode
+    // valid only while hash_write_time == last_write_time
+    int64_t size = -1;
+    uint64_t hash = 0;
+    fs::file_time_type hash_write_time = fs::file_time_type::min();
+    std::mutex m_hash;
+
     //SomeFlags flags;
     std::weak_ptr<builder::Command> generator;
     bool generated = false;
@@ -69,6 +75,12 @@ struct FileData
 
     void reset();
     void refresh(const path &file);
+    /// refreshes once per run
+    bool isChanged(const path &file);
+    /// sets refresh result and wakes up threads waiting for it
+    void setRefreshed(RefreshType);
+    /// sleeps while other thread refreshes this file
+    void waitRefreshed() const;
 };
 
 struct SW_BUILDER_API File : virtual ICastable
@@ -101,6 +113,20 @@ private:
     mutable FileData *data = nullptr;
 };
 
+/// Fast non cryptographic hash of file contents, stable between runs and platforms.
+/// Chained XXH64 of 64K blocks.
+SW_BUILDER_API
+uint64_t getFileContentHash(const path &);
+
+/// same as getFileContentHash() for data in memory
+SW_BUILDER_API
+uint64_t getContentHash(std::string_view);
+
+/// Refreshes files of one command in one go.
+/// Files refreshed by other threads are waited for only after the rest is done.
+SW_BUILDER_API
+void refreshFiles(const std::vector<std::pair<FileData *, const path *>> &);
+
 #define EXPLAIN_OUTDATED(subject, outdated, reason, name) \
     explainMessage(subject, outdated, reason, name)
 
@@ -27,24 +27,63 @@ DECLARE_STATIC_LOGGER(logger, "file_storage");
 namespace sw
 {
 
+// file data is complete here
+FileStorage::FileStorage() = default;
+FileStorage::~FileStorage() = default;
+
 void FileStorage::clear()
 {
     files.clear();
+    known_states.clear(); // files may be changed since the start
+    std::unique_lock lk(m_recorded);
+    recorded.clear();
 }
 
 void FileStorage::reset()
 {
-    for (const auto &[k, f] : files)
-        f.reset();
+    for (const auto &[k, f] : files.snapshot())
+        f->reset();
 }
 
 FileData &FileStorage::registerFile(const path &in_f)
 {
     auto p = normalize_path(in_f);
     auto d = files.insert(p);
-    if (d.second)
+    if (!d.second)
+        return *d.first;
+
+    auto i = known_states.find(p);
+    auto r = FileData::RefreshType::Unrefreshed;
+    if (i != known_states.end() && d.first->refreshed.compare_exchange_strong(r, FileData::RefreshType::InProcess))
+    {
+        d.first->last_write_time = i->second;
+        d.first->setRefreshed(FileData::RefreshType::NotChanged);
+    }
+    else
         d.first->refresh(in_f);
+
+    if (record_files)
+    {
+        std::unique_lock lk(m_recorded);
+        recorded.emplace_back(std::move(p), d.first);
+    }
     return *d.first;
 }
 
+void FileStorage::setKnownStates(KnownStates s)
+{
+    known_states = std::move(s);
+}
+
+void FileStorage::recordFiles()
+{
+    record_files = true;
+}
+
+std::vector<std::pair<String, FileData *>> FileStorage::getRecordedFiles() const
+{
+    std::unique_lock lk(m_recorded);
+    return recorded;
+}
+
 }
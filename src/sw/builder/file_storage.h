@@ -22,6 +22,8 @@
 
 #include <primitives/filesystem.h>
 
+#include <mutex>
+
 namespace sw
 {
 
@@ -31,13 +33,30 @@ struct SwBuilderContext;
 struct SW_BUILDER_API FileStorage
 {
     using FileDataHashMap = ConcurrentHashMap<path, FileData>;
+    using KnownStates = std::unordered_map<String, fs::file_time_type>;
 
     FileDataHashMap files;
 
+    FileStorage();
+    ~FileStorage();
+
     void clear(); // remove?
     void reset(); // remove?
 
     FileData &registerFile(const path &f);
+
+    /// states of files that are not changed since the previous run,
+    /// such files are not checked on the file system
+    void setKnownStates(KnownStates);
+    /// registered paths are kept, so file states can be saved
+    void recordFiles();
+    std::vector<std::pair<String, FileData *>> getRecordedFiles() const;
+
+private:
+    KnownStates known_states;
+    bool record_files = false;
+    mutable std::mutex m_recorded;
+    std::vector<std::pair<String, FileData *>> recorded;
 };
 
 }
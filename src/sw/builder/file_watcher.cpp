@@ -0,0 +1,658 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "file_watcher.h"
+
+#include "file.h"
+#include "file_storage.h"
+
+#include <sw/manager/settings.h>
+
+#include <primitives/exceptions.h>
+#include <primitives/templates.h>
+
+#include <cstring>
+#include <random>
+#include <unordered_set>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "file_watcher");
+
+#define FILE_STATES_MAGIC 0x53465753 // SWFS
+#define FILE_STATES_VERSION 1
+
+namespace sw
+{
+
+static bool isUnder(std::string_view p, std::string_view root)
+{
+    if (p.size() < root.size() || p.compare(0, root.size(), root) != 0)
+        return false;
+    return p.size() == root.size() || p[root.size()] == '/' || root.back() == '/';
+}
+
+static bool parseToken(const String &token, uint64_t &instance, uint64_t &generation)
+{
+    auto p = token.find('.');
+    if (p == token.npos)
+        return false;
+    try
+    {
+        instance = std::stoull(token.substr(0, p));
+        generation = std::stoull(token.substr(p + 1));
+    }
+    catch (std::exception &)
+    {
+        return false;
+    }
+    return true;
+}
+
+FileWatcher::FileWatcher()
+{
+    std::random_device rd;
+    instance = ((uint64_t)rd() << 32) | rd();
+
+#ifdef __linux__
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1)
+        throw SW_RUNTIME_ERROR("inotify_init1() failed: " + std::to_string(errno));
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd == -1)
+        throw SW_RUNTIME_ERROR("eventfd() failed: " + std::to_string(errno));
+    t = std::thread([this] { run(); });
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+    if (t.joinable())
+    {
+        stopped = true;
+        uint64_t v = 1;
+        [[maybe_unused]] auto r = write(wake_fd, &v, sizeof(v));
+        t.join();
+    }
+    if (fd != -1)
+        close(fd);
+    if (wake_fd != -1)
+        close(wake_fd);
+#endif
+}
+
+bool FileWatcher::isSupported()
+{
+#ifdef __linux__
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef __linux__
+
+static constexpr uint32_t watch_mask =
+    IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+    IN_ONLYDIR | IN_EXCL_UNLINK;
+
+void FileWatcher::run()
+{
+    // events are read here too, so kernel queue does not overflow between queries
+    pollfd fds[2] = {};
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake_fd;
+    fds[1].events = POLLIN;
+    while (!stopped)
+    {
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR(logger, "poll() failed: " << errno);
+            std::unique_lock lk(m);
+            lost_generation = ++generation;
+            return;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            std::unique_lock lk(m);
+            processEvents();
+        }
+    }
+}
+
+void FileWatcher::setChanged(const String &p)
+{
+    changes[p] = ++generation;
+}
+
+void FileWatcher::processEvents()
+{
+    alignas(inotify_event) char buf[64 * 1024];
+    while (1)
+    {
+        auto n = read(fd, buf, sizeof(buf));
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break; // EAGAIN, everything is read
+
+        for (auto p = buf; p < buf + n;)
+        {
+            auto e = (const inotify_event *)p;
+            p += sizeof(inotify_event) + e->len;
+
+            if (e->mask & IN_Q_OVERFLOW)
+            {
+                LOG_DEBUG(logger, "inotify queue overflow, all changes before now are unknown");
+                lost_generation = ++generation;
+                continue;
+            }
+            auto i = dirs.find(e->wd);
+            if (i == dirs.end())
+                continue;
+            if (e->mask & IN_IGNORED)
+            {
+                dirs.erase(i);
+                continue;
+            }
+
+            auto fn = i->second;
+            if (e->len && *e->name)
+                fn += "/"s + e->name;
+            setChanged(fn);
+            if (e->mask & (IN_DELETE | IN_MOVED_FROM))
+                symlinks.erase(fn);
+            if (!(e->mask & (IN_CREATE | IN_MOVED_TO)))
+                continue;
+            // files may be created in a new dir before we watch it, so they are reported too
+            if (e->mask & IN_ISDIR)
+            {
+                if (!watchTree(fn, true))
+                    lost_generation = ++generation;
+            }
+            else
+            {
+                std::error_code ec;
+                if (fs::is_symlink(fn, ec) && fs::is_directory(fn, ec))
+                    symlinks.insert(fn);
+            }
+        }
+    }
+}
+
+bool FileWatcher::watchTree(const String &dir, bool report_files)
+{
+    auto wd = inotify_add_watch(fd, dir.c_str(), watch_mask);
+    if (wd == -1)
+    {
+        // removed already, its removal is reported
+        if (errno == ENOENT || errno == ENOTDIR)
+            return true;
+        // most likely fs.inotify.max_user_watches is reached
+        LOG_WARN(logger, "Cannot watch " << dir << ": " << strerror(errno));
+        return false;
+    }
+    dirs[wd] = dir;
+
+    std::error_code ec;
+    for (fs::directory_iterator i(dir, ec), end; !ec && i != end; i.increment(ec))
+    {
+        auto p = normalize_path(i->path());
+        if (report_files)
+            setChanged(p);
+        std::error_code ec2;
+        if (!i->is_directory(ec2))
+            continue;
+        if (i->is_symlink(ec2))
+            symlinks.insert(p);
+        else if (!watchTree(p, report_files))
+            return false;
+    }
+    return true;
+}
+
+FileWatcher::Changes FileWatcher::getChangesSince(const String &token, const path &root)
+{
+    Changes c;
+    auto r = normalize_path(root);
+
+    std::unique_lock lk(m);
+    // changes made before this call are in kernel queue already
+    processEvents();
+    auto i = roots.find(r);
+    if (i == roots.end())
+    {
+        LOG_DEBUG(logger, "Watching " << r);
+        auto ok = watchTree(r, false);
+        i = roots.emplace(r, ok ? generation : ~0ULL).first;
+    }
+    c.token = std::to_string(instance) + "." + std::to_string(generation);
+
+    uint64_t ti, tg;
+    c.known = parseToken(token, ti, tg) && ti == instance && tg >= i->second && tg >= lost_generation;
+    // old token is used again when the client does not save the new one
+    tokens[r] = c.known ? std::min(tg, generation) : generation;
+    pruneChanges();
+    if (!c.known)
+        return c;
+    for (auto &[p, g] : changes)
+    {
+        if (g > tg && isUnder(p, r))
+            c.files.push_back(p);
+    }
+    // changes behind symlinks are not seen
+    for (auto &p : symlinks)
+    {
+        if (isUnder(p, r))
+            c.files.push_back(p);
+    }
+    return c;
+}
+
+void FileWatcher::pruneChanges()
+{
+    auto oldest = generation;
+    for (auto &[_, g] : tokens)
+        oldest = std::min(oldest, g);
+    if (oldest <= lost_generation)
+        return;
+    for (auto i = changes.begin(); i != changes.end();)
+    {
+        if (i->second <= oldest)
+            i = changes.erase(i);
+        else
+            i++;
+    }
+    // changes for older tokens are unknown now
+    lost_generation = oldest;
+}
+
+static bool writeAll(int fd, const String &s)
+{
+    for (size_t pos = 0; pos < s.size();)
+    {
+        auto n = write(fd, s.data() + pos, s.size() - pos);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        pos += n;
+    }
+    return true;
+}
+
+static sockaddr_un getSocketAddress(const path &socket)
+{
+    sockaddr_un a = {};
+    a.sun_family = AF_UNIX;
+    auto s = socket.string();
+    if (s.size() >= sizeof(a.sun_path))
+        throw SW_RUNTIME_ERROR("Socket path is too long: " + s);
+    strcpy(a.sun_path, s.c_str());
+    return a;
+}
+
+FileWatcherServer::FileWatcherServer(const path &socket)
+    : socket(socket)
+{
+    if (queryFileWatcher(socket, {}, {}))
+        throw SW_RUNTIME_ERROR("File watcher is already running at " + normalize_path(socket));
+
+    fs::create_directories(socket.parent_path());
+    std::error_code ec;
+    fs::remove(socket, ec); // left by killed server
+
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        throw SW_RUNTIME_ERROR("socket() failed: " + std::to_string(errno));
+    auto a = getSocketAddress(socket);
+    if (bind(fd, (sockaddr *)&a, sizeof(a)) == -1 || listen(fd, 64) == -1)
+        throw SW_RUNTIME_ERROR("Cannot listen on " + normalize_path(socket) + ": " + strerror(errno));
+}
+
+FileWatcherServer::~FileWatcherServer()
+{
+    if (fd != -1)
+        close(fd);
+    std::error_code ec;
+    fs::remove(socket, ec);
+}
+
+void FileWatcherServer::run()
+{
+    LOG_INFO(logger, "File watcher is listening on " << normalize_path(socket));
+    while (1)
+    {
+        auto c = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (c == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            throw SW_RUNTIME_ERROR("accept() failed: " + std::to_string(errno));
+        }
+
+        String req;
+        char buf[4096];
+        while (req.find('\n') == req.npos && req.size() < 64 * 1024)
+        {
+            auto n = read(c, buf, sizeof(buf));
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            req.append(buf, n);
+        }
+
+        // changes <token> <root>
+        String resp;
+        auto eol = req.find('\n');
+        auto p1 = req.find(' ');
+        auto p2 = p1 == req.npos ? req.npos : req.find(' ', p1 + 1);
+        if (eol != req.npos && p2 != req.npos && p2 < eol && req.compare(0, p1, "changes") == 0)
+        {
+            auto token = req.substr(p1 + 1, p2 - p1 - 1);
+            if (token == "-")
+                token.clear();
+            auto root = req.substr(p2 + 1, eol - p2 - 1);
+            FileWatcher::Changes ch;
+            if (!root.empty())
+                ch = w.getChangesSince(token, fs::u8path(root));
+            resp = ch.token + "\n" + (ch.known ? "known" : "unknown") + "\n";
+            for (auto &f : ch.files)
+                resp += f + "\n";
+        }
+        writeAll(c, resp);
+        close(c);
+    }
+}
+
+std::optional<FileWatcher::Changes> queryFileWatcher(const path &socket, const String &token, const path &root)
+{
+    auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return {};
+    SCOPE_EXIT
+    {
+        close(fd);
+    };
+    // do not hang the build if server is stuck
+    timeval tv = {};
+    tv.tv_sec = 10;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    sockaddr_un a;
+    try
+    {
+        a = getSocketAddress(socket);
+    }
+    catch (std::exception &)
+    {
+        return {};
+    }
+    if (connect(fd, (sockaddr *)&a, sizeof(a)) == -1)
+        return {};
+    if (!writeAll(fd, "changes " + (token.empty() ? "-"s : token) + " " + normalize_path(root) + "\n"))
+        return {};
+
+    String resp;
+    char buf[64 * 1024];
+    while (1)
+    {
+        auto n = read(fd, buf, sizeof(buf));
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            return {};
+        if (n == 0)
+            break;
+        resp.append(buf, n);
+    }
+
+    FileWatcher::Changes c;
+    Strings lines;
+    for (size_t pos = 0; pos < resp.size();)
+    {
+        auto eol = resp.find('\n', pos);
+        if (eol == resp.npos)
+            eol = resp.size();
+        lines.push_back(resp.substr(pos, eol - pos));
+        pos = eol + 1;
+    }
+    if (lines.size() < 2)
+        return c; // bad request
+    c.token = lines[0];
+    c.known = lines[1] == "known";
+    c.files.assign(lines.begin() + 2, lines.end());
+    return c;
+}
+
+path FileWatcherServer::getDefaultSocket()
+{
+    return Settings::get_user_settings().storage_dir / "tmp" / "file_watcher.sock";
+}
+
+#else
+
+FileWatcher::Changes FileWatcher::getChangesSince(const String &, const path &)
+{
+    return {};
+}
+
+FileWatcherServer::FileWatcherServer(const path &socket)
+    : socket(socket)
+{
+    throw SW_RUNTIME_ERROR("File watcher is not supported on this platform");
+}
+
+FileWatcherServer::~FileWatcherServer()
+{
+}
+
+void FileWatcherServer::run()
+{
+}
+
+std::optional<FileWatcher::Changes> queryFileWatcher(const path &, const String &, const path &)
+{
+    return {};
+}
+
+path FileWatcherServer::getDefaultSocket()
+{
+    return Settings::get_user_settings().storage_dir / "tmp" / "file_watcher.sock";
+}
+
+#endif
+
+FileStateCache::FileStateCache(const path &fn, const path &socket, const FilesOrdered &in_roots)
+    : fn(fn), socket(socket)
+{
+    for (auto &r : in_roots)
+        roots.push_back(normalize_path(fs::absolute(r)));
+}
+
+namespace
+{
+
+struct FileStatesReader
+{
+    const String &s;
+    size_t pos = 0;
+
+    template <class T>
+    T read()
+    {
+        T v;
+        if (pos + sizeof(v) > s.size())
+            throw SW_RUNTIME_ERROR("Truncated file states");
+        memcpy(&v, s.data() + pos, sizeof(v));
+        pos += sizeof(v);
+        return v;
+    }
+
+    std::string_view readString()
+    {
+        auto n = read<uint32_t>();
+        if (pos + n > s.size())
+            throw SW_RUNTIME_ERROR("Truncated file states");
+        std::string_view v(s.data() + pos, n);
+        pos += n;
+        return v;
+    }
+};
+
+template <class T>
+static void writeValue(String &s, const T &v)
+{
+    s.append((const char *)&v, sizeof(v));
+}
+
+static void writeString(String &s, std::string_view v)
+{
+    writeValue(s, (uint32_t)v.size());
+    s.append(v.data(), v.size());
+}
+
+}
+
+void FileStateCache::load(FileStorage &storage)
+{
+    tokens.clear();
+
+    // previous run
+    String data;
+    std::map<String, String> old_tokens;
+    std::vector<std::pair<std::string_view, int64_t>> entries;
+    if (fs::exists(fn))
+    {
+        try
+        {
+            data = read_file(fn);
+            FileStatesReader r{ data };
+            if (r.read<uint32_t>() != FILE_STATES_MAGIC || r.read<uint32_t>() != FILE_STATES_VERSION)
+                throw SW_RUNTIME_ERROR("Bad file states version");
+            auto n_roots = r.read<uint32_t>();
+            for (uint32_t i = 0; i < n_roots; i++)
+            {
+                String root(r.readString());
+                old_tokens[root] = r.readString();
+            }
+            auto n = r.read<uint64_t>();
+            entries.reserve(n);
+            for (uint64_t i = 0; i < n; i++)
+            {
+                auto p = r.readString();
+                entries.emplace_back(p, r.read<int64_t>());
+            }
+        }
+        catch (std::exception &e)
+        {
+            LOG_DEBUG(logger, "Cannot load file states: " << e.what());
+            old_tokens.clear();
+            entries.clear();
+        }
+    }
+
+    Strings new_tokens;
+    std::vector<String> known_roots;
+    // hashes of changed paths, collisions only make files checked
+    std::unordered_set<size_t> changed;
+    for (auto &r : roots)
+    {
+        auto c = queryFileWatcher(socket, old_tokens[r], r);
+        if (!c || c->token.empty())
+        {
+            LOG_DEBUG(logger, "File watcher is not running, run 'sw server --file-watcher'");
+            return;
+        }
+        new_tokens.push_back(c->token);
+        if (!c->known)
+            continue;
+        known_roots.push_back(r);
+        for (auto &f : c->files)
+            changed.insert(std::hash<std::string_view>()(f));
+    }
+    tokens = std::move(new_tokens);
+    storage.recordFiles();
+
+    auto is_changed = [&changed](std::string_view p)
+    {
+        // file or one of its parent dirs
+        while (!p.empty())
+        {
+            if (changed.count(std::hash<std::string_view>()(p)))
+                return true;
+            auto pos = p.rfind('/');
+            if (pos == p.npos || pos == 0)
+                break;
+            p = p.substr(0, pos);
+        }
+        return false;
+    };
+
+    FileStorage::KnownStates known;
+    for (auto &[p, t] : entries)
+    {
+        if (std::none_of(known_roots.begin(), known_roots.end(), [p = p](auto &r) { return isUnder(p, r); }))
+            continue;
+        if (is_changed(p))
+            continue;
+        known.emplace(String(p), fs::file_time_type(fs::file_time_type::duration(t)));
+    }
+    LOG_DEBUG(logger, "Reusing " << known.size() << " of " << entries.size() << " file states, "
+        << changed.size() << " paths were changed");
+    storage.setKnownStates(std::move(known));
+}
+
+void FileStateCache::save(const FileStorage &storage) const
+{
+    if (tokens.empty())
+        return;
+
+    String s;
+    writeValue(s, (uint32_t)FILE_STATES_MAGIC);
+    writeValue(s, (uint32_t)FILE_STATES_VERSION);
+    writeValue(s, (uint32_t)roots.size());
+    for (size_t i = 0; i < roots.size(); i++)
+    {
+        writeString(s, roots[i]);
+        writeString(s, tokens[i]);
+    }
+
+    auto files = storage.getRecordedFiles();
+    auto n_pos = s.size();
+    uint64_t n = 0;
+    writeValue(s, n);
+    for (auto &[p, d] : files)
+    {
+        auto r = d->refreshed.load();
+        if (r != FileData::RefreshType::NotChanged && r != FileData::RefreshType::Changed)
+            continue;
+        if (std::none_of(roots.begin(), roots.end(), [p = std::string_view(p)](auto &r) { return isUnder(p, r); }))
+            continue;
+        writeString(s, p);
+        writeValue(s, (int64_t)d->last_write_time.time_since_epoch().count());
+        n++;
+    }
+    memcpy(s.data() + n_pos, &n, sizeof(n));
+
+    // other processes may read it
+    auto tmp = fn.parent_path() / unique_path();
+    write_file(tmp, s);
+    fs::rename(tmp, fn);
+}
+
+}
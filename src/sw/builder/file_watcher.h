@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
+namespace sw
+{
+
+struct FileStorage;
+
+/// Watches directory trees with inotify and tells what was changed since a token.
+///
+/// Token is "instance.generation", every file system event increases generation.
+/// Changes are unknown for tokens of other instances, for tokens taken before
+/// the root was watched, after event queue overflows or failed watches and for tokens
+/// older than the last tokens of all roots (their changes are dropped).
+/// Directories behind symlinks are not watched, symlinks to them are always reported as changed.
+/// Only Linux is supported.
+struct SW_BUILDER_API FileWatcher
+{
+    struct Changes
+    {
+        String token; // current token, pass it to the next query
+        bool known = false; // false - everything may be changed
+        Strings files; // normalized paths, a directory means everything under it
+    };
+
+    FileWatcher();
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+    ~FileWatcher();
+
+    static bool isSupported();
+
+    /// starts watching root recursively if it is not watched yet
+    Changes getChangesSince(const String &token, const path &root);
+
+private:
+    int fd = -1;
+    int wake_fd = -1;
+    uint64_t instance;
+    std::mutex m;
+    std::thread t;
+    std::atomic_bool stopped{ false };
+
+    uint64_t generation = 0;
+    uint64_t lost_generation = 0; // events before it are lost
+    std::unordered_map<int, String> dirs; // watch descriptors
+    std::map<String, uint64_t> roots; // generation of the first watch
+    std::unordered_map<String, uint64_t> changes; // generation of the last change
+    std::map<String, uint64_t> tokens; // generation of the oldest token of root in use
+    std::set<String> symlinks; // to directories
+
+    void run();
+    void processEvents();
+    bool watchTree(const String &dir, bool report_files);
+    void setChanged(const String &);
+    void pruneChanges();
+};
+
+/// Serves FileWatcher over a unix socket, one query per connection.
+///
+/// Request: "changes <token or -> <root>\n".
+/// Response: token line, "known" or "unknown" line, then changed paths one per line.
+struct SW_BUILDER_API FileWatcherServer
+{
+    FileWatcherServer(const path &socket);
+    ~FileWatcherServer();
+
+    /// serves until process is stopped
+    void run();
+
+    static path getDefaultSocket();
+
+private:
+    path socket;
+    int fd = -1;
+    FileWatcher w;
+};
+
+/// Queries file watcher server, returns nullopt if it is not running.
+SW_BUILDER_API
+std::optional<FileWatcher::Changes> queryFileWatcher(const path &socket, const String &token, const path &root);
+
+/// Keeps file states between runs while file watcher says that files are not changed.
+///
+/// States of files under roots are saved after build together with the tokens
+/// taken before anything was checked. On the next run files that are not changed
+/// since then are not checked on the file system.
+struct SW_BUILDER_API FileStateCache
+{
+    FileStateCache(const path &fn, const path &socket, const FilesOrdered &roots);
+
+    /// asks watcher for changes and sets known states of file storage
+    void load(FileStorage &);
+    void save(const FileStorage &) const;
+
+private:
+    path fn;
+    path socket;
+    Strings roots;
+    Strings tokens; // new tokens of roots, empty when watcher is not running
+};
+
+}
@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "log_writer.h"
+
+#include <primitives/exceptions.h>
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "log_writer");
+
+namespace sw
+{
+
+static void sync_file(FILE *f)
+{
+#if defined(_WIN32)
+    _commit(_fileno(f));
+#elif defined(__APPLE__)
+    fsync(fileno(f));
+#else
+    fdatasync(fileno(f));
+#endif
+}
+
+void LogWriter::Context::append(int file, const void *data, size_t size)
+{
+    auto &b = w.files[file].buffer;
+    auto sz = b.size();
+    b.resize(sz + size);
+    memcpy(b.data() + sz, data, size);
+    // large batch
+    if (b.size() >= w.options.max_buffer_size)
+        w.write(false);
+}
+
+void LogWriter::Context::closeFiles()
+{
+    w.write(true);
+    w.close();
+}
+
+void LogWriter::Context::setFilename(int file, const path &fn)
+{
+    w.write(true);
+    w.files[file].f.reset();
+    w.files[file].fn = fn;
+}
+
+LogWriter::LogWriter()
+    : LogWriter(Options{})
+{
+}
+
+LogWriter::LogWriter(const Options &options)
+    : options(options)
+{
+    last_sync = Clock::now();
+    t = std::thread([this] { run(); });
+}
+
+LogWriter::~LogWriter()
+{
+    {
+        std::unique_lock lk(m);
+        stopped = true;
+    }
+    cv.notify_one();
+    t.join();
+}
+
+int LogWriter::addFile(const path &fn)
+{
+    // files are not touched by writer until tasks are pushed
+    std::unique_lock lk(m);
+    if (pushed)
+        throw SW_RUNTIME_ERROR("Files must be added before writing");
+    auto &f = files.emplace_back();
+    f.fn = fn;
+    return (int)files.size() - 1;
+}
+
+void LogWriter::push(Task task)
+{
+    bool wake;
+    {
+        std::unique_lock lk(m);
+        if (stopped)
+            throw SW_RUNTIME_ERROR("Log writer is stopped");
+        queue.push_back(std::move(task));
+        pushed++;
+        wake = queue.size() >= options.max_pending_tasks;
+    }
+    if (wake)
+        cv.notify_one();
+}
+
+void LogWriter::append(int file, const void *data, size_t size)
+{
+    push([file, s = String((const char *)data, size)](Context &ctx)
+    {
+        ctx.append(file, s.data(), s.size());
+    });
+}
+
+void LogWriter::flush()
+{
+    std::unique_lock lk(m);
+    auto n = pushed;
+    flush_requested = true;
+    cv.notify_one();
+    cv_written.wait(lk, [this, n] { return written >= n; });
+}
+
+void LogWriter::run()
+{
+    Context ctx(*this);
+    std::vector<Task> tasks;
+    while (1)
+    {
+        uint64_t n;
+        bool stop, sync;
+        {
+            std::unique_lock lk(m);
+            cv.wait_for(lk, options.flush_interval, [this]
+            {
+                return stopped || flush_requested || queue.size() >= options.max_pending_tasks;
+            });
+            tasks.swap(queue);
+            n = pushed;
+            stop = stopped && queue.empty();
+            sync = flush_requested;
+            flush_requested = false;
+        }
+
+        for (auto &task : tasks)
+        {
+            try
+            {
+                task(ctx);
+            }
+            catch (std::exception &e)
+            {
+                LOG_ERROR(logger, "Error during log writing: " << e.what());
+            }
+        }
+        tasks.clear();
+        write(stop || sync);
+
+        {
+            std::unique_lock lk(m);
+            written = n;
+        }
+        cv_written.notify_all();
+
+        if (stop)
+            break;
+    }
+    close();
+}
+
+void LogWriter::write(bool sync)
+{
+    for (auto &f : files)
+    {
+        if (f.buffer.empty())
+            continue;
+        if (!f.f)
+        {
+            try
+            {
+                fs::create_directories(f.fn.parent_path());
+                f.f = std::make_unique<ScopedFile>(f.fn, "ab");
+            }
+            catch (std::exception &e)
+            {
+                LOG_ERROR(logger, "Cannot open log: " << e.what());
+                f.buffer.clear();
+                continue;
+            }
+            // Opening a file in append mode doesn't set the file pointer to the file's
+            // end on Windows. Do that explicitly.
+            fseek(f.f->getHandle(), 0, SEEK_END);
+        }
+        if (fwrite(f.buffer.data(), f.buffer.size(), 1, f.f->getHandle()) != 1 || fflush(f.f->getHandle()) != 0)
+            LOG_ERROR(logger, "Cannot write log: " << normalize_path(f.fn));
+        f.buffer.clear();
+        f.needs_sync = true;
+        n_writes++;
+    }
+
+    if (options.sync_interval.count() == 0)
+        return;
+    auto now = Clock::now();
+    if (!sync && now - last_sync < options.sync_interval)
+        return;
+    for (auto &f : files)
+    {
+        if (f.f && f.needs_sync)
+            sync_file(f.f->getHandle());
+        f.needs_sync = false;
+    }
+    last_sync = now;
+}
+
+void LogWriter::close()
+{
+    for (auto &f : files)
+        f.f.reset();
+}
+
+}
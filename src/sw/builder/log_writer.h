@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace sw
+{
+
+/// Appends records to log files from a dedicated thread.
+///
+/// Tasks from many producers are queued and run on the writer thread in order.
+/// Their output is buffered and written with one write per file
+/// every flush interval or when enough tasks are pending (group commit).
+/// Files stay open until closed explicitly or until the writer is destroyed.
+struct SW_BUILDER_API LogWriter
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        std::chrono::milliseconds flush_interval{ 50 };
+        /// writer is woken up earlier when this number of tasks is pending
+        size_t max_pending_tasks = 4096;
+        /// large batches are written in parts
+        size_t max_buffer_size = 1 << 20;
+        /// fdatasync files at most this often, so at most this much is lost on power failure,
+        /// 0 leaves it to OS
+        std::chrono::milliseconds sync_interval{ 0 };
+    };
+
+    /// writer thread side, passed to tasks
+    struct Context
+    {
+        void append(int file, const void *data, size_t size);
+        template <class T>
+        void append(int file, const T &v) { append(file, &v, sizeof(v)); }
+
+        /// writes pending data and closes files, they are reopened on the next write
+        void closeFiles();
+        /// file is opened under the new name on the next write
+        void setFilename(int file, const path &);
+
+    private:
+        LogWriter &w;
+
+        Context(LogWriter &w) : w(w) {}
+        friend struct LogWriter;
+    };
+
+    using Task = std::function<void(Context &)>;
+
+    LogWriter();
+    LogWriter(const Options &);
+    LogWriter(const LogWriter &) = delete;
+    LogWriter &operator=(const LogWriter &) = delete;
+    /// runs all queued tasks and writes everything
+    ~LogWriter();
+
+    /// returns file id for Context::append(), files must be added before the first push
+    int addFile(const path &);
+
+    void push(Task);
+    /// copies data, shortcut for simple records
+    void append(int file, const void *data, size_t size);
+
+    /// waits until everything pushed before is written (and synced in sync mode)
+    void flush();
+
+    /// number of write calls, for statistics
+    size_t getNumberOfWrites() const { return n_writes; }
+
+private:
+    struct File
+    {
+        path fn;
+        std::unique_ptr<ScopedFile> f;
+        std::vector<uint8_t> buffer;
+        bool needs_sync = false;
+    };
+
+    Options options;
+    std::vector<File> files;
+    std::thread t;
+    std::mutex m;
+    std::condition_variable cv; // producers -> writer
+    std::condition_variable cv_written; // writer -> flush()
+    std::vector<Task> queue;
+    uint64_t pushed = 0;
+    uint64_t written = 0;
+    bool flush_requested = false;
+    bool stopped = false;
+    Clock::time_point last_sync;
+    std::atomic<size_t> n_writes{ 0 };
+
+    void run();
+    void write(bool sync);
+    void close();
+};
+
+}
@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "path_table.h"
+
+#include <primitives/exceptions.h>
+
+#include <mutex>
+
+namespace sw
+{
+
+static size_t getSegment(size_t pos)
+{
+    size_t s = 0;
+    while (pos >>= 1)
+        s++;
+    return s;
+}
+
+PathTable::~PathTable()
+{
+    for (auto &s : segments)
+        delete[] s.load();
+}
+
+PathTable::Entry &PathTable::getEntry(Id id) const
+{
+    auto s = getSegment(id / first_segment_size + 1);
+    auto offset = id - ((size_t(1) << s) - 1) * first_segment_size;
+    auto p = s < max_segments ? segments[s].load(std::memory_order_acquire) : nullptr;
+    if (!p || id >= next_id)
+        throw SW_RUNTIME_ERROR("Bad path id: " + std::to_string(id));
+    return p[offset];
+}
+
+PathTable::Entry &PathTable::allocateEntry(Id id)
+{
+    auto s = getSegment(id / first_segment_size + 1);
+    if (s >= max_segments)
+        throw SW_RUNTIME_ERROR("Too many paths");
+    if (!segments[s].load(std::memory_order_acquire))
+    {
+        // ids from different shards may race for the same segment
+        auto p = new Entry[first_segment_size << s];
+        Entry *expected = nullptr;
+        if (!segments[s].compare_exchange_strong(expected, p, std::memory_order_acq_rel))
+            delete[] p;
+    }
+    return getEntry(id);
+}
+
+PathTable::Id PathTable::intern(size_t hash, std::string_view normalized_path)
+{
+    auto &sh = shards[hash % n_shards];
+    {
+        std::shared_lock lk(sh.m);
+        auto i = sh.ids.find(hash);
+        if (i != sh.ids.end())
+            return i->second;
+    }
+
+    std::unique_lock lk(sh.m);
+    auto i = sh.ids.find(hash);
+    if (i != sh.ids.end())
+        return i->second;
+    // entry is complete before id is visible to others through the shard
+    auto id = next_id++;
+    auto &e = allocateEntry(id);
+    e.p = fs::u8path(normalized_path.begin(), normalized_path.end());
+    e.hash = hash;
+    sh.ids.emplace(hash, id);
+    return id;
+}
+
+PathTable::Id PathTable::find(size_t hash) const
+{
+    auto &sh = shards[hash % n_shards];
+    std::shared_lock lk(sh.m);
+    auto i = sh.ids.find(hash);
+    if (i == sh.ids.end())
+        return npos;
+    return i->second;
+}
+
+const path &PathTable::get(Id id) const
+{
+    return getEntry(id).p;
+}
+
+size_t PathTable::getHash(Id id) const
+{
+    return getEntry(id).hash;
+}
+
+FileData *PathTable::getFileData(Id id) const
+{
+    return getEntry(id).data.load(std::memory_order_acquire);
+}
+
+void PathTable::setFileData(Id id, FileData *d)
+{
+    getEntry(id).data.store(d, std::memory_order_release);
+}
+
+void PathTable::clearFileData()
+{
+    for (Id i = 0; i < size(); i++)
+        setFileData(i, nullptr);
+}
+
+}
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+#include <atomic>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace sw
+{
+
+struct FileData;
+
+/// Interns paths and gives them stable small ids.
+///
+/// Lookup by path hash goes to one of many shards, each with its own lock,
+/// so concurrent lookups of different paths almost never wait for each other.
+/// Lookup by id takes no locks: paths are never moved or removed,
+/// returned references stay valid until the table is destroyed.
+struct SW_BUILDER_API PathTable
+{
+    using Id = uint32_t;
+    static constexpr Id npos = ~0;
+
+    PathTable() = default;
+    PathTable(const PathTable &) = delete;
+    PathTable &operator=(const PathTable &) = delete;
+    ~PathTable();
+
+    /// hash is Storage::getPathHash() of normalized path string, path is created only when it is new
+    Id intern(size_t hash, std::string_view normalized_path);
+    /// returns npos when path is unknown
+    Id find(size_t hash) const;
+
+    const path &get(Id) const;
+    size_t getHash(Id) const;
+
+    /// cached file data of the path, nullptr when it is not registered yet
+    FileData *getFileData(Id) const;
+    void setFileData(Id, FileData *);
+    /// when file storage is recreated
+    void clearFileData();
+
+    /// ids are [0, size), iterate only when nobody adds paths
+    size_t size() const { return next_id; }
+
+private:
+    static constexpr size_t n_shards = 64;
+    // segment k holds (first_segment_size << k) entries
+    static constexpr size_t first_segment_size = 1024;
+    static constexpr size_t max_segments = 24;
+
+    struct Entry
+    {
+        path p;
+        size_t hash = 0;
+        std::atomic<FileData *> data{ nullptr };
+    };
+
+    struct alignas(64) Shard
+    {
+        mutable std::shared_mutex m;
+        std::unordered_map<size_t, Id> ids;
+    };
+
+    Shard shards[n_shards];
+    std::atomic<Entry *> segments[max_segments] = {};
+    std::atomic<Id> next_id{ 0 };
+
+    Entry &getEntry(Id) const;
+    Entry &allocateEntry(Id);
+};
+
+}
@@ -0,0 +1,432 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "process_launcher.h"
+
+#include "command.h"
+
+#include <primitives/exceptions.h>
+#include <primitives/templates.h>
+
+#include <condition_variable>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "process_launcher");
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+namespace sw
+{
+
+// one output pipe of a running process
+struct ProcessLauncher::Stream
+{
+    Job *job = nullptr;
+    int fd = -1;
+    String *text = nullptr;
+};
+
+struct ProcessLauncher::Job
+{
+    Stream streams[2];
+    int open = 0; // pipes not closed by epoll thread
+    int error = 0; // epoll thread failed
+    std::mutex m;
+    std::condition_variable cv;
+};
+
+ProcessLauncher::ProcessLauncher()
+{
+}
+
+ProcessLauncher::~ProcessLauncher()
+{
+#ifdef __linux__
+    if (t.joinable())
+    {
+        stopped = true;
+        uint64_t v = 1;
+        [[maybe_unused]] auto r = write(wake_fd, &v, sizeof(v));
+        t.join();
+    }
+    if (epoll_fd != -1)
+        close(epoll_fd);
+    if (wake_fd != -1)
+        close(wake_fd);
+#endif
+}
+
+bool ProcessLauncher::isSupported()
+{
+#ifdef __linux__
+    return true;
+#else
+    return false;
+#endif
+}
+
+path ProcessLauncher::resolveProgram(const path &p)
+{
+    {
+        std::unique_lock lk(m_programs);
+        auto i = programs.find(p);
+        if (i != programs.end())
+            return i->second;
+    }
+    // resolve outside of the lock, it may run which/where
+    auto r = resolveExecutable(p);
+    std::unique_lock lk(m_programs);
+    return programs.emplace(p, r).first->second;
+}
+
+#ifdef __linux__
+
+char *const *ProcessLauncher::getEnvironment(const std::map<String, String> &env)
+{
+    if (env.empty())
+        return environ;
+
+    std::unique_lock lk(m_environments);
+    auto i = environments.find(env);
+    if (i != environments.end())
+        return i->second.envp;
+
+    // command variables are added to or replace variables of this process
+    auto &e = environments[env];
+    for (auto p = environ; *p; p++)
+    {
+        std::string_view v(*p);
+        auto k = v.substr(0, v.find('='));
+        if (env.find(String(k)) == env.end())
+            e.b.push_back(v);
+    }
+    for (auto &[k, v] : env)
+        e.b.push_back(k + "=" + v);
+    e.envp = e.b.data();
+    return e.envp;
+}
+
+bool ProcessLauncher::start()
+{
+    std::call_once(started, [this]
+    {
+        try
+        {
+            epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            if (epoll_fd == -1)
+                throw SW_RUNTIME_ERROR("epoll_create1() failed: " + std::to_string(errno));
+            wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            if (wake_fd == -1)
+                throw SW_RUNTIME_ERROR("eventfd() failed: " + std::to_string(errno));
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.ptr = nullptr;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) == -1)
+                throw SW_RUNTIME_ERROR("epoll_ctl() failed: " + std::to_string(errno));
+            t = std::thread([this] { run(); });
+        }
+        catch (std::exception &e)
+        {
+            LOG_WARN(logger, "Process launcher is disabled: " << e.what());
+            std::unique_lock lk(m_jobs);
+            failed = true;
+        }
+    });
+    std::unique_lock lk(m_jobs);
+    return !failed;
+}
+
+// jobs are failed and new ones go to primitives, because nobody reads their pipes anymore
+void ProcessLauncher::fail(int error)
+{
+    std::unique_lock lk(m_jobs);
+    failed = true;
+    for (auto j : jobs)
+    {
+        std::unique_lock lk2(j->m);
+        j->error = error;
+        j->cv.notify_all();
+    }
+}
+
+void ProcessLauncher::run()
+{
+    // exception must not escape the thread
+    try
+    {
+        run1();
+    }
+    catch (std::system_error &e)
+    {
+        LOG_ERROR(logger, "Process launcher failed: " << e.what());
+        fail(e.code().value());
+    }
+    catch (std::exception &e)
+    {
+        LOG_ERROR(logger, "Process launcher failed: " << e.what());
+        fail(EIO);
+    }
+}
+
+void ProcessLauncher::run1()
+{
+    epoll_event events[64];
+    char buf[64 * 1024];
+    while (!stopped)
+    {
+        auto n = epoll_wait(epoll_fd, events, std::size(events), -1);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "epoll_wait() failed");
+        }
+        for (int i = 0; i < n; i++)
+        {
+            auto s = (Stream *)events[i].data.ptr;
+            if (!s)
+                continue; // wake up
+
+            bool closed = false;
+            while (1)
+            {
+                auto r = read(s->fd, buf, sizeof(buf));
+                if (r > 0)
+                {
+                    s->text->append(buf, r);
+                    continue;
+                }
+                if (r == -1 && errno == EINTR)
+                    continue;
+                // on EAGAIN we wait for more data
+                closed = r == 0 || errno != EAGAIN;
+                break;
+            }
+            if (!closed)
+                continue;
+
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->fd, nullptr);
+            close(s->fd);
+            // job lives on the stack of execute(), do not touch it after notification
+            auto &job = *s->job;
+            std::unique_lock lk(job.m);
+            s->fd = -1;
+            if (--job.open == 0)
+                job.cv.notify_all();
+        }
+    }
+}
+
+bool ProcessLauncher::execute(primitives::Command &c, ArgvBuilder &argv, std::error_code &ec, uint64_t *peak_rss)
+{
+    if (c.detached || c.getFirstCommand() || !c.in.text.empty() || argv.empty())
+        return false;
+
+#if !(defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29)))
+    // no posix_spawn_file_actions_addchdir_np()
+    if (!c.working_directory.empty())
+        return false;
+#endif
+
+    if (!start())
+        return false;
+
+    Job job;
+    {
+        std::unique_lock lk(m_jobs);
+        if (failed)
+            return false;
+        jobs.insert(&job);
+    }
+    SCOPE_EXIT
+    {
+        std::unique_lock lk(m_jobs);
+        jobs.erase(&job);
+    };
+
+    // paths are relative to our working directory, not to the one of the process
+    auto program = fs::absolute(c.getProgram());
+    auto abs = [](const path &p) { return fs::absolute(p).string(); };
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    SCOPE_EXIT
+    {
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+    };
+
+    // child must not inherit our blocked signals
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    if (!c.in.file.empty())
+        posix_spawn_file_actions_addopen(&actions, 0, abs(c.in.file).c_str(), O_RDONLY, 0);
+    else if (!c.in.inherit)
+        posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+
+    int pipes[2][2] = { { -1, -1 }, { -1, -1 } };
+    auto close_pipes = [&pipes]()
+    {
+        for (auto &p : pipes)
+        {
+            for (auto &fd : p)
+            {
+                if (fd != -1)
+                    close(fd);
+                fd = -1;
+            }
+        }
+    };
+    primitives::Command::Stream *streams[] = { &c.out, &c.err };
+    for (int i = 0; i < 2; i++)
+    {
+        auto &s = *streams[i];
+        if (!s.file.empty())
+        {
+            posix_spawn_file_actions_addopen(&actions, i + 1, abs(s.file).c_str(),
+                O_WRONLY | O_CREAT | (s.append ? O_APPEND : O_TRUNC), 0644);
+            continue;
+        }
+        if (s.inherit)
+            continue;
+        // close on exec, so processes started by other threads do not hold our pipes
+        if (pipe2(pipes[i], O_CLOEXEC) == -1)
+        {
+            ec.assign(errno, std::generic_category());
+            close_pipes();
+            return true;
+        }
+        posix_spawn_file_actions_adddup2(&actions, pipes[i][1], i + 1);
+        fcntl(pipes[i][0], F_SETFL, O_NONBLOCK);
+        s.text.clear();
+        job.streams[job.open++] = { &job, pipes[i][0], &s.text };
+    }
+
+    // after opens, they are relative to our directory
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+    if (!c.working_directory.empty())
+        posix_spawn_file_actions_addchdir_np(&actions, abs(c.working_directory).c_str());
+#endif
+
+    c.onBeforeRun();
+
+    pid_t pid;
+    if (auto r = posix_spawn(&pid, program.c_str(), &actions, &attr, argv.data(), getEnvironment(c.environment)); r != 0)
+    {
+        ec.assign(r, std::generic_category());
+        close_pipes();
+        c.onEnd();
+        return true;
+    }
+    c.pid = pid;
+
+    // write ends belong to the process now
+    for (auto &p : pipes)
+    {
+        if (p[1] != -1)
+            close(p[1]);
+        p[1] = -1;
+    }
+    if (job.open)
+    {
+        for (int i = 0, n = job.open; i < n; i++)
+        {
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.ptr = &job.streams[i];
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, job.streams[i].fd, &ev) == -1)
+            {
+                // output is lost, but we must not leave the process writing into a full pipe
+                std::unique_lock lk(job.m);
+                close(job.streams[i].fd);
+                job.streams[i].fd = -1;
+                job.open--;
+            }
+        }
+        std::unique_lock lk(job.m);
+        job.cv.wait(lk, [&job] { return job.open == 0 || job.error; });
+        // epoll thread is stopped, process gets EPIPE on writes
+        for (auto &s : job.streams)
+        {
+            if (s.fd != -1)
+                close(s.fd);
+            s.fd = -1;
+        }
+    }
+
+    int status = 0;
+    rusage ru{};
+    while (wait4(pid, &status, 0, &ru) == -1)
+    {
+        if (errno != EINTR)
+        {
+            ec.assign(errno, std::generic_category());
+            c.onEnd();
+            return true;
+        }
+    }
+    c.onEnd();
+
+    if (peak_rss)
+        *peak_rss = (uint64_t)ru.ru_maxrss * 1024; // kilobytes on linux
+    if (WIFEXITED(status))
+        c.exit_code = WEXITSTATUS(status);
+    else if (WIFSIGNALED(status))
+        c.exit_code = 128 + WTERMSIG(status); // like shells do
+    else
+        c.exit_code = -1;
+    if (job.error)
+        ec.assign(job.error, std::generic_category());
+    else if (c.exit_code.value())
+        ec.assign((int)c.exit_code.value(), std::generic_category());
+    return true;
+}
+
+#else
+
+char *const *ProcessLauncher::getEnvironment(const std::map<String, String> &)
+{
+    return nullptr;
+}
+
+bool ProcessLauncher::start()
+{
+    return false;
+}
+
+void ProcessLauncher::run()
+{
+}
+
+void ProcessLauncher::run1()
+{
+}
+
+void ProcessLauncher::fail(int)
+{
+}
+
+bool ProcessLauncher::execute(primitives::Command &, ArgvBuilder &, std::error_code &, uint64_t *)
+{
+    return false;
+}
+
+#endif
+
+}
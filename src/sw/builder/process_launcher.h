@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include "argv.h"
+
+#include <primitives/command.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace sw
+{
+
+/// Starts build processes with posix_spawn() and reads their output from one epoll thread.
+///
+/// Programs are resolved once per launcher, environment blocks are made once
+/// per distinct environment, so starting a process costs one spawn and no PATH walks.
+/// Pipes of all running processes are served by a single thread.
+/// Only Linux is supported, elsewhere execute() returns false
+/// and the caller runs the command with primitives::Command::execute().
+/// The same happens after the launcher failed, running commands get the error then.
+struct SW_BUILDER_API ProcessLauncher
+{
+    ProcessLauncher();
+    ProcessLauncher(const ProcessLauncher &) = delete;
+    ProcessLauncher &operator=(const ProcessLauncher &) = delete;
+    ~ProcessLauncher();
+
+    static bool isSupported();
+
+    /// cached resolveExecutable(), empty path if program is not found
+    path resolveProgram(const path &);
+
+    /// runs command with argv instead of its arguments,
+    /// sets pid, exit_code and captured out/err text like primitives::Command::execute(),
+    /// returns false if command needs something unsupported (pipelines, stdin text, detached processes)
+    bool execute(primitives::Command &, ArgvBuilder &argv, std::error_code &ec, uint64_t *peak_rss = nullptr);
+
+private:
+    struct Job;
+    struct Stream;
+    struct Environment
+    {
+        ArgvBuilder b;
+        char *const *envp = nullptr;
+    };
+
+    std::mutex m_programs;
+    std::unordered_map<path, path> programs;
+    std::mutex m_environments;
+    std::map<std::map<String, String>, Environment> environments;
+
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    std::once_flag started;
+    std::thread t;
+    std::atomic_bool stopped{ false };
+    std::mutex m_jobs;
+    std::unordered_set<Job *> jobs; // running ones
+    bool failed = false; // under m_jobs
+
+    char *const *getEnvironment(const std::map<String, String> &);
+    /// returns false if launcher cannot be used
+    bool start();
+    void run();
+    void run1();
+    void fail(int error);
+};
+
+}
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "progress.h"
+
+#include "command_storage.h"
+
+#include <nlohmann/json.hpp>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "progress");
+
+namespace sw
+{
+
+// cheap check without touching filesystem
+// commands with a record in command storage are considered up to date
+// until they are actually executed
+static bool isProbablyOutdated(const CommandNode &n)
+{
+    auto c = dynamic_cast<const builder::Command *>(&n);
+    if (!c)
+        return true;
+    if (c->always || !c->command_storage)
+        return true;
+    return !c->command_storage->find(c->getHash());
+}
+
+static String formatDuration(ExecutionProgress::Duration d)
+{
+    auto s = std::chrono::duration_cast<std::chrono::seconds>(d).count();
+    String r;
+    if (s >= 3600)
+        r += std::to_string(s / 3600) + "h ";
+    if (s >= 60)
+        r += std::to_string(s / 60 % 60) + "m ";
+    r += std::to_string(s % 60) + "s";
+    return r;
+}
+
+ExecutionProgress::ExecutionProgress(size_t n_threads)
+    : n_threads(std::max<size_t>(n_threads, 1))
+{
+}
+
+ExecutionProgress::~ExecutionProgress()
+{
+    stop();
+}
+
+void ExecutionProgress::start(const Commands &cmds, const std::unordered_map<CommandNode *, Duration> &estimates,
+    const std::unordered_set<CommandNode *> *up_to_date)
+{
+    total = cmds.size();
+    expected.reserve(cmds.size());
+    Duration::rep work = 0;
+    for (auto &c : cmds)
+    {
+        if (up_to_date)
+        {
+            if (up_to_date->find(c) != up_to_date->end())
+                continue;
+        }
+        else if (!isProbablyOutdated(*c))
+            continue;
+        auto d = estimates.at(c);
+        expected[c] = d;
+        work += d.count();
+    }
+    n_expected = expected.size();
+    remaining_work = work;
+    t_start = Clock::now();
+
+    if (!print && status_file.empty())
+        return;
+    reporter = std::thread([this]
+    {
+        std::unique_lock lk(m);
+        while (!cv.wait_for(lk, interval, [this] { return stopped; }))
+            report();
+    });
+}
+
+void ExecutionProgress::stop()
+{
+    {
+        std::unique_lock lk(m);
+        if (stopped)
+            return;
+        stopped = true;
+        finished = true;
+    }
+    cv.notify_all();
+    if (reporter.joinable())
+        reporter.join();
+    if ((print || !status_file.empty()) && total)
+        report();
+}
+
+void ExecutionProgress::onCommandFinished(const CommandNode &c, bool executed, Duration d)
+{
+    auto i = expected.find(&c);
+    if (i != expected.end())
+        remaining_work -= i->second.count();
+    if (!executed)
+    {
+        // we expected it, but it was up to date
+        if (i != expected.end())
+            n_expected--;
+        n_skipped++;
+        return;
+    }
+    // we did not expect it, but it was outdated
+    if (i == expected.end())
+        n_expected++;
+    n_executed++;
+    busy_time += d.count();
+}
+
+ExecutionProgress::Duration ExecutionProgress::getElapsed() const
+{
+    return std::chrono::duration_cast<Duration>(Clock::now() - t_start);
+}
+
+double ExecutionProgress::getThroughput() const
+{
+    auto e = getElapsed().count();
+    if (e == 0)
+        return 0;
+    return (n_executed + n_skipped) * 1000.0 / e;
+}
+
+double ExecutionProgress::getUtilization() const
+{
+    auto e = getElapsed().count();
+    if (e == 0)
+        return 0;
+    return std::min(1.0, busy_time / (double)(e * n_threads));
+}
+
+ExecutionProgress::Duration ExecutionProgress::getEta() const
+{
+    // average number of busy workers so far, pool size at the very beginning
+    double parallelism = n_threads;
+    if (getElapsed() > std::chrono::seconds(5))
+        parallelism = std::max(1.0, getUtilization() * n_threads);
+    return Duration((Duration::rep)(std::max<Duration::rep>(remaining_work, 0) / parallelism));
+}
+
+String ExecutionProgress::toString() const
+{
+    String s;
+    s += "[progress] ";
+    s += std::to_string(n_executed) + "/" + std::to_string(n_expected) + " executed, ";
+    s += std::to_string(n_skipped) + " up to date, ";
+    s += std::to_string(total - n_executed - n_skipped) + " left, ";
+    s += std::to_string((int)getThroughput()) + " cmd/s, ";
+    s += "pool utilization " + std::to_string((int)(getUtilization() * 100)) + "%, ";
+    s += "elapsed " + formatDuration(getElapsed());
+    if (!finished)
+        s += ", ETA " + formatDuration(getEta());
+    return s;
+}
+
+String ExecutionProgress::toJson() const
+{
+    nlohmann::json j;
+    j["state"] = finished ? "finished" : "running";
+    j["total"] = total;
+    j["expected"] = n_expected.load();
+    j["executed"] = n_executed.load();
+    j["up_to_date"] = n_skipped.load();
+    j["elapsed"] = getElapsed().count() / 1000.0;
+    j["eta"] = finished ? 0.0 : getEta().count() / 1000.0;
+    j["commands_per_second"] = getThroughput();
+    j["pool_utilization"] = getUtilization();
+    j["threads"] = n_threads;
+    return j.dump(2);
+}
+
+void ExecutionProgress::report() const
+{
+    if (print)
+        LOG_INFO(logger, toString());
+    if (status_file.empty())
+        return;
+    // readers must never see partial file
+    auto tmp = path(status_file) += ".tmp";
+    write_file(tmp, toJson());
+    error_code ec;
+    fs::rename(tmp, status_file, ec);
+    if (ec)
+        LOG_WARN(logger, "Cannot write progress status file " << normalize_path(status_file) << ": " << ec.message());
+}
+
+}
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include "command.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+namespace sw
+{
+
+/// Tracks execution plan state: throughput, executor pool utilization
+/// and remaining time estimation based on recorded command durations.
+/// Periodically reports to console and/or to machine-readable status file.
+struct SW_BUILDER_API ExecutionProgress
+{
+    using Clock = std::chrono::steady_clock;
+    using Duration = CommandNode::Duration;
+    using Commands = std::vector<CommandNode *>;
+
+    bool print = false;
+    path status_file;
+    Duration interval = std::chrono::seconds(1);
+
+    ExecutionProgress(size_t n_threads);
+    ExecutionProgress(const ExecutionProgress &) = delete;
+    ExecutionProgress &operator=(const ExecutionProgress &) = delete;
+    ~ExecutionProgress();
+
+    /// estimates outdated commands and starts reporting
+    /// estimates must be taken before execution, command history is changed during it
+    /// pass commands known to be up to date if outdated check was performed before execution
+    void start(const Commands &, const std::unordered_map<CommandNode *, Duration> &estimates,
+        const std::unordered_set<CommandNode *> *up_to_date = nullptr);
+    /// final report
+    void stop();
+
+    void onCommandFinished(const CommandNode &, bool executed, Duration);
+
+    String toString() const;
+    String toJson() const;
+
+private:
+    size_t n_threads;
+    Clock::time_point t_start;
+
+    // estimated durations of commands we expect to be executed
+    std::unordered_map<const CommandNode *, Duration> expected;
+
+    size_t total = 0;
+    std::atomic_size_t n_expected{ 0 };
+    std::atomic_size_t n_executed{ 0 };
+    std::atomic_size_t n_skipped{ 0 };
+    std::atomic<Duration::rep> remaining_work{ 0 };
+    std::atomic<Duration::rep> busy_time{ 0 };
+
+    std::thread reporter;
+    std::mutex m;
+    std::condition_variable cv;
+    bool stopped = false;
+    bool finished = false;
+
+    void report() const;
+    Duration getElapsed() const;
+    Duration getEta() const;
+    double getThroughput() const;
+    double getUtilization() const;
+};
+
+}
@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "remote_action_cache.h"
+
+#include "file.h"
+
+#include <sw/manager/settings.h>
+#include <sw/protocol/grpc_helpers.h>
+
+#include <grpcpp/grpcpp.h>
+#include <primitives/exceptions.h>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "remote_action_cache");
+
+namespace sw
+{
+
+void toProtobuf(const ActionCacheEntry &e, api::build::ActionResult &r)
+{
+    for (auto &o : e.outputs)
+    {
+        auto po = r.add_outputs();
+        po->set_file(normalize_path(o.file));
+        po->mutable_digest()->set_hash(o.hash);
+        po->mutable_digest()->set_size(o.size);
+    }
+    for (auto &i : e.implicit_inputs)
+        r.add_implicit_inputs(normalize_path(i));
+    r.set_out(e.out);
+    r.set_err(e.err);
+}
+
+ActionCacheEntry fromProtobuf(const api::build::ActionResult &r)
+{
+    ActionCacheEntry e;
+    for (auto &po : r.outputs())
+    {
+        ActionCacheEntry::Output o;
+        o.file = fs::u8path(po.file());
+        o.hash = po.digest().hash();
+        o.size = po.digest().size();
+        e.outputs.push_back(o);
+    }
+    for (auto &i : r.implicit_inputs())
+        e.implicit_inputs.insert(fs::u8path(i));
+    e.out = r.out();
+    e.err = r.err();
+    return e;
+}
+
+RemoteActionCache::RemoteActionCache(const String &endpoint)
+    : endpoint(endpoint)
+{
+    // outputs may be large
+    grpc::ChannelArguments args;
+    args.SetMaxReceiveMessageSize(-1);
+    args.SetMaxSendMessageSize(-1);
+    channel = grpc::CreateCustomChannel(endpoint, grpc::InsecureChannelCredentials(), args);
+    stub = api::build::ActionCacheService::NewStub(channel);
+}
+
+RemoteActionCache::~RemoteActionCache()
+{
+    if (hits || misses || stores)
+        LOG_DEBUG(logger, "Remote action cache " << endpoint << ": " << hits << " hits, " << misses << " misses, " << stores << " stores");
+}
+
+void addAuthToken(grpc::ClientContext &context)
+{
+    auto &token = Settings::get_user_settings().distributed_build_token;
+    if (!token.empty())
+        context.AddMetadata(SW_GRPC_METADATA_AUTH_TOKEN, token);
+}
+
+std::unique_ptr<grpc::ClientContext> RemoteActionCache::getContext() const
+{
+    auto context = std::make_unique<grpc::ClientContext>();
+    GRPC_SET_DEADLINE(10);
+    addAuthToken(*context);
+    return context;
+}
+
+void RemoteActionCache::onError(const std::exception &e)
+{
+    if (disabled.exchange(true))
+        return;
+    LOG_WARN(logger, "Remote action cache " << endpoint << " is disabled for this run: " << e.what());
+}
+
+// missing blob (trimmed on the server) or missing outputs of uploaded action
+static bool isMiss(const grpc::Status &s)
+{
+    return s.error_code() == grpc::StatusCode::NOT_FOUND || s.error_code() == grpc::StatusCode::FAILED_PRECONDITION;
+}
+
+static void check(const grpc::Status &s, const String &method)
+{
+    if (!s.ok())
+        throw RemoteActionCache::TransportError(method + ": " + s.error_message());
+}
+
+std::optional<ActionCacheEntry> RemoteActionCache::lookup(uint64_t key)
+{
+    api::build::ActionKey request;
+    request.set_key(key);
+    auto context = getContext();
+    api::build::LookupActionResponse response;
+    check(stub->LookupAction(context.get(), request, &response), "LookupAction");
+    if (!response.found())
+        return {};
+    return fromProtobuf(response.result());
+}
+
+std::optional<ActionCacheEntry> RemoteActionCache::find(uint64_t inputs_key, const ActionCache::GetKey &get_key, const path &root)
+{
+    if (disabled)
+        return {};
+    try
+    {
+        auto e = lookup(inputs_key);
+        if (e)
+            e = lookup(get_key(inputs_key, e->toAbsolute(root).implicit_inputs));
+        if (!e)
+        {
+            misses++;
+            return {};
+        }
+        return e->toAbsolute(root);
+    }
+    catch (TransportError &e)
+    {
+        onError(e);
+        return {};
+    }
+}
+
+bool RemoteActionCache::restore(const ActionCacheEntry &e)
+{
+    if (disabled)
+        return false;
+    api::build::Blobs response;
+    try
+    {
+        api::build::Digests request;
+        for (auto &o : e.outputs)
+        {
+            auto d = request.add_digests();
+            d->set_hash(o.hash);
+            d->set_size(o.size);
+        }
+        auto context = getContext();
+        GRPC_SET_DEADLINE(600);
+        auto status = stub->ReadBlobs(context.get(), request, &response);
+        if (isMiss(status))
+        {
+            misses++;
+            return false;
+        }
+        check(status, "ReadBlobs");
+    }
+    catch (TransportError &ex)
+    {
+        onError(ex);
+        return false;
+    }
+
+    // check everything before any output is touched
+    if ((size_t)response.blobs().size() != e.outputs.size())
+    {
+        misses++;
+        return false;
+    }
+    int i = 0;
+    for (auto &o : e.outputs)
+    {
+        auto &b = response.blobs()[i++];
+        if (b.digest().hash() != o.hash || (int64_t)b.data().size() != o.size || getContentHash(b.data()) != o.hash)
+        {
+            LOG_DEBUG(logger, "Bad blob from remote action cache " << endpoint << " for " << normalize_path(o.file));
+            misses++;
+            return false;
+        }
+    }
+
+    i = 0;
+    for (auto &o : e.outputs)
+    {
+        auto &b = response.blobs()[i++];
+        error_code ec;
+        fs::remove(o.file, ec);
+        write_file(o.file, b.data());
+    }
+    hits++;
+    return true;
+}
+
+void RemoteActionCache::store(uint64_t inputs_key, uint64_t key, const ActionCacheEntry &e, const path &root)
+{
+    if (disabled)
+        return;
+    try
+    {
+        api::build::Digests missing;
+        {
+            api::build::Digests request;
+            for (auto &o : e.outputs)
+            {
+                auto d = request.add_digests();
+                d->set_hash(o.hash);
+                d->set_size(o.size);
+            }
+            auto context = getContext();
+            check(stub->FindMissingBlobs(context.get(), request, &missing), "FindMissingBlobs");
+        }
+
+        // one blob per call to keep messages reasonable
+        for (auto &d : missing.digests())
+        {
+            auto i = std::find_if(e.outputs.begin(), e.outputs.end(), [&d](const auto &o)
+            {
+                return o.hash == d.hash() && o.size == d.size();
+            });
+            if (i == e.outputs.end())
+                continue;
+            api::build::Blobs request;
+            auto b = request.add_blobs();
+            *b->mutable_digest() = d;
+            b->set_data(read_file(i->file));
+            // output was changed since hashing, server would reject it
+            if ((int64_t)b->data().size() != i->size || getContentHash(b->data()) != i->hash)
+                return;
+            auto context = getContext();
+            GRPC_SET_DEADLINE(600);
+            google::protobuf::Empty response;
+            check(stub->UploadBlobs(context.get(), request, &response), "UploadBlobs");
+        }
+
+        // false when blobs were trimmed on the server meanwhile
+        auto upload = [this](uint64_t key, const ActionCacheEntry &e)
+        {
+            api::build::UploadActionRequest request;
+            request.mutable_key()->set_key(key);
+            toProtobuf(e, *request.mutable_result());
+            auto context = getContext();
+            google::protobuf::Empty response;
+            auto status = stub->UploadAction(context.get(), request, &response);
+            if (isMiss(status))
+                return false;
+            check(status, "UploadAction");
+            return true;
+        };
+
+        // implicit inputs only
+        ActionCacheEntry e1;
+        e1.implicit_inputs = e.implicit_inputs;
+        if (upload(inputs_key, e1.toRelative(root)) && upload(key, e.toRelative(root)))
+            stores++;
+    }
+    catch (TransportError &ex)
+    {
+        onError(ex);
+    }
+}
+
+}
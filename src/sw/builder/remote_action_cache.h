@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include "action_cache.h"
+
+#include <sw/protocol/build.grpc.pb.h>
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+namespace grpc { class ClientContext; }
+
+namespace sw
+{
+
+/// adds token from user settings (distributed_build_token) to a call of build services
+SW_BUILDER_API
+void addAuthToken(grpc::ClientContext &);
+
+SW_BUILDER_API
+void toProtobuf(const ActionCacheEntry &, api::build::ActionResult &);
+SW_BUILDER_API
+ActionCacheEntry fromProtobuf(const api::build::ActionResult &);
+
+/// Client of ActionCacheService (build.proto).
+/// Uses the same two step lookup as local action cache.
+/// After the first connection error the cache is disabled for the rest of the run.
+/// Missing entries and blobs are misses, received blobs are checked against their digests.
+struct SW_BUILDER_API RemoteActionCache
+{
+    /// failed call to the service
+    struct TransportError : std::runtime_error
+    {
+        using std::runtime_error::runtime_error;
+    };
+
+    RemoteActionCache(const String &endpoint);
+    RemoteActionCache(const RemoteActionCache &) = delete;
+    RemoteActionCache &operator=(const RemoteActionCache &) = delete;
+    ~RemoteActionCache();
+
+    const String &getEndpoint() const { return endpoint; }
+
+    std::optional<ActionCacheEntry> find(uint64_t inputs_key, const ActionCache::GetKey &, const path &root);
+    /// uploads outputs missing on the server, then the action itself
+    void store(uint64_t inputs_key, uint64_t key, const ActionCacheEntry &, const path &root);
+    /// downloads outputs into their places
+    bool restore(const ActionCacheEntry &);
+
+private:
+    String endpoint;
+    std::shared_ptr<grpc::Channel> channel;
+    std::unique_ptr<api::build::ActionCacheService::Stub> stub;
+    std::atomic_bool disabled{ false };
+    std::atomic<uint64_t> hits{ 0 };
+    std::atomic<uint64_t> misses{ 0 };
+    std::atomic<uint64_t> stores{ 0 };
+
+    std::unique_ptr<grpc::ClientContext> getContext() const;
+    std::optional<ActionCacheEntry> lookup(uint64_t key);
+    void onError(const std::exception &);
+};
+
+}
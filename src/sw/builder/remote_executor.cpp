@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "remote_executor.h"
+
+#include "command.h"
+#include "command_storage.h"
+#include "file.h"
+#include "file_storage.h"
+#include "remote_action_cache.h"
+#include "sw_context.h"
+
+#include <sw/protocol/grpc_helpers.h>
+
+#include <grpcpp/grpcpp.h>
+#include <primitives/exceptions.h>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "remote_executor");
+
+namespace sw
+{
+
+RemoteExecutor::RemoteExecutor(const String &endpoint)
+    : endpoint(endpoint)
+{
+    // inputs and outputs may be large
+    grpc::ChannelArguments args;
+    args.SetMaxReceiveMessageSize(-1);
+    args.SetMaxSendMessageSize(-1);
+    channel = grpc::CreateCustomChannel(endpoint, grpc::InsecureChannelCredentials(), args);
+    stub = api::build::DistributedBuildService::NewStub(channel);
+    cache = api::build::ActionCacheService::NewStub(channel);
+}
+
+RemoteExecutor::~RemoteExecutor()
+{
+    if (executed)
+        LOG_DEBUG(logger, executed << " commands were executed on " << endpoint);
+}
+
+std::unique_ptr<grpc::ClientContext> RemoteExecutor::getContext() const
+{
+    auto context = std::make_unique<grpc::ClientContext>();
+    GRPC_SET_DEADLINE(10);
+    addAuthToken(*context);
+    return context;
+}
+
+void RemoteExecutor::uploadInputs(const api::build::Command &cmd, const path &root)
+{
+    api::build::Digests missing;
+    {
+        api::build::Digests request;
+        for (auto &i : cmd.inputs())
+            *request.add_digests() = i.digest();
+        auto context = getContext();
+        GRPC_CALL_THROWS(cache, FindMissingBlobs, api::build::Digests);
+        missing = response;
+    }
+
+    // one blob per call to keep messages reasonable
+    for (auto &d : missing.digests())
+    {
+        auto i = std::find_if(cmd.inputs().begin(), cmd.inputs().end(), [&d](const auto &i)
+        {
+            return i.digest().hash() == d.hash() && i.digest().size() == d.size();
+        });
+        if (i == cmd.inputs().end())
+            continue;
+        api::build::Blobs request;
+        auto b = request.add_blobs();
+        *b->mutable_digest() = d;
+        b->set_data(read_file(root / fs::u8path(i->file())));
+        auto context = getContext();
+        GRPC_SET_DEADLINE(600);
+        GRPC_CALL_THROWS(cache, UploadBlobs, google::protobuf::Empty);
+    }
+}
+
+// relative path of file under root, empty when it is outside
+static String relativePath(const path &p, const path &root)
+{
+    auto r = p.lexically_relative(root);
+    if (r.empty() || *r.begin() == "..")
+        return {};
+    return normalize_path(r);
+}
+
+bool RemoteExecutor::execute(builder::Command &c, const Files &additional_inputs)
+{
+    if (disabled)
+        return false;
+
+    // everything is sent relative to the root, the server runs command in a sandbox
+    auto root = c.getActionRoot();
+    auto wd = relativePath(c.working_directory.empty() ? fs::current_path() : c.working_directory, root);
+    // programs are not transferred, built ones can be run only locally
+    auto program = normalize_path(c.getProgram());
+    if (root.empty() || wd.empty() || !relativePath(program, root).empty())
+        return false;
+
+    try
+    {
+        api::build::Command request;
+        request.add_arguments(toRelativeActionPath(c.getProgram(), root));
+        for (auto &a : c.getArguments())
+            request.add_arguments(toRelativeActionPath(a->toString(), root));
+        request.set_working_directory(wd);
+        for (auto &[k, v] : c.environment)
+            (*request.mutable_environment())[k] = toRelativeActionPath(v, root);
+        request.mutable_in()->set_text(c.in.text);
+
+        // files outside of the root must be present on workers
+        auto add_input = [&request, &c, &program, &root](const path &p)
+        {
+            auto s = normalize_path(p);
+            auto rel = relativePath(p, root);
+            if (s == program || rel.empty())
+                return true;
+            if (!fs::is_regular_file(p))
+                return false;
+            auto i = request.add_inputs();
+            i->set_file(rel);
+            if (c.command_storage)
+            {
+                File f(p, c.getContext().getFileStorage());
+                f.isChanged();
+                i->mutable_digest()->set_hash(c.command_storage->getFileHash(p, f.getFileData()));
+                i->mutable_digest()->set_size(f.getFileData().size);
+            }
+            else
+            {
+                i->mutable_digest()->set_hash(getFileContentHash(p));
+                i->mutable_digest()->set_size(fs::file_size(p));
+            }
+            return true;
+        };
+        for (auto &i : c.inputs)
+            add_input(i);
+        // implicit inputs are taken from the previous run,
+        // removed ones tell that they are not current
+        for (auto &i : c.implicit_inputs)
+        {
+            if (!add_input(i))
+                return false;
+        }
+        for (auto &i : additional_inputs)
+        {
+            // not registered in file storage
+            auto rel = relativePath(i, root);
+            if (rel.empty())
+                continue;
+            auto r = request.add_inputs();
+            r->set_file(rel);
+            r->mutable_digest()->set_hash(getFileContentHash(i));
+            r->mutable_digest()->set_size(fs::file_size(i));
+        }
+
+        std::unordered_set<String> outputs;
+        auto add_output = [&request, &root, &outputs](const path &p)
+        {
+            auto rel = relativePath(p, root);
+            if (rel.empty())
+                return false;
+            request.add_outputs(rel);
+            outputs.insert(rel);
+            return true;
+        };
+        for (auto &o : c.outputs)
+        {
+            if (!add_output(o))
+                return false;
+        }
+        if (!c.deps_file.empty() && !add_output(c.deps_file))
+            return false;
+
+        uploadInputs(request, root);
+
+        // no deadline, commands may run for a long time
+        auto context = std::make_unique<grpc::ClientContext>();
+        addAuthToken(*context);
+        GRPC_CALL_THROWS(stub, ExecuteCommand, api::build::CommandResult);
+
+        // the cause may be missing on the server (new includes etc.), so errors are checked locally
+        if (response.exit_code())
+        {
+            LOG_DEBUG(logger, "Command failed on " << endpoint << " with exit code " << response.exit_code() << ", running it locally: " << c.getName());
+            return false;
+        }
+
+        // paths of the sandbox are replaced in text outputs
+        auto unsandbox = [&root, &response](const String &s)
+        {
+            if (response.sandbox().empty())
+                return s;
+            return fromRelativeActionPath(toRelativeActionPath(s, fs::u8path(response.sandbox())), root);
+        };
+        auto deps_file = relativePath(c.deps_file, root);
+        for (auto &o : response.outputs())
+        {
+            if (outputs.find(o.file()) == outputs.end())
+                continue;
+            auto p = root / fs::u8path(o.file());
+            error_code ec2;
+            fs::remove(p, ec2);
+            write_file(p, o.file() == deps_file ? unsandbox(o.data()) : o.data());
+        }
+        c.exit_code = response.exit_code();
+        c.out.text = unsandbox(response.out());
+        c.err.text = unsandbox(response.err());
+        executed++;
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        if (!disabled.exchange(true))
+            LOG_WARN(logger, "Distributed execution on " << endpoint << " is disabled for this run: " << e.what());
+        return false;
+    }
+}
+
+}
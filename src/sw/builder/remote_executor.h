@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include <sw/protocol/build.grpc.pb.h>
+
+#include <primitives/filesystem.h>
+
+#include <atomic>
+#include <memory>
+
+namespace grpc { class ClientContext; }
+
+namespace sw
+{
+
+namespace builder { struct Command; }
+
+/// Client of DistributedBuildService (build.proto).
+/// Inputs missing on the server are uploaded into its action cache,
+/// outputs are returned together with the result.
+/// Paths are sent relative to the root of the command (Command::getActionRoot()).
+/// Programs and files outside of the root are not transferred, they must be present on workers at the same paths.
+/// Implicit inputs of the previous run are sent, commands without them and failed ones are run locally.
+struct SW_BUILDER_API RemoteExecutor
+{
+    RemoteExecutor(const String &endpoint);
+    RemoteExecutor(const RemoteExecutor &) = delete;
+    RemoteExecutor &operator=(const RemoteExecutor &) = delete;
+    ~RemoteExecutor();
+
+    const String &getEndpoint() const { return endpoint; }
+
+    /// returns false when command was not executed remotely or failed there (server is not available,
+    /// implicit inputs are stale etc.), caller must execute it locally then
+    bool execute(builder::Command &, const Files &additional_inputs);
+
+private:
+    String endpoint;
+    std::shared_ptr<grpc::Channel> channel;
+    std::unique_ptr<api::build::DistributedBuildService::Stub> stub;
+    std::unique_ptr<api::build::ActionCacheService::Stub> cache;
+    std::atomic_bool disabled{ false };
+    std::atomic<uint64_t> executed{ 0 };
+
+    std::unique_ptr<grpc::ClientContext> getContext() const;
+    void uploadInputs(const api::build::Command &, const path &root);
+};
+
+}
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "stable_hash.h"
+
+#include <cstring>
+
+namespace sw
+{
+
+static constexpr uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64_t prime3 = 0x165667B19E3779F9ULL;
+static constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+static constexpr uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t rotl(uint64_t v, int r)
+{
+    return (v << r) | (v >> (64 - r));
+}
+
+// input is little endian on every platform
+static uint64_t read64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t round(uint64_t acc, uint64_t v)
+{
+    acc += v * prime2;
+    acc = rotl(acc, 31);
+    return acc * prime1;
+}
+
+static uint64_t merge(uint64_t acc, uint64_t v)
+{
+    acc ^= round(0, v);
+    return acc * prime1 + prime4;
+}
+
+static uint64_t avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t stable_hash(const void *data, size_t size, uint64_t seed)
+{
+    auto p = (const uint8_t *)data;
+    auto end = p + size;
+    uint64_t h;
+
+    if (size >= 32)
+    {
+        uint64_t v1 = seed + prime1 + prime2;
+        uint64_t v2 = seed + prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - prime1;
+        do
+        {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(h, v1);
+        h = merge(h, v2);
+        h = merge(h, v3);
+        h = merge(h, v4);
+    }
+    else
+        h = seed + prime5;
+
+    h += size;
+    for (; p + 8 <= end; p += 8)
+        h = rotl(h ^ round(0, read64(p)), 27) * prime1 + prime4;
+    if (p + 4 <= end)
+    {
+        h = rotl(h ^ (read32(p) * prime1), 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = rotl(h ^ (*p * prime5), 11) * prime1;
+    return avalanche(h);
+}
+
+void stable_hash_combine(uint64_t &h, uint64_t v)
+{
+    h = avalanche(h ^ (v + prime1 + (h << 6) + (h >> 2)));
+}
+
+void UnorderedHash::add(std::string_view s)
+{
+    auto h = stable_hash(s);
+    // two independent mixes, so sums of different sets rarely collide
+    sum1 += avalanche(h);
+    sum2 += avalanche(h ^ prime4) * prime5;
+    n++;
+}
+
+uint64_t UnorderedHash::get() const
+{
+    uint64_t h = n;
+    stable_hash_combine(h, sum1);
+    stable_hash_combine(h, sum2);
+    return h;
+}
+
+}
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#pragma once
+
+#include <primitives/filesystem.h>
+
+#include <string_view>
+
+namespace sw
+{
+
+/// XXH64 of data, same value on every platform, compiler and run.
+/// Use it for hashes that are stored on disk, std::hash is implementation defined.
+SW_BUILDER_API
+uint64_t stable_hash(const void *data, size_t size, uint64_t seed = 0);
+
+inline uint64_t stable_hash(std::string_view s, uint64_t seed = 0)
+{
+    return stable_hash(s.data(), s.size(), seed);
+}
+
+/// order dependent combination
+SW_BUILDER_API
+void stable_hash_combine(uint64_t &h, uint64_t v);
+
+/// Order insensitive hash of a sequence of strings.
+///
+/// Element hashes are mixed and summed, so no sorting and no allocations are needed.
+/// Unlike hashing of a sorted set, repeated elements change the value.
+struct SW_BUILDER_API UnorderedHash
+{
+    void add(std::string_view);
+    uint64_t get() const;
+
+private:
+    uint64_t sum1 = 0;
+    uint64_t sum2 = 0;
+    uint64_t n = 0;
+};
+
+}
@@ -18,10 +18,17 @@
 
 #include "sw_context.h"
 
+#include "action_cache.h"
 #include "command_storage.h"
 #include "file_storage.h"
+#include "file_watcher.h"
+#include "process_launcher.h"
+#include "remote_action_cache.h"
+#include "remote_executor.h"
 
+#include <sw/manager/settings.h>
 #include <sw/manager/storage.h>
+#include <sw/support/filesystem.h>
 
 #include <boost/thread/lock_types.hpp>
 #include <boost/thread/shared_mutex.hpp>
@@ -38,6 +45,7 @@ namespace sw
 SwBuilderContext::SwBuilderContext()
 {
     file_storage_executor = std::make_unique<Executor>("async log writer", 1);
+    process_launcher = std::make_unique<ProcessLauncher>();
 }
 
 SwBuilderContext::~SwBuilderContext()
@@ -49,10 +57,26 @@ Executor &SwBuilderContext::getFileStorageExecutor() const
     return *file_storage_executor;
 }
 
+ProcessLauncher &SwBuilderContext::getProcessLauncher() const
+{
+    return *process_launcher;
+}
+
 FileStorage &SwBuilderContext::getFileStorage() const
 {
     if (!file_storage)
+    {
         file_storage = std::make_unique<FileStorage>();
+        auto &us = Settings::get_user_settings();
+        if (us.use_file_watcher && FileWatcher::isSupported())
+        {
+            file_states = std::make_unique<FileStateCache>(
+                fs::current_path() / SW_BINARY_DIR / "file_states.bin",
+                FileWatcherServer::getDefaultSocket(),
+                FilesOrdered{ fs::current_path(), us.storage_dir });
+            file_states->load(*file_storage);
+        }
+    }
     return *file_storage;
 }
 
@@ -65,9 +89,59 @@ CommandStorage &SwBuilderContext::getCommandStorage(const path &root) const
     return *cs;
 }
 
+ActionCache &SwBuilderContext::getActionCache() const
+{
+    std::unique_lock lk(csm);
+    if (!action_cache)
+    {
+        auto &us = Settings::get_user_settings();
+        action_cache = std::make_unique<ActionCache>(us.storage_dir / "cache" / "actions", us.action_cache_max_size);
+    }
+    return *action_cache;
+}
+
+RemoteActionCache &SwBuilderContext::getRemoteActionCache(const String &endpoint) const
+{
+    std::unique_lock lk(csm);
+    auto &c = remote_action_caches[endpoint];
+    if (!c)
+        c = std::make_unique<RemoteActionCache>(endpoint);
+    return *c;
+}
+
+RemoteExecutor &SwBuilderContext::getRemoteExecutor(const String &endpoint) const
+{
+    std::unique_lock lk(csm);
+    auto &e = remote_executors[endpoint];
+    if (!e)
+        e = std::make_unique<RemoteExecutor>(endpoint);
+    return *e;
+}
+
 void SwBuilderContext::clearFileStorages()
 {
+    // command storages keep pointers to file data
+    {
+        std::unique_lock lk(csm);
+        for (auto &[_, cs] : command_storages)
+            cs->getInternalStorage().paths.clearFileData();
+    }
     file_storage.reset();
+    file_states.reset();
+}
+
+void SwBuilderContext::saveFileStates() const
+{
+    if (!file_states || !file_storage)
+        return;
+    try
+    {
+        file_states->save(*file_storage);
+    }
+    catch (std::exception &)
+    {
+        // next run will check all files
+    }
 }
 
 void SwBuilderContext::clearCommandStorages()
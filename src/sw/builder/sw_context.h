@@ -28,8 +28,13 @@ struct Executor;
 namespace sw
 {
 
+struct ActionCache;
 struct CommandStorage;
+struct FileStateCache;
 struct FileStorage;
+struct ProcessLauncher;
+struct RemoteActionCache;
+struct RemoteExecutor;
 
 namespace builder::detail { struct ResolvableCommand; }
 
@@ -41,14 +46,25 @@ struct SW_BUILDER_API SwBuilderContext
     FileStorage &getFileStorage() const;
     Executor &getFileStorageExecutor() const;
     CommandStorage &getCommandStorage(const path &root) const;
+    ActionCache &getActionCache() const;
+    RemoteActionCache &getRemoteActionCache(const String &endpoint) const;
+    RemoteExecutor &getRemoteExecutor(const String &endpoint) const;
+    ProcessLauncher &getProcessLauncher() const;
 
     void clearFileStorages();
+    /// for the next run, when file watcher is used
+    void saveFileStates() const;
     void clearCommandStorages();
 
 private:
     // keep order
     mutable std::unordered_map<path, std::unique_ptr<CommandStorage>> command_storages;
     mutable std::unique_ptr<FileStorage> file_storage;
+    mutable std::unique_ptr<FileStateCache> file_states;
+    mutable std::unique_ptr<ActionCache> action_cache;
+    mutable std::unordered_map<String, std::unique_ptr<RemoteActionCache>> remote_action_caches;
+    mutable std::unordered_map<String, std::unique_ptr<RemoteExecutor>> remote_executors;
+    std::unique_ptr<ProcessLauncher> process_launcher;
     std::unique_ptr<Executor> file_storage_executor; // after everything!
 
     mutable std::mutex csm;
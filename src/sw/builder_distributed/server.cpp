@@ -4,9 +4,15 @@
 #include "server.h"
 
 #include <sw/builder/command.h>
+#include <sw/builder/file.h>
+#include <sw/builder/remote_action_cache.h>
+#include <sw/manager/settings.h>
 
 #include <grpcpp/grpcpp.h>
 #include <primitives/exceptions.h>
+#include <primitives/templates.h>
+
+#include <thread>
 
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "builder.distributed.server");
@@ -16,30 +22,169 @@ DECLARE_STATIC_LOGGER(logger, "builder.distributed.server");
 namespace sw::builder::distributed
 {
 
+// token is compared in constant time
+static bool checkToken(const grpc::ServerContext &context, const String &token)
+{
+    // only local endpoints are allowed without it, see Server::start()
+    if (token.empty())
+        return true;
+    auto &md = context.client_metadata();
+    auto i = md.find(SW_GRPC_METADATA_AUTH_TOKEN);
+    if (i == md.end() || i->second.size() != token.size())
+        return false;
+    unsigned char d = 0;
+    for (size_t j = 0; j < token.size(); j++)
+        d |= i->second.data()[j] ^ token[j];
+    return d == 0;
+}
+
+#define CHECK_TOKEN(t) \
+    if (!checkToken(*context, t)) \
+        return grpc::Status(grpc::StatusCode::UNAUTHENTICATED, "Bad token")
+
 DEFINE_SERVICE_METHOD(DistributedBuildService, ExecuteCommand, ::sw::api::build::Command, ::sw::api::build::CommandResult)
 {
-    // fan mode: send to workers in round robin mode
+    CHECK_TOKEN(token);
+    try
+    {
+        server->execute(*request, *response);
+    }
+    catch (std::exception &e)
+    {
+        return grpc::Status(grpc::StatusCode::INTERNAL, e.what());
+    }
+    GRPC_RETURN_OK();
+}
+
+DEFINE_SERVICE_METHOD(DistributedBuildService, RegisterWorker, ::sw::api::build::WorkerInfo, ::google::protobuf::Empty)
+{
+    CHECK_TOKEN(token);
+    if (request->endpoint().empty())
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Empty endpoint");
+    server->addWorker(request->endpoint(), request->threads());
+    GRPC_RETURN_OK();
+}
+
+DEFINE_SERVICE_METHOD(ActionCacheService, LookupAction, ::sw::api::build::ActionKey, ::sw::api::build::LookupActionResponse)
+{
+    CHECK_TOKEN(token);
+    auto e = cache->loadEntry(request->key());
+    response->set_found(!!e);
+    if (e)
+        toProtobuf(*e, *response->mutable_result());
+    GRPC_RETURN_OK();
+}
+
+DEFINE_SERVICE_METHOD(ActionCacheService, UploadAction, ::sw::api::build::UploadActionRequest, ::google::protobuf::Empty)
+{
+    CHECK_TOKEN(token);
+    // do not accept actions with missing outputs
+    auto e = fromProtobuf(request->result());
+    for (auto &o : e.outputs)
+    {
+        if (!cache->hasBlob(o.hash, o.size))
+            return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, "Missing blob for " + normalize_path(o.file));
+    }
+    cache->saveEntry(request->key().key(), e);
+    flush();
+    GRPC_RETURN_OK();
+}
 
-    Command c;
-    c.in.file = fs::u8path(request->in().file());
-    c.in.file = fs::u8path(request->in().file());
-    c.in.file = fs::u8path(request->in().file());
+DEFINE_SERVICE_METHOD(ActionCacheService, FindMissingBlobs, ::sw::api::build::Digests, ::sw::api::build::Digests)
+{
+    CHECK_TOKEN(token);
+    for (auto &d : request->digests())
+    {
+        if (!cache->hasBlob(d.hash(), d.size()))
+            *response->add_digests() = d;
+    }
+    GRPC_RETURN_OK();
+}
 
-    c.execute();
+DEFINE_SERVICE_METHOD(ActionCacheService, UploadBlobs, ::sw::api::build::Blobs, ::google::protobuf::Empty)
+{
+    CHECK_TOKEN(token);
+    for (auto &b : request->blobs())
+    {
+        // blobs are addressed by content, never store them under a wrong digest
+        auto &d = b.digest();
+        if ((int64_t)b.data().size() != d.size() || getContentHash(b.data()) != d.hash())
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Blob digest mismatch");
+        cache->storeBlob(d.hash(), d.size(), b.data());
+    }
+    flush();
+    GRPC_RETURN_OK();
+}
 
+DEFINE_SERVICE_METHOD(ActionCacheService, ReadBlobs, ::sw::api::build::Digests, ::sw::api::build::Blobs)
+{
+    CHECK_TOKEN(token);
+    for (auto &d : request->digests())
+    {
+        if (!cache->hasBlob(d.hash(), d.size()))
+            return grpc::Status(grpc::StatusCode::NOT_FOUND, "Missing blob");
+        auto b = response->add_blobs();
+        *b->mutable_digest() = d;
+        b->set_data(cache->readBlob(d.hash(), d.size()));
+    }
     GRPC_RETURN_OK();
 }
 
-Server::Server()
+void ActionCacheServiceImpl::flush()
+{
+    // cache is walked only when it is over the limit, one walk at a time is enough
+    std::unique_lock lk(m_flush, std::try_to_lock);
+    if (!lk.owns_lock())
+        return;
+    try
+    {
+        cache->flush();
+    }
+    catch (std::exception &e)
+    {
+        LOG_WARN(logger, "Cannot trim action cache: " << e.what());
+    }
+}
+
+Worker::Worker(const String &endpoint, int threads)
+    : endpoint(endpoint), threads(threads > 0 ? threads : 1)
+{
+    grpc::ChannelArguments args;
+    args.SetMaxReceiveMessageSize(-1);
+    args.SetMaxSendMessageSize(-1);
+    stub = ::sw::api::build::DistributedBuildService::NewStub(
+        grpc::CreateCustomChannel(endpoint, grpc::InsecureChannelCredentials(), args));
+}
+
+Server::Server(const path &in_cache_dir)
 {
+    dbs.server = this;
+    auto &us = Settings::get_user_settings();
+    auto cache_dir = in_cache_dir.empty() ? us.storage_dir / "cache" / "server" : in_cache_dir;
+    acs.cache = std::make_unique<ActionCache>(cache_dir, us.action_cache_max_size);
+    sandbox_dir = cache_dir / "sandbox";
+    dbs.token = us.distributed_build_token;
+    acs.token = us.distributed_build_token;
 }
 
 Server::~Server()
 {
 }
 
+static bool isLocalEndpoint(const String &endpoint)
+{
+    if (endpoint.rfind("unix:", 0) == 0)
+        return true;
+    auto host = endpoint.substr(0, endpoint.rfind(':'));
+    return host == "localhost" || host == "127.0.0.1" || host == "[::1]";
+}
+
 void Server::start(const String &server_address/*, const String &cert*/)
 {
+    // anyone who can connect is able to run commands
+    if (dbs.token.empty() && !isLocalEndpoint(server_address))
+        throw SW_RUNTIME_ERROR("Set 'distributed_build_token' in user settings to listen on " + server_address);
+
     grpc::SslServerCredentialsOptions ssl_options;
     //if (!cert.empty())
         //ssl_options.pem_key_cert_pairs.push_back({ read_file("server.key"), read_file("server.crt") });
@@ -49,8 +194,11 @@ void Server::start(const String &server_address/*, const String &cert*/)
         //builder.AddListeningPort(server_address, grpc::SslServerCredentials(ssl_options));
     //else
     builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+    builder.SetMaxReceiveMessageSize(-1); // blobs
+    builder.SetMaxSendMessageSize(-1);
 
     builder.RegisterService(&dbs);
+    builder.RegisterService(&acs);
     server = builder.BuildAndStart();
     if (!server)
         throw SW_RUNTIME_ERROR("Cannot start grpc server");
@@ -68,6 +216,180 @@ void Server::stop()
     if (!server)
         throw SW_RUNTIME_ERROR("Server not started");
     server->Shutdown();
+    acs.flush();
+}
+
+void Server::registerAsWorker(const String &main_server, const String &endpoint, int threads)
+{
+    auto channel = grpc::CreateCustomChannel(main_server, grpc::InsecureChannelCredentials(), [] {
+        grpc::ChannelArguments args;
+        args.SetMaxReceiveMessageSize(-1);
+        args.SetMaxSendMessageSize(-1);
+        return args;
+    }());
+    main_cache = ::sw::api::build::ActionCacheService::NewStub(channel);
+
+    ::sw::api::build::WorkerInfo request;
+    request.set_endpoint(endpoint);
+    request.set_threads(threads > 0 ? threads : std::thread::hardware_concurrency());
+    auto context = std::make_unique<grpc::ClientContext>();
+    GRPC_SET_DEADLINE(10);
+    addAuthToken(*context);
+    auto stub = ::sw::api::build::DistributedBuildService::NewStub(channel);
+    GRPC_CALL_THROWS(stub, RegisterWorker, ::google::protobuf::Empty);
+    LOG_INFO(logger, "Registered as worker " << endpoint << " at " << main_server);
+}
+
+void Server::addWorker(const String &endpoint, int threads)
+{
+    std::unique_lock lk(m_workers);
+    auto i = std::find_if(workers.begin(), workers.end(), [&endpoint](const auto &w) { return w->endpoint == endpoint; });
+    if (i != workers.end())
+    {
+        // restarted worker
+        (*i)->threads = threads > 0 ? threads : 1;
+        (*i)->alive = true;
+    }
+    else
+        workers.push_back(std::make_unique<Worker>(endpoint, threads));
+    LOG_INFO(logger, "Worker " << endpoint << " (" << threads << " threads) is registered");
+}
+
+Worker *Server::selectWorker()
+{
+    std::unique_lock lk(m_workers);
+    Worker *best = nullptr;
+    for (size_t j = 0; j < workers.size(); j++)
+    {
+        // start from the next one, so equally loaded workers are taken in turn
+        auto &w = workers[(next_worker + j) % workers.size()];
+        if (!w->alive)
+            continue;
+        if (!best || w->getLoad() < best->getLoad())
+            best = w.get();
+    }
+    if (best)
+    {
+        best->active++;
+        next_worker++;
+    }
+    return best;
+}
+
+void Server::execute(const ::sw::api::build::Command &cmd, ::sw::api::build::CommandResult &result)
+{
+    while (auto w = selectWorker())
+    {
+        auto context = std::make_unique<grpc::ClientContext>();
+        addAuthToken(*context);
+        auto status = w->stub->ExecuteCommand(context.get(), cmd, &result);
+        w->active--;
+        if (status.ok())
+            return;
+        if (status.error_code() != grpc::StatusCode::UNAVAILABLE)
+            throw SW_RUNTIME_ERROR("Worker " + w->endpoint + " failed: " + status.error_message());
+        LOG_WARN(logger, "Worker " << w->endpoint << " is not available, removing it");
+        w->alive = false;
+        result.Clear();
+    }
+    executeLocally(cmd, result);
+}
+
+// client must not write outside of the sandbox
+static path getSandboxPath(const path &sandbox, const String &file)
+{
+    auto p = fs::u8path(file);
+    if (p.empty() || p.has_root_name() || p.has_root_directory())
+        throw SW_RUNTIME_ERROR("Bad path: '" + file + "', only relative paths are allowed");
+    for (auto &c : p)
+    {
+        if (c == "..")
+            throw SW_RUNTIME_ERROR("Bad path: '" + file + "', '..' is not allowed");
+    }
+    return sandbox / p;
+}
+
+void Server::prepareInputs(const ::sw::api::build::Command &cmd, const path &sandbox)
+{
+    for (auto &i : cmd.inputs())
+    {
+        auto p = getSandboxPath(sandbox, i.file());
+        auto &d = i.digest();
+        String data;
+        if (acs.cache->hasBlob(d.hash(), d.size()))
+            data = acs.cache->readBlob(d.hash(), d.size());
+        else if (main_cache)
+        {
+            ::sw::api::build::Digests request;
+            *request.add_digests() = d;
+            auto context = std::make_unique<grpc::ClientContext>();
+            GRPC_SET_DEADLINE(600);
+            addAuthToken(*context);
+            GRPC_CALL_THROWS(main_cache, ReadBlobs, ::sw::api::build::Blobs);
+            if (response.blobs().empty())
+                throw SW_RUNTIME_ERROR("Missing input: " + i.file());
+            data = response.blobs()[0].data();
+            if ((int64_t)data.size() != d.size() || getContentHash(data) != d.hash())
+                throw SW_RUNTIME_ERROR("Bad input from main server: " + i.file());
+            acs.cache->storeBlob(d.hash(), d.size(), data);
+        }
+        else
+            throw SW_RUNTIME_ERROR("Missing input: " + i.file());
+
+        fs::create_directories(p.parent_path());
+        write_file(p, data);
+    }
+}
+
+void Server::executeLocally(const ::sw::api::build::Command &cmd, ::sw::api::build::CommandResult &result)
+{
+    if (cmd.arguments().empty())
+        throw SW_RUNTIME_ERROR("Empty command");
+
+    // every command has its own directory, so clients cannot touch files of the server and of each other
+    auto sandbox = sandbox_dir / unique_path();
+    SCOPE_EXIT
+    {
+        error_code ec;
+        fs::remove_all(sandbox, ec);
+    };
+    prepareInputs(cmd, sandbox);
+    for (auto &o : cmd.outputs())
+        fs::create_directories(getSandboxPath(sandbox, o).parent_path());
+    auto wd = getSandboxPath(sandbox, cmd.working_directory());
+    fs::create_directories(wd);
+
+    primitives::Command c;
+    c.setProgram(fs::u8path(fromRelativeActionPath(cmd.arguments()[0], sandbox)));
+    for (int i = 1; i < cmd.arguments().size(); i++)
+        c.arguments.push_back(fromRelativeActionPath(cmd.arguments()[i], sandbox));
+    c.working_directory = wd;
+    for (auto &[k, v] : cmd.environment())
+        c.environment[k] = fromRelativeActionPath(v, sandbox);
+    c.in.text = cmd.in().text();
+
+    error_code ec;
+    c.execute(ec);
+
+    if (c.exit_code)
+        result.set_exit_code(*c.exit_code);
+    else
+        result.set_exit_code(-1);
+    result.set_out(c.out.text);
+    result.set_err(c.err.text);
+    if (ec && !c.exit_code)
+        result.set_err(result.err() + ec.message());
+    result.set_sandbox(normalize_path(sandbox));
+
+    for (auto &o : cmd.outputs())
+    {
+        auto p = getSandboxPath(sandbox, o);
+        if (!fs::exists(p))
+            continue;
+        auto r = result.add_outputs();
+        r->set_file(o);
+        r->set_data(read_file(p));
+    }
 }
 
 }
@@ -3,51 +3,107 @@
 
 #pragma once
 
+#include <sw/builder/action_cache.h>
 #include <sw/protocol/build.grpc.pb.h>
 #include <sw/protocol/grpc_helpers.h>
 
 #include <grpcpp/server.h>
 #include <primitives/string.h>
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 namespace sw::builder::distributed
 {
 
+struct Server;
+
 class DistributedBuildServiceImpl : public ::sw::api::build::DistributedBuildService::Service
 {
+public:
+    Server *server = nullptr;
+    String token;
+
     DECLARE_SERVICE_METHOD(ExecuteCommand, ::sw::api::build::Command, ::sw::api::build::CommandResult);
+    DECLARE_SERVICE_METHOD(RegisterWorker, ::sw::api::build::WorkerInfo, ::google::protobuf::Empty);
 };
 
-struct SW_BUILDER_DISTRIBUTED_API Client
-{
-
-};
+// stores everything in a local action cache of the server
+// blobs are checked against their digests, cache is trimmed after uploads
+class ActionCacheServiceImpl : public ::sw::api::build::ActionCacheService::Service
+{
+public:
+    std::unique_ptr<ActionCache> cache;
+    String token;
+
+    DECLARE_SERVICE_METHOD(LookupAction, ::sw::api::build::ActionKey, ::sw::api::build::LookupActionResponse);
+    DECLARE_SERVICE_METHOD(UploadAction, ::sw::api::build::UploadActionRequest, ::google::protobuf::Empty);
+    DECLARE_SERVICE_METHOD(FindMissingBlobs, ::sw::api::build::Digests, ::sw::api::build::Digests);
+    DECLARE_SERVICE_METHOD(UploadBlobs, ::sw::api::build::Blobs, ::google::protobuf::Empty);
+    DECLARE_SERVICE_METHOD(ReadBlobs, ::sw::api::build::Digests, ::sw::api::build::Blobs);
 
-struct SW_BUILDER_DISTRIBUTED_API Session
-{
-    std::unique_ptr<Client> client;
+    void flush();
+
+private:
+    std::mutex m_flush;
 };
 
 struct SW_BUILDER_DISTRIBUTED_API Worker
-{
-
-};
+{
+    String endpoint;
+    int threads = 1;
+    std::atomic_int active{ 0 }; // commands in progress
+    std::atomic_bool alive{ true };
+    std::unique_ptr<::sw::api::build::DistributedBuildService::Stub> stub;
+
+    Worker(const String &endpoint, int threads);
+
+    double getLoad() const { return active / (double)threads; }
+};
 
+/// Distributed builder.
+///
+/// Commands are sent to registered workers with the least load (round robin on ties).
+/// When there are no workers, commands are executed by the server itself.
+/// Workers are servers registered at the main one, they take missing inputs
+/// from the main server action cache.
+/// Commands are executed in sandbox directories, see build.proto.
+/// Calls must have the token from user settings, without it server listens only on local endpoints.
 struct SW_BUILDER_DISTRIBUTED_API Server
-{
+{
     std::unique_ptr<grpc::Server> server;
     DistributedBuildServiceImpl dbs;
-    std::vector<std::unique_ptr<Session>> sessions;
-    std::vector<std::unique_ptr<Worker>> workers;
+    ActionCacheServiceImpl acs;
 
-    Server();
+    /// action cache is stored in cache_dir, default is under user storage dir
+    Server(const path &cache_dir = {});
     ~Server();
 
     void start(const String &endpoint/*, const String &cert = {}*/);
     void wait();
     void stop();
+
+    /// register as a worker of the main server, endpoint must be reachable from it
+    void registerAsWorker(const String &main_server, const String &endpoint, int threads = 0);
+
+    void addWorker(const String &endpoint, int threads);
+    void execute(const ::sw::api::build::Command &, ::sw::api::build::CommandResult &);
+
+private:
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex m_workers;
+    size_t next_worker = 0;
+
+    // main server action cache, when we are a worker
+    std::unique_ptr<::sw::api::build::ActionCacheService::Stub> main_cache;
+
+    path sandbox_dir;
+
+    Worker *selectWorker();
+    void executeLocally(const ::sw::api::build::Command &, ::sw::api::build::CommandResult &);
+    void prepareInputs(const ::sw::api::build::Command &, const path &sandbox);
 };
 
 }
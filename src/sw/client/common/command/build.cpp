@@ -130,5 +130,12 @@ SUBCOMMAND_DECL(build)
         b->runSavedExecutionPlan();
         return;
     }
+    // targets are not used after this build, so they may be not loaded at all
+    if (getOptions().plan_cache)
+    {
+        auto s = b->getSettings();
+        s["plan_cache"] = "true";
+        b->setSettings(s);
+    }
     b->build();
 }
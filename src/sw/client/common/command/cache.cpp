@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+#include "../commands.h"
+
+#include <sw/builder/action_cache.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "command.cache");
+
+static uint64_t parse_size(const String &s)
+{
+    size_t pos;
+    auto v = std::stoull(s, &pos);
+    auto suffix = boost::to_upper_copy(s.substr(pos));
+    if (suffix.empty() || suffix == "B")
+        return v;
+    if (suffix == "K" || suffix == "KB")
+        return v << 10;
+    if (suffix == "M" || suffix == "MB")
+        return v << 20;
+    if (suffix == "G" || suffix == "GB")
+        return v << 30;
+    throw SW_RUNTIME_ERROR("Bad size: " + s);
+}
+
+static String print_size(uint64_t v)
+{
+    if (v >= (1ULL << 30))
+        return std::to_string(v / (1ULL << 20) / 1024.0) + " GB";
+    if (v >= (1ULL << 20))
+        return std::to_string(v / (1ULL << 10) / 1024.0) + " MB";
+    return std::to_string(v) + " bytes";
+}
+
+SUBCOMMAND_DECL(cache)
+{
+    auto &ac = getContext(false).getActionCache();
+    auto &cmd = getOptions().options_cache.cache_subcommand;
+
+    if (cmd.empty() || cmd == "stats")
+    {
+        auto s = ac.getStats();
+        auto total = s.hits + s.misses;
+        LOG_INFO(logger, "Action cache: " << normalize_path(ac.getRoot()));
+        LOG_INFO(logger, "size: " << print_size(s.size) << " of " << print_size(ac.max_size));
+        LOG_INFO(logger, "entries: " << s.entries);
+        LOG_INFO(logger, "blobs: " << s.blobs);
+        LOG_INFO(logger, "hits: " << s.hits << (total ? " (" + std::to_string(s.hits * 100 / total) + "%)" : String()));
+        LOG_INFO(logger, "misses: " << s.misses);
+        LOG_INFO(logger, "stores: " << s.stores);
+    }
+    else if (cmd == "trim")
+    {
+        auto max_size = ac.max_size;
+        if (!getOptions().options_cache.cache_max_size.empty())
+            max_size = parse_size(getOptions().options_cache.cache_max_size);
+        ac.trim(max_size);
+        LOG_INFO(logger, "Action cache size: " << print_size(ac.getStats().size));
+    }
+    else if (cmd == "clear")
+    {
+        ac.clear();
+    }
+    else
+        throw SW_RUNTIME_ERROR("Unknown cache subcommand: " + cmd);
+}
@@ -3,19 +3,30 @@
 
 #include "../commands.h"
 
+#include <sw/builder/file_watcher.h>
 #include <sw/builder_distributed/server.h>
 
 SUBCOMMAND_DECL(server)
 {
-    if (getOptions().options_server.distributed_builder)
+    auto &o = getOptions().options_server;
+    if (o.distributed_builder || !o.distributed_worker.empty())
     {
-        sw::builder::distributed::Server s;
-        s.start(getOptions().options_server.endpoint);
+        sw::builder::distributed::Server s(o.server_cache_dir);
+        s.start(o.endpoint);
+        if (!o.distributed_worker.empty())
+            s.registerAsWorker(o.distributed_worker, o.endpoint);
         s.wait();
         // TODO: handle interrupts properly
         s.stop();
         return;
     }
 
+    if (o.file_watcher)
+    {
+        sw::FileWatcherServer s(sw::FileWatcherServer::getDefaultSocket());
+        s.run();
+        return;
+    }
+
     SW_UNIMPLEMENTED;
 }
@@ -1283,7 +1283,8 @@ void RawBootstrapBuildGenerator::generate(const sw::SwBuild &b)
     {
         auto &c = dynamic_cast<const sw::builder::Command &>(*c1);
         files.insert(c.inputs.begin(), c.inputs.end());
-        files.insert(c.implicit_inputs.begin(), c.implicit_inputs.end());
+        auto implicit_inputs = c.getImplicitInputs();
+        files.insert(implicit_inputs.begin(), implicit_inputs.end());
     }
 
     LOG_INFO(logger, "Filtering files");
@@ -309,17 +309,6 @@ void StartupData::setup()
         return;
     }
 
-    // before storages
-    // Create QSBR context for the main thread.
-    //auto context = createConcurrentContext();
-    //getConcurrentContext(&context);
-
-    SCOPE_EXIT
-    {
-        // Destroy the QSBR context for the main thread.
-        //destroyConcurrentContext(context);
-    };
-
     if (!getOptions().options_build.ide_fast_path.empty() && fs::exists(getOptions().options_build.ide_fast_path))
     {
         auto files = read_lines(getOptions().options_build.ide_fast_path);
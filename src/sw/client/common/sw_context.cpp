@@ -387,6 +387,12 @@ std::unique_ptr<sw::SwBuild> SwClientContext::createBuildInternal()
 
     //
     SET_BOOL_OPTION(build_always);
+    SET_BOOL_OPTION(content_hash);
+    SET_BOOL_OPTION(action_cache);
+    if (!options.remote_cache.empty())
+        bs["remote_cache"] = options.remote_cache;
+    if (!options.distributed_build.empty())
+        bs["distributed_build"] = options.distributed_build;
     SET_BOOL_OPTION(use_saved_configs);
     if (!options.options_build.ide_copy_to_dir.empty())
         bs["build_ide_copy_to_dir"] = normalize_path(options.options_build.ide_copy_to_dir);
@@ -394,8 +400,13 @@ std::unique_ptr<sw::SwBuild> SwClientContext::createBuildInternal()
         bs["build_ide_fast_path"] = normalize_path(options.options_build.ide_fast_path);
     if (options.skip_errors)
         bs["skip_errors"] = std::to_string(options.skip_errors);
+    if (!options.scheduling.empty())
+        bs["scheduling"] = options.scheduling;
 
     SET_BOOL_OPTION(time_trace);
+    SET_BOOL_OPTION(progress);
+    if (!options.progress_status_file.empty())
+        bs["progress_status_file"] = normalize_path(options.progress_status_file);
     SET_BOOL_OPTION(show_output);
     SET_BOOL_OPTION(write_output_to_file);
 
@@ -10,8 +10,10 @@
 #include <sw/builder/execution_plan.h>
 #include <sw/builder/jumppad.h>
 #include <sw/manager/storage.h>
+#include <sw/support/filesystem.h>
 
 #include <boost/current_function.hpp>
+#include <boost/dll/runtime_symbol_info.hpp>
 #include <magic_enum.hpp>
 #include <nlohmann/json.hpp>
 #include <primitives/date_time.h>
@@ -106,6 +108,17 @@ static auto can_use_saved_configs(const SwBuild &b)
         ;
 }
 
+static bool use_plan_cache(const SwBuild &b)
+{
+    auto &s = b.getSettings();
+    return true
+        && s["plan_cache"] == "true"
+        && s["master_build"] == "true"
+        // these files are gathered from targets
+        && !s["build_ide_fast_path"].isValue()
+        ;
+}
+
 static std::unordered_map<UnresolvedPackage, PackageId> loadLockFile(const path &fn/*, SwContext &swctx*/)
 {
     auto j = nlohmann::json::parse(read_file(fn));
@@ -304,7 +317,9 @@ bool SwBuild::step()
         loadInputs();
         break;
     case BuildState::InputsLoaded:
-        setTargetsToBuild();
+        // unchanged build goes directly to execution
+        if (!runCachedExecutionPlan())
+            setTargetsToBuild();
         break;
     case BuildState::TargetsToBuildSet:
         resolvePackages();
@@ -750,6 +765,7 @@ void SwBuild::prepare()
 void SwBuild::execute() const
 {
     auto p = getExecutionPlan();
+    saveCachedExecutionPlan(*p);
     execute(*p);
 }
 
@@ -760,14 +776,34 @@ void SwBuild::execute(ExecutionPlan &p) const
     SwapAndRestore sr(current_explan, &p);
 
     p.build_always |= build_settings["build_always"] == "true";
+    p.content_hash |= build_settings["content_hash"] == "true";
+    p.action_cache |= build_settings["action_cache"] == "true";
+    if (build_settings["remote_cache"].isValue())
+        p.remote_cache = &getContext().getRemoteActionCache(build_settings["remote_cache"].getValue());
+    if (build_settings["distributed_build"].isValue())
+        p.remote_executor = &getContext().getRemoteExecutor(build_settings["distributed_build"].getValue());
     p.write_output_to_file |= build_settings["write_output_to_file"] == "true";
     if (build_settings["skip_errors"].isValue())
         p.skip_errors = std::stoll(build_settings["skip_errors"].getValue());
     if (build_settings["time_limit"].isValue())
         p.setTimeLimit(parseTimeLimit(build_settings["time_limit"].getValue()));
+    p.show_progress |= build_settings["progress"] == "true";
+    if (build_settings["progress_status_file"].isValue())
+        p.progress_status_file = build_settings["progress_status_file"].getValue();
+    if (build_settings["scheduling"].isValue())
+    {
+        auto &v = build_settings["scheduling"].getValue();
+        if (v == "critical_path")
+            p.scheduling = ExecutionPlan::SchedulingMode::CriticalPath;
+        else if (v == "fifo")
+            p.scheduling = ExecutionPlan::SchedulingMode::Fifo;
+        else
+            throw SW_RUNTIME_ERROR("Unknown scheduling mode: " + v);
+    }
 
     ScopedTime t;
     p.execute(getBuildExecutor());
+    getContext().saveFileStates();
     if (build_settings["measure"] == "true")
         LOG_DEBUG(logger, BOOST_CURRENT_FUNCTION << " time: " << t.getTimeFloat() << " s.");
 
@@ -1208,6 +1244,200 @@ void SwBuild::runSavedExecutionPlan(const path &in) const
     execute(*p);
 }
 
+path SwBuild::getPlanCachePath() const
+{
+    return getBuildDirectory() / "ep" / "cache" / getName() += ".swb";
+}
+
+static String getMtime(const path &p)
+{
+    return std::to_string(fs::last_write_time(p).time_since_epoch().count());
+}
+
+// mtime of directory is changed when its files are added or removed,
+// edited files do not change commands
+static String getDirectoryTimes(const FilesSorted &dirs)
+{
+    String s;
+    path prev;
+    for (auto &d : dirs)
+    {
+        // parents go first
+        if (!prev.empty() && std::mismatch(prev.begin(), prev.end(), d.begin(), d.end()).first == prev.end())
+            continue;
+        prev = d;
+
+        s += getMtime(d) + " " + normalize_path(d) + "\n";
+        for (auto i = fs::recursive_directory_iterator(d); i != fs::recursive_directory_iterator(); ++i)
+        {
+            // .sw, .git etc.
+            auto fn = i->path().filename().u8string();
+            if (!fn.empty() && fn[0] == '.')
+            {
+                i.disable_recursion_pending();
+                continue;
+            }
+            if (i->is_directory() && !i->is_symlink())
+                s += getMtime(i->path()) + " " + normalize_path(i->path()) + "\n";
+        }
+    }
+    return s;
+}
+
+// only saved directories are checked, so tree is not walked while nothing is changed
+static bool isPlanCacheKeyValid(const path &kfn, const String &key)
+{
+    if (!fs::exists(kfn))
+        return false;
+    auto lines = split_lines(read_file(kfn));
+    if (lines.empty() || lines[0] != key)
+        return false;
+    for (size_t i = 1; i < lines.size(); i++)
+    {
+        auto p = lines[i].find(' ');
+        if (p == lines[i].npos)
+            return false;
+        auto d = fs::u8path(lines[i].substr(p + 1));
+        error_code ec;
+        if (!fs::is_directory(d, ec) || getMtime(d) != lines[i].substr(0, p))
+            return false;
+    }
+    return true;
+}
+
+String SwBuild::getPlanCacheKey(FilesSorted &dirs) const
+{
+    String s;
+    s += getHash() + "\n"; // inputs and their settings
+    s += build_settings.toString() + "\n";
+    auto prog = path(boost::dll::program_location().wstring());
+    s += normalize_path(prog) + " " + getMtime(prog) + "\n";
+    // programs and their files are found using these
+    for (auto v : {
+        "PATH", "CC", "CXX", "CFLAGS", "CXXFLAGS", "CPPFLAGS", "LDFLAGS",
+        "CPATH", "LIBRARY_PATH", "PKG_CONFIG_PATH", "INCLUDE", "LIB", "LIBPATH",
+        "VSINSTALLDIR", "VCINSTALLDIR", "VCToolsInstallDir", "VisualStudioVersion",
+        "WindowsSdkDir", "WindowsSDKVersion", "UniversalCRTSdkDir", "UCRTVersion",
+        "SDKROOT", "DEVELOPER_DIR", "ANDROID_NDK_ROOT",
+        })
+    {
+        if (auto p = getenv(v))
+            s += v + "="s + p + "\n";
+    }
+    auto cfg = support::get_config_filename();
+    if (fs::exists(cfg))
+        s += read_file(cfg) + "\n";
+
+    // resolved packages
+    if (build_settings["lock_file"].isValue() && fs::exists(build_settings["lock_file"].getValue()))
+        s += read_file(build_settings["lock_file"].getValue()) + "\n";
+    auto db = getContext().getLocalStorage().getDatabaseRootDir();
+    for (auto &d : { db, db / "remote" })
+    {
+        if (!fs::exists(d))
+            continue;
+        for (auto &e : fs::directory_iterator(d))
+        {
+            auto f = e.path() / "packages.db";
+            if (fs::exists(f))
+                s += normalize_path(f) + " " + getMtime(f) + "\n";
+        }
+    }
+
+    // targets may take all files of their directories
+    for (auto &i : inputs)
+    {
+        auto &spec = i.getInput().getInput().getSpecification();
+        // only path of directory inputs is hashed
+        if (!spec.dir.empty())
+            return {};
+        for (auto &f : spec.getFiles())
+            dirs.insert(f.parent_path());
+    }
+
+    return blake2b_512(s);
+}
+
+bool SwBuild::runCachedExecutionPlan() const
+{
+    if (!use_plan_cache(*this))
+        return false;
+
+    FilesSorted dirs;
+    try
+    {
+        plan_cache_key = getPlanCacheKey(dirs);
+    }
+    catch (std::exception &e)
+    {
+        LOG_DEBUG(logger, "Cannot make execution plan cache key: " << e.what());
+        return false;
+    }
+    if (plan_cache_key.empty())
+        return false;
+
+    auto fn = getPlanCachePath();
+    auto kfn = path(fn) += ".key";
+    try
+    {
+        if (!isPlanCacheKeyValid(kfn, plan_cache_key))
+        {
+            // plan is saved when the same key is seen again,
+            // so one time configurations do not write their plans
+            error_code ec;
+            fs::remove(fn, ec);
+            write_file(kfn, plan_cache_key + "\n" + getDirectoryTimes(dirs));
+            plan_cache_key.clear();
+            return false;
+        }
+    }
+    catch (std::exception &e)
+    {
+        LOG_DEBUG(logger, "Cannot check execution plan cache key: " << e.what());
+        plan_cache_key.clear();
+        return false;
+    }
+    if (!fs::exists(fn))
+        return false;
+
+    std::unique_ptr<ExecutionPlan> p;
+    try
+    {
+        auto cmds = ExecutionPlan::load(fn, *this);
+        p = getExecutionPlan(cmds);
+        // plan keeps raw pointers
+        commands_storage.insert(cmds.begin(), cmds.end());
+    }
+    catch (std::exception &e)
+    {
+        LOG_DEBUG(logger, "Cannot load cached execution plan: " << e.what());
+        return false;
+    }
+
+    LOG_TRACE(logger, "build id " << this << " using cached execution plan " << fn);
+    // nothing to save
+    plan_cache_key.clear();
+    overrideBuildState(BuildState::Prepared);
+    execute(*p);
+    return true;
+}
+
+void SwBuild::saveCachedExecutionPlan(const ExecutionPlan &p) const
+{
+    if (plan_cache_key.empty())
+        return;
+
+    // key is written already, plan file is replaced at once
+    try
+    {
+        p.save(getPlanCachePath());
+    }
+    catch (std::exception &e)
+    {
+        LOG_DEBUG(logger, "Cannot save execution plan to cache: " << e.what());
+    }
+}
+
 const std::vector<InputWithSettings> &SwBuild::getInputs() const
 {
     return inputs;
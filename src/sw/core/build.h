@@ -77,6 +77,8 @@ struct SW_CORE_API SwBuild : SwBuilderContext
     std::unique_ptr<ExecutionPlan> getExecutionPlan() const;
     String getHash() const;
     path getExecutionPlanPath() const;
+    /// plan of the previous build, it is used while the key is the same
+    path getPlanCachePath() const;
 
     // tests
     void test();
@@ -117,8 +119,12 @@ private:
     // other data
     String name;
     mutable FilesSorted fast_path_files;
+    mutable String plan_cache_key; // empty when plan cache is not used
 
     Commands getCommands() const;
+    String getPlanCacheKey(FilesSorted &dirs) const;
+    bool runCachedExecutionPlan() const;
+    void saveCachedExecutionPlan(const ExecutionPlan &) const;
     void loadPackages(const TargetMap &predefined);
     void resolvePackages(const std::vector<IDependency*> &upkgs); // [2/2] step
     Executor &getBuildExecutor() const;
@@ -51,6 +51,11 @@ void Settings::load_main(const yaml &root, const SettingsType type)
     YAML_EXTRACT_AUTO(record_commands);
     YAML_EXTRACT_AUTO(record_commands_in_current_dir);
     YAML_EXTRACT(storage_dir, String);
+    YAML_EXTRACT_AUTO(action_cache_max_size);
+    YAML_EXTRACT_AUTO(command_log_sync_interval);
+    YAML_EXTRACT_AUTO(use_process_launcher);
+    YAML_EXTRACT_AUTO(use_file_watcher);
+    YAML_EXTRACT_AUTO(distributed_build_token);
 
     auto &p = root["proxy"];
     if (p.IsDefined())
@@ -243,6 +248,14 @@ void Settings::save(const path &p) const
     root["record_commands"] = record_commands;
     root["record_commands_in_current_dir"] = record_commands_in_current_dir;
 
+    root["action_cache_max_size"] = action_cache_max_size;
+
+    root["command_log_sync_interval"] = command_log_sync_interval;
+    root["use_process_launcher"] = use_process_launcher;
+    root["use_file_watcher"] = use_file_watcher;
+    if (!distributed_build_token.empty())
+        root["distributed_build_token"] = distributed_build_token;
+
     std::ofstream o(p);
     if (!o)
         throw SW_RUNTIME_ERROR("Cannot open file: " + p.string());
@@ -49,6 +49,25 @@ struct SW_MANAGER_API Settings
 
     String save_command_format;
 
+    // action cache
+    uint64_t action_cache_max_size = 5ULL * 1024 * 1024 * 1024;
+
+    // command db
+    // sync command logs to disk at most every N ms, 0 - leave it to OS
+    uint64_t command_log_sync_interval = 0;
+
+    // start processes with builtin launcher where it is supported,
+    // off until it is measured against primitives launcher on real builds
+    bool use_process_launcher = false;
+
+    // keep file states between runs while 'sw server --file-watcher' is running
+    bool use_file_watcher = false;
+
+    // distributed build
+    // shared secret of build servers and their clients,
+    // servers listening on non local endpoints require it
+    String distributed_build_token;
+
 public:
     Settings();
     ~Settings();
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+// command log writer microbenchmark
+// compares per record open/write/flush with batched LogWriter
+
+#include <sw/builder/log_writer.h>
+
+#include <primitives/sw/main.h>
+#include <primitives/sw/cl.h>
+
+#include <iostream>
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void report(const String &name, size_t n, double t, size_t writes)
+{
+    std::cout << name << ": " << n << " records in " << t << " s, "
+        << (size_t)(n / t) << " records/s, " << writes << " writes" << "\n";
+}
+
+int main(int argc, char **argv)
+{
+    static cl::opt<size_t> n_records("records", cl::desc("Number of records"), cl::init(1'000'000));
+    static cl::opt<size_t> record_size("record-size", cl::desc("Record size in bytes"), cl::init(100));
+    static cl::opt<int> n_threads("threads", cl::desc("Number of producer threads"), cl::init(std::thread::hardware_concurrency()));
+    static cl::opt<int> sync_interval("sync-interval", cl::desc("fdatasync interval in ms, 0 - no sync"), cl::init(0));
+    static cl::opt<bool> baseline("baseline", cl::desc("Also run per record open/write/flush (slow)"));
+    static cl::opt<path> dir("dir", cl::desc("Directory for log files"), cl::init(temp_directory_path() / "sw_command_log_bench"));
+
+    cl::ParseCommandLineOptions(argc, argv);
+
+    fs::create_directories(dir);
+    auto fn = dir / "cmd_log.bin";
+    error_code ec;
+    fs::remove(fn, ec);
+
+    std::vector<uint8_t> record(record_size, 0x5a);
+    auto threads = std::max(1, (int)n_threads);
+
+    if (baseline)
+    {
+        auto start = Clock::now();
+        for (size_t i = 0; i < n_records; i++)
+        {
+            // old log: file is reopened and flushed for every record
+            ScopedFile f(fn, "ab");
+            auto sz = record.size();
+            fwrite(&sz, sizeof(sz), 1, f.getHandle());
+            fwrite(record.data(), record.size(), 1, f.getHandle());
+            fflush(f.getHandle());
+        }
+        report("per record", n_records, seconds(start), n_records);
+        fs::remove(fn, ec);
+    }
+
+    {
+        sw::LogWriter::Options o;
+        o.sync_interval = std::chrono::milliseconds(sync_interval);
+        auto start = Clock::now();
+        size_t writes;
+        {
+            sw::LogWriter w(o);
+            auto id = w.addFile(fn);
+            std::vector<std::thread> producers;
+            for (int t = 0; t < threads; t++)
+            {
+                producers.emplace_back([&, t]
+                {
+                    for (size_t i = t; i < n_records; i += threads)
+                    {
+                        w.push([&record, id](sw::LogWriter::Context &ctx)
+                        {
+                            ctx.append(id, record.size());
+                            ctx.append(id, record.data(), record.size());
+                        });
+                    }
+                });
+            }
+            for (auto &p : producers)
+                p.join();
+            w.flush();
+            writes = w.getNumberOfWrites();
+        }
+        report("log writer", n_records, seconds(start), writes);
+
+        auto expected = n_records * (record_size + sizeof(size_t));
+        if (fs::file_size(fn) != expected)
+        {
+            std::cerr << "Bad log size: " << fs::file_size(fn) << ", expected " << expected << "\n";
+            return 1;
+        }
+    }
+
+    fs::remove(fn, ec);
+    return 0;
+}
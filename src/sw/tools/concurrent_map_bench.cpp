@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+// concurrent map microbenchmark
+// compares old junction leapfrog map with values allocated by new (file and command storages before)
+// with sharded ConcurrentMap on insert, find and full iteration
+
+#include <sw/builder/concurrent_map.h>
+
+#include <junction/ConcurrentMap_Leapfrog.h>
+#include <primitives/string.h>
+#include <primitives/sw/main.h>
+#include <primitives/sw/cl.h>
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+using Value = std::atomic<uint64_t>;
+
+// like old storages: 0 is reserved, values are never freed
+struct LeapfrogMap
+{
+    junction::ConcurrentMap_Leapfrog<size_t, Value *> map;
+
+    Value *insert(size_t k)
+    {
+        auto i = map.insertOrFind(k);
+        auto value = i.getValue();
+        if (!value)
+        {
+            value = new Value(0);
+            if (auto old = i.exchangeValue(value))
+            {
+                delete value;
+                return old;
+            }
+        }
+        return value;
+    }
+
+    Value *find(size_t k)
+    {
+        return map.get(k);
+    }
+
+    uint64_t sum()
+    {
+        uint64_t s = 0;
+        for (junction::ConcurrentMap_Leapfrog<size_t, Value *>::Iterator i(map); i.isValid(); i.next())
+            s += *i.getValue();
+        return s;
+    }
+};
+
+struct ShardedMap
+{
+    sw::ConcurrentMap<size_t, Value> map;
+
+    Value *insert(size_t k)
+    {
+        return map.insert(k).first;
+    }
+
+    Value *find(size_t k)
+    {
+        return map.find(k);
+    }
+
+    uint64_t sum()
+    {
+        uint64_t s = 0;
+        for (auto &[k, v] : map.snapshot())
+            s += *v;
+        return s;
+    }
+};
+
+static double seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+template <class F>
+static double run(int threads, F &&f)
+{
+    auto start = Clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.emplace_back([&f, t] { f(t); });
+    for (auto &w : workers)
+        w.join();
+    return seconds(start);
+}
+
+static void report(const String &name, const String &op, size_t n, double t)
+{
+    std::cout << name << ", " << op << ": " << n << " in " << t << " s, "
+        << (size_t)(n / t) << " ops/s" << "\n";
+}
+
+template <class Map>
+static int bench(const String &name, const std::vector<size_t> &keys, int threads, int iterations)
+{
+    Map m;
+
+    // threads insert all keys from their own offsets, so most inserts find existing keys
+    auto t = run(threads, [&](int t)
+    {
+        for (size_t i = 0; i < keys.size(); i++)
+            (*m.insert(keys[(i + t * 7919) % keys.size()]))++;
+    });
+    report(name, "insert", keys.size() * threads, t);
+
+    t = run(threads, [&](int t)
+    {
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            if (!m.find(keys[(i + t * 7919) % keys.size()]))
+                throw SW_RUNTIME_ERROR("Key is not found");
+        }
+    });
+    report(name, "find", keys.size() * threads, t);
+
+    std::atomic<uint64_t> bad{ 0 };
+    t = run(threads, [&](int)
+    {
+        for (int i = 0; i < iterations; i++)
+        {
+            if (m.sum() != keys.size() * threads)
+                bad++;
+        }
+    });
+    report(name, "iterate", keys.size() * threads * iterations, t);
+
+    if (bad)
+    {
+        std::cerr << name << ": bad sums: " << bad << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static cl::opt<size_t> n_keys("keys", cl::desc("Number of distinct keys"), cl::init(500'000));
+    static cl::opt<int> n_iterations("iterations", cl::desc("Full iterations per thread"), cl::init(4));
+    static cl::opt<int> n_threads("threads", cl::desc("Number of threads"), cl::init(32));
+
+    cl::ParseCommandLineOptions(argc, argv);
+
+    // file and command hashes, 0 is not allowed by the old map
+    std::vector<size_t> keys;
+    for (size_t i = 0; i < n_keys; i++)
+        keys.push_back(std::hash<String>()("/usr/include/dir" + std::to_string(i % 100) + "/header" + std::to_string(i) + ".h") | 1);
+    auto threads = std::max(1, (int)n_threads);
+
+    int r = 0;
+    r |= bench<LeapfrogMap>("leapfrog", keys, threads, n_iterations);
+    r |= bench<ShardedMap>("sharded", keys, threads, n_iterations);
+    return r;
+}
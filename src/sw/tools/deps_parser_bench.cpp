@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+// dependency list parsing microbenchmark
+// compares token copying parsers (previous command.cpp code) with deps_parser.h scanners
+
+#include <sw/builder/deps_parser.h>
+
+#include <boost/algorithm/string.hpp>
+#include <primitives/sw/main.h>
+#include <primitives/sw/cl.h>
+
+#include <deque>
+#include <iostream>
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void report(const String &name, size_t n, size_t bytes, double t)
+{
+    std::cout << name << ": " << n << " parses in " << t << " s, "
+        << (size_t)(n / t) << " parses/s, " << (size_t)(n * bytes / t / 1024 / 1024) << " MB/s" << "\n";
+}
+
+static Files parse_gnu_old(String f)
+{
+    f = f.substr(f.find(": ") + 1);
+
+    FilesOrdered files;
+    enum
+    {
+        EMPTY,
+        FILE,
+    };
+    int state = EMPTY;
+    auto p = f.c_str();
+    auto begin = p;
+    while (*p)
+    {
+        switch (state)
+        {
+        case EMPTY:
+            if (isspace(*p) || *p == '\\')
+                break;
+            state = FILE;
+            begin = p;
+            break;
+        case FILE:
+            if (!isspace(*p))
+                break;
+            if (*(p - 1) == '\\')
+                break;
+            String s(begin, p);
+            if (!s.empty())
+            {
+                boost::replace_all(s, "\\ ", " ");
+                if (boost::ends_with(s, "\\\n"))
+                    s.resize(s.size() - 2);
+                files.push_back(fs::u8path(s));
+            }
+            state = EMPTY;
+            break;
+        }
+        p++;
+    }
+
+    Files deps;
+    for (auto &f : files)
+        deps.insert(f);
+    return deps;
+}
+
+static Files parse_msvc_old(String text, const String &prefix)
+{
+    Files deps;
+    std::deque<String> lines;
+    boost::split(lines, text, boost::is_any_of("\n"));
+    text.clear();
+    lines.pop_front();
+    for (auto &line : lines)
+    {
+        if (line.find(prefix) != 0)
+        {
+            text += line + "\n";
+            continue;
+        }
+        auto include = line.substr(prefix.size());
+        boost::trim(include);
+        deps.insert(include);
+    }
+    return deps;
+}
+
+int main(int argc, char **argv)
+{
+    static cl::opt<path> deps_file("file", cl::desc("Real .d file, generated one is used by default"));
+    static cl::opt<size_t> n_headers("headers", cl::desc("Number of headers in generated lists"), cl::init(2500));
+    static cl::opt<size_t> n_parses("parses", cl::desc("Number of parses"), cl::init(1000));
+
+    cl::ParseCommandLineOptions(argc, argv);
+
+    String gnu, msvc;
+    const String prefix = "Note: including file:";
+    if (!deps_file.empty())
+        gnu = read_file(deps_file);
+    else
+    {
+        gnu = "/home/user/project/.sw/out/obj/source.cpp.o: /home/user/project/src/source.cpp";
+        for (size_t i = 0; i < n_headers; i++)
+        {
+            gnu += " \\\n  /usr/include/c++/9/some_library/detail/header_number_" + std::to_string(i) + ".hpp";
+            if (i % 500 == 0)
+                gnu += " /home/user/project/dir\\ with\\ spaces/h" + std::to_string(i) + ".h";
+        }
+        gnu += "\n";
+    }
+    msvc = "source.cpp\n";
+    for (size_t i = 0; i < n_headers; i++)
+    {
+        msvc += prefix + " " + String(i % 8, ' ') + "C:\\Program Files (x86)\\Microsoft Visual Studio\\VC\\include\\header_number_" + std::to_string(i) + ".h\r\n";
+        if (i % 1000 == 0)
+            msvc += "source.cpp(10): warning C4996: something is deprecated\r\n";
+    }
+
+    // same files from both parsers
+    {
+        Files deps;
+        sw::parse_deps_gnu(gnu, [&deps](std::string_view p) { deps.insert(fs::u8path(p.begin(), p.end())); });
+        if (deps != parse_gnu_old(gnu))
+        {
+            std::cerr << "gnu parsers do not match" << "\n";
+            return 1;
+        }
+        deps.clear();
+        auto text = msvc;
+        sw::parse_deps_msvc(text, prefix, true, [&deps](std::string_view p) { deps.insert(fs::u8path(p.begin(), p.end())); });
+        if (deps != parse_msvc_old(msvc, prefix))
+        {
+            std::cerr << "msvc parsers do not match" << "\n";
+            return 1;
+        }
+    }
+
+    size_t x = 0;
+    {
+        auto start = Clock::now();
+        for (size_t i = 0; i < n_parses; i++)
+            x += parse_gnu_old(gnu).size();
+        report("gnu old", n_parses, gnu.size(), seconds(start));
+    }
+    {
+        auto start = Clock::now();
+        for (size_t i = 0; i < n_parses; i++)
+            sw::parse_deps_gnu(gnu, [&x](std::string_view p) { x += p.size(); });
+        report("gnu scanner", n_parses, gnu.size(), seconds(start));
+    }
+    {
+        auto start = Clock::now();
+        for (size_t i = 0; i < n_parses; i++)
+            x += parse_msvc_old(msvc, prefix).size();
+        report("msvc old", n_parses, msvc.size(), seconds(start));
+    }
+    {
+        auto start = Clock::now();
+        for (size_t i = 0; i < n_parses; i++)
+        {
+            auto text = msvc; // output is modified in place
+            sw::parse_deps_msvc(text, prefix, true, [&x](std::string_view p) { x += p.size(); });
+        }
+        report("msvc scanner", n_parses, msvc.size(), seconds(start));
+    }
+    return x == 0;
+}
@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+// execution plan file microbenchmark
+// compares boost text archive with strings of commands saved one by one (old plans)
+// with ExecutionPlanFile on size, save and load of synthetic compile and link commands
+
+#include <sw/builder/execution_plan_file.h>
+
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
+#include <primitives/sw/main.h>
+#include <primitives/sw/cl.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void report(const String &name, const String &op, size_t n, double t)
+{
+    std::cout << name << ", " << op << ": " << n << " commands in " << t << " s, "
+        << (size_t)(n / t) << " commands/s" << "\n";
+}
+
+static void add(Strings &s, const Files &files)
+{
+    // sets are compared after load, so order must be the same
+    auto first = s.size();
+    for (auto &f : files)
+        s.push_back(f.u8string());
+    std::sort(s.begin() + first, s.end());
+}
+
+// everything the old archive wrote as separate strings
+static Strings toStrings(const sw::builder::Command &c)
+{
+    Strings s;
+    s.push_back(c.name);
+    s.push_back(c.working_directory.u8string());
+    for (auto &a : c.arguments)
+        s.push_back(a->toString());
+    s.push_back(c.deps_file.u8string());
+    add(s, c.inputs);
+    add(s, c.outputs);
+    return s;
+}
+
+int main(int argc, char **argv)
+{
+    static cl::opt<size_t> n_commands("commands", cl::desc("Number of compile commands"), cl::init(100'000));
+    static cl::opt<size_t> n_objects("objects", cl::desc("Objects per link command"), cl::init(100));
+    static cl::opt<size_t> n_include_dirs("include-dirs", cl::desc("Include directories per command"), cl::init(30));
+    static cl::opt<path> dir("dir", cl::desc("Directory for plan files"), cl::init(temp_directory_path() / "sw_execution_plan_bench"));
+
+    cl::ParseCommandLineOptions(argc, argv);
+
+    const auto objects = std::max<size_t>(1, n_objects);
+    const path root = "/home/user/project";
+    const path bdir = root / ".sw" / "out" / "linux_x86_64_gcc_shared_release";
+
+    // targets share compiler, flags and include directories
+    std::vector<std::shared_ptr<sw::builder::Command>> storage;
+    std::vector<sw::builder::Command *> commands;
+    std::shared_ptr<sw::builder::Command> link;
+    for (size_t i = 0; i < n_commands; i++)
+    {
+        auto target = std::to_string(i / objects);
+        auto src = root / "src" / ("target" + target) / ("file" + std::to_string(i) + ".cpp");
+        auto obj = bdir / ("target" + target) / ("file" + std::to_string(i) + ".o");
+
+        auto c = std::make_shared<sw::builder::Command>();
+        c->name = "[target" + target + "]/" + src.filename().u8string();
+        c->working_directory = bdir;
+        c->environment["LANG"] = "C";
+        c->arguments.push_back("/usr/bin/g++");
+        c->arguments.push_back("-c");
+        c->arguments.push_back("-O2");
+        c->arguments.push_back("-std=c++17");
+        c->arguments.push_back("-DTARGET" + target);
+        for (size_t j = 0; j < n_include_dirs; j++)
+            c->arguments.push_back("-I" + (root / "include" / ("dir" + std::to_string(j))).u8string());
+        c->arguments.push_back("-o");
+        c->arguments.push_back(obj.u8string());
+        c->arguments.push_back(src.u8string());
+        c->deps_processor = sw::builder::Command::DepsProcessor::Gnu;
+        c->deps_file = path(obj) += ".d";
+        c->inputs.insert(src);
+        c->outputs.insert(obj);
+
+        if (i % objects == 0)
+        {
+            link = std::make_shared<sw::builder::Command>();
+            link->name = "[target" + target + "]/link";
+            link->working_directory = bdir;
+            link->arguments.push_back("/usr/bin/g++");
+            link->arguments.push_back("-shared");
+            link->arguments.push_back("-o");
+            link->arguments.push_back((bdir / ("libtarget" + target + ".so")).u8string());
+            link->outputs.insert(bdir / ("libtarget" + target + ".so"));
+            storage.push_back(link);
+            commands.push_back(link.get());
+        }
+        link->arguments.push_back(obj.u8string());
+        link->inputs.insert(obj);
+        link->dependencies.insert(c);
+
+        storage.push_back(c);
+        commands.push_back(c.get());
+    }
+
+    fs::create_directories(dir);
+    const auto n = commands.size();
+    int r = 0;
+
+    {
+        auto fn = dir / "plan.txt";
+        auto start = Clock::now();
+        {
+            std::ofstream ofs(fn);
+            boost::archive::text_oarchive ar(ofs);
+            std::vector<Strings> v;
+            v.reserve(n);
+            for (auto c : commands)
+                v.push_back(toStrings(*c));
+            ar << v;
+        }
+        report("text archive", "save", n, seconds(start));
+
+        start = Clock::now();
+        std::vector<Strings> v;
+        {
+            std::ifstream ifs(fn);
+            boost::archive::text_iarchive ar(ifs);
+            ar >> v;
+        }
+        report("text archive", "load", n, seconds(start));
+        std::cout << "text archive, size: " << fs::file_size(fn) << " bytes" << "\n";
+    }
+
+    {
+        auto fn = dir / "plan.swb";
+        auto start = Clock::now();
+        sw::ExecutionPlanFile::write(fn, root, commands);
+        report("plan file", "save", n, seconds(start));
+
+        start = Clock::now();
+        sw::ExecutionPlanFile f(fn);
+        std::cout << "plan file, open: " << seconds(start) << " s, "
+            << f.getNumberOfStrings() << " strings" << "\n";
+
+        // lazy: one command of a big plan
+        start = Clock::now();
+        auto c = f.getCommand(n / 2);
+        std::cout << "plan file, one command: " << seconds(start) << " s" << "\n";
+        if (toStrings(*c) != toStrings(*commands[n / 2]))
+        {
+            std::cerr << "plan file: bad command " << n / 2 << "\n";
+            r = 1;
+        }
+
+        start = Clock::now();
+        size_t deps = 0;
+        for (size_t i = 0; i < f.getNumberOfCommands(); i++)
+        {
+            f.getCommand(i);
+            deps += f.getNumberOfDependencies(i);
+        }
+        report("plan file", "load", n, seconds(start));
+        std::cout << "plan file, size: " << fs::file_size(fn) << " bytes" << "\n";
+        if (deps != n_commands)
+        {
+            std::cerr << "plan file: bad number of dependencies " << deps << "\n";
+            r = 1;
+        }
+    }
+
+    return r;
+}
@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+// execution plan construction microbenchmark
+// measures ExecutionPlan::init() (topological ordering and setup) on random DAGs of 10k, 100k and 1M nodes,
+// optionally compares ordering with the old repeated scans of remaining commands
+
+#include <sw/builder/execution_plan.h>
+
+#include <primitives/sw/main.h>
+#include <primitives/sw/cl.h>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+
+using Clock = std::chrono::steady_clock;
+
+struct Node : sw::CommandNode
+{
+    size_t id = 0;
+
+    String getName(bool) const override { return std::to_string(id); }
+    size_t getHash() const override { return id; }
+    void execute() override {}
+    void prepare() override {}
+    bool lessDuringExecution(const CommandNode &) const override { return false; }
+};
+
+static double seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void report(const String &name, size_t n, size_t edges, double t)
+{
+    std::cout << name << ": " << n << " nodes, " << edges << " edges in " << t << " s, "
+        << (size_t)(n / t) << " nodes/s" << "\n";
+}
+
+// old ordering: scan remaining commands until none can be added
+static size_t scan_order(sw::ExecutionPlan::USet cmds)
+{
+    size_t n = 0;
+    while (!cmds.empty())
+    {
+        bool added = false;
+        for (auto it = cmds.begin(); it != cmds.end();)
+        {
+            auto deps = std::count_if((*it)->dependencies.begin(), (*it)->dependencies.end(),
+                [&cmds](auto &d) { return cmds.find(d.get()) != cmds.end(); });
+            if (deps)
+            {
+                it++;
+                continue;
+            }
+            added = true;
+            n++;
+            it = cmds.erase(it);
+        }
+        if (!added)
+            break;
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    static cl::opt<size_t> max_nodes("max-nodes", cl::desc("Largest graph size"), cl::init(1'000'000));
+    static cl::opt<int> n_deps("deps", cl::desc("Maximum number of dependencies per node"), cl::init(8));
+    static cl::opt<size_t> window("window", cl::desc("Dependencies are taken from this many previous nodes"), cl::init(1000));
+    static cl::opt<bool> baseline("baseline", cl::desc("Also run old ordering by repeated scans (slow)"));
+
+    cl::ParseCommandLineOptions(argc, argv);
+
+    int r = 0;
+    for (size_t n = 10'000; n <= max_nodes; n *= 10)
+    {
+        // like compile commands feeding into links of nearby targets
+        std::mt19937_64 g(n);
+        std::vector<std::shared_ptr<Node>> nodes(n);
+        size_t edges = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            nodes[i] = std::make_shared<Node>();
+            nodes[i]->id = i;
+            if (i == 0)
+                continue;
+            auto k = g() % (n_deps + 1);
+            for (size_t j = 0; j < k; j++)
+            {
+                auto d = i - 1 - g() % std::min<size_t>(i, std::max<size_t>(1, window));
+                edges += nodes[i]->dependencies.insert(nodes[d]).second;
+            }
+        }
+
+        sw::ExecutionPlan::USet cmds;
+        cmds.reserve(n);
+        for (auto &c : nodes)
+            cmds.insert(c.get());
+
+        if (baseline)
+        {
+            auto start = Clock::now();
+            auto sorted = scan_order(cmds);
+            report("scans", n, edges, seconds(start));
+            if (sorted != n)
+            {
+                std::cerr << "scans: ordered " << sorted << " of " << n << "\n";
+                r = 1;
+            }
+        }
+
+        auto start = Clock::now();
+        sw::ExecutionPlan p(cmds);
+        report("init", n, edges, seconds(start));
+        if (!p.isValid() || p.getCommands().size() != n)
+        {
+            std::cerr << "init: ordered " << p.getCommands().size() << " of " << n << "\n";
+            r = 1;
+        }
+    }
+    return r;
+}
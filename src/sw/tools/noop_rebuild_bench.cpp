@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+// no-op rebuild benchmark
+// executes a plan of up to date commands (100k by default) with and without
+// parallel outdated check before execution (ExecutionPlan::prefetch_file_info)
+
+#include <sw/builder/command_storage.h>
+#include <sw/builder/execution_plan.h>
+#include <sw/builder/sw_context.h>
+
+#include <primitives/executor.h>
+#include <primitives/sw/main.h>
+#include <primitives/sw/cl.h>
+
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static path source(const path &dir, size_t i)
+{
+    return dir / "src" / ("dir" + std::to_string(i / 1000)) / ("file" + std::to_string(i) + ".cpp");
+}
+
+static path object(const path &dir, size_t i)
+{
+    return dir / "obj" / ("dir" + std::to_string(i / 1000)) / ("file" + std::to_string(i) + ".o");
+}
+
+static void touch(const path &p)
+{
+    fs::create_directories(p.parent_path());
+    std::ofstream(p) << p.filename().u8string();
+}
+
+static int bench(const String &name, const path &dir, size_t n, int threads, bool prefetch)
+{
+    // fresh context, nothing is known about files
+    sw::SwBuilderContext swctx;
+    auto &cs = swctx.getCommandStorage(dir / "cs");
+
+    sw::Commands cmds;
+    cmds.reserve(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        auto c = std::make_shared<sw::builder::Command>(swctx);
+        c->arguments.push_back("true");
+        c->arguments.push_back(source(dir, i));
+        c->arguments.push_back(object(dir, i));
+        c->inputs.insert(source(dir, i));
+        c->outputs.insert(object(dir, i));
+        c->command_storage = &cs;
+        c->silent = true;
+        cmds.insert(c);
+    }
+    auto p = sw::ExecutionPlan::create(cmds);
+    p->prefetch_file_info = prefetch;
+
+    // previous build: everything is older than records
+    auto now = fs::file_time_type::clock::now();
+    for (auto &c : p->getCommands())
+    {
+        auto &r = *cs.insert(c->getHash()).first;
+        r.hash = c->getHash();
+        r.mtime = now;
+    }
+
+    Executor e(threads);
+    auto start = Clock::now();
+    p->execute(e);
+    auto t = seconds(start);
+
+    size_t executed = 0;
+    for (auto &c : p->getCommands())
+        executed += !static_cast<sw::builder::Command *>(c)->isUpToDate();
+    std::cout << name << ": " << n << " commands in " << t << " s, "
+        << (size_t)(n / t) << " commands/s, " << executed << " executed" << "\n";
+    if (executed)
+    {
+        std::cerr << name << ": commands are not up to date" << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static cl::opt<size_t> n_commands("commands", cl::desc("Number of commands"), cl::init(100'000));
+    static cl::opt<int> n_threads("threads", cl::desc("Number of executor threads"), cl::init(std::thread::hardware_concurrency()));
+    static cl::opt<path> dir("dir", cl::desc("Directory for files of commands"), cl::init(temp_directory_path() / "sw_noop_rebuild_bench"));
+
+    cl::ParseCommandLineOptions(argc, argv);
+
+    // sources first, so objects are newer
+    error_code ec;
+    fs::remove_all(dir, ec);
+    for (size_t i = 0; i < n_commands; i++)
+        touch(source(dir, i));
+    for (size_t i = 0; i < n_commands; i++)
+        touch(object(dir, i));
+
+    auto threads = std::max(1, (int)n_threads);
+    int r = 0;
+    r |= bench("sequential check", dir, n_commands, threads, false);
+    r |= bench("parallel check", dir, n_commands, threads, true);
+    return r;
+}
@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+// path interning microbenchmark
+// compares one map under upgrade mutex (old command storage files) with sharded PathTable
+
+#include <sw/builder/path_table.h>
+
+#include <boost/thread/lock_types.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <primitives/sw/main.h>
+#include <primitives/sw/cl.h>
+
+#include <iostream>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void report(const String &name, size_t n, double t)
+{
+    std::cout << name << ": " << n << " lookups in " << t << " s, "
+        << (size_t)(n / t) << " lookups/s" << "\n";
+}
+
+template <class F>
+static double run(int threads, F &&f)
+{
+    auto start = Clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.emplace_back([&f, t] { f(t); });
+    for (auto &w : workers)
+        w.join();
+    return seconds(start);
+}
+
+int main(int argc, char **argv)
+{
+    static cl::opt<size_t> n_paths("paths", cl::desc("Number of distinct paths"), cl::init(100'000));
+    static cl::opt<size_t> n_lookups("lookups", cl::desc("Lookups per thread"), cl::init(2'000'000));
+    static cl::opt<int> n_threads("threads", cl::desc("Number of threads"), cl::init(std::thread::hardware_concurrency()));
+
+    cl::ParseCommandLineOptions(argc, argv);
+
+    std::vector<String> paths;
+    std::vector<size_t> hashes;
+    for (size_t i = 0; i < n_paths; i++)
+    {
+        paths.push_back("/usr/include/dir" + std::to_string(i % 100) + "/header" + std::to_string(i) + ".h");
+        hashes.push_back(std::hash<String>()(paths.back()));
+    }
+    auto threads = std::max(1, (int)n_threads);
+    auto total = n_lookups * threads;
+    size_t n_interned;
+
+    // every thread walks all paths from its own offset, so first passes also insert
+    {
+        boost::upgrade_mutex m;
+        std::unordered_map<size_t, path> files;
+        auto t = run(threads, [&](int t)
+        {
+            for (size_t i = 0; i < n_lookups; i++)
+            {
+                auto j = (i + t * 7919) % paths.size();
+                boost::upgrade_lock lk(m);
+                auto it = files.find(hashes[j]);
+                if (it == files.end())
+                {
+                    boost::upgrade_to_unique_lock lk2(lk);
+                    files[hashes[j]] = fs::u8path(paths[j]);
+                }
+            }
+        });
+        report("upgrade mutex", total, t);
+        n_interned = files.size();
+    }
+
+    {
+        sw::PathTable table;
+        auto t = run(threads, [&](int t)
+        {
+            for (size_t i = 0; i < n_lookups; i++)
+            {
+                auto j = (i + t * 7919) % paths.size();
+                auto id = table.intern(hashes[j], paths[j]);
+                if (table.getHash(id) != hashes[j])
+                    throw SW_RUNTIME_ERROR("Bad path id");
+            }
+        });
+        report("path table", total, t);
+
+        if (table.size() != n_interned)
+        {
+            std::cerr << "Bad number of paths: " << table.size() << ", expected " << n_interned << "\n";
+            return 1;
+        }
+    }
+
+    return 0;
+}
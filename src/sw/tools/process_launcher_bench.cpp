@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright (C) 2020 Egor Pugin <egor.pugin@gmail.com>
+
+// process launch microbenchmark
+// compares primitives::Command::execute() with ProcessLauncher
+
+#include <sw/builder/process_launcher.h>
+
+#include <primitives/sw/main.h>
+#include <primitives/sw/cl.h>
+
+#include <iostream>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void report(const String &name, size_t n, double t)
+{
+    std::cout << name << ": " << n << " launches in " << t << " s, "
+        << (size_t)(n / t) << " launches/s" << "\n";
+}
+
+template <class F>
+static double run(int threads, F &&f)
+{
+    auto start = Clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.emplace_back([&f] { f(); });
+    for (auto &w : workers)
+        w.join();
+    return seconds(start);
+}
+
+int main(int argc, char **argv)
+{
+    static cl::opt<String> program("program", cl::desc("Program to start, it is resolved through PATH"), cl::init("echo"));
+    static cl::opt<size_t> n_launches("launches", cl::desc("Launches per thread"), cl::init(2'000));
+    static cl::opt<int> n_threads("threads", cl::desc("Number of threads"), cl::init(std::thread::hardware_concurrency()));
+
+    cl::ParseCommandLineOptions(argc, argv);
+
+    if (!sw::ProcessLauncher::isSupported())
+    {
+        std::cerr << "process launcher is not supported on this platform" << "\n";
+        return 1;
+    }
+
+    auto threads = std::max(1, (int)n_threads);
+    auto total = n_launches * threads;
+    Strings args{ program, "-n", "some output" };
+
+    // resolving is a part of the old path, every command resolves its program
+    {
+        auto t = run(threads, [&]
+        {
+            for (size_t i = 0; i < n_launches; i++)
+            {
+                primitives::Command c;
+                c.setProgram(primitives::resolve_executable(program.getValue()));
+                for (size_t j = 1; j < args.size(); j++)
+                    c.push_back(args[j]);
+                c.execute();
+            }
+        });
+        report("primitives", total, t);
+    }
+
+    {
+        sw::ProcessLauncher l;
+        std::atomic<size_t> failed = 0;
+        auto t = run(threads, [&]
+        {
+            for (size_t i = 0; i < n_launches; i++)
+            {
+                primitives::Command c;
+                c.setProgram(l.resolveProgram(program.getValue()));
+                sw::ArgvBuilder argv(args);
+                std::error_code ec;
+                if (!l.execute(c, argv, ec) || ec || c.out.text != args[2])
+                    failed++;
+            }
+        });
+        report("process launcher", total, t);
+        if (failed)
+        {
+            std::cerr << failed << " launches failed" << "\n";
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -117,8 +117,8 @@ void build(Solution &s)
         builder += cpp17;
         builder += "src/sw/builder/.*"_rr;
         builder.Public += manager,
-            "org.sw.demo.preshing.junction-master"_dep,
             "org.sw.demo.boost.graph"_dep,
+            "org.sw.demo.boost.interprocess"_dep,
             "org.sw.demo.boost.serialization"_dep,
             "org.sw.demo.microsoft.gsl"_dep,
             "pub.egorpugin.primitives.emitter-master"_dep;
@@ -139,6 +139,25 @@ void build(Solution &s)
         builder_distributed.Public += builder;
     }
 
+    // benchmarks of builder internals
+    auto add_bench = [&builder](const String &name) -> ExecutableTarget &
+    {
+        auto &t = builder.addTarget<ExecutableTarget>("tools." + name);
+        t += cpp17;
+        t += path("src/sw/tools") / (name + ".cpp");
+        t += builder;
+        t += "pub.egorpugin.primitives.sw.main-master"_dep;
+        return t;
+    };
+    add_bench("command_log_bench");
+    add_bench("path_table_bench");
+    add_bench("process_launcher_bench");
+    add_bench("deps_parser_bench");
+    add_bench("concurrent_map_bench") += "org.sw.demo.preshing.junction-master"_dep;
+    add_bench("execution_plan_bench");
+    add_bench("execution_plan_init_bench");
+    add_bench("noop_rebuild_bench");
+
     auto &core = p.addTarget<LibraryTarget>("core");
     {
         core.ApiName = "SW_CORE_API";
@@ -356,6 +375,19 @@ void build(Solution &s)
         add_build_test_with_configs("cpp/static");
         add_build_test_with_configs("cpp/multiconf");
         add_build_test_with_configs("cpp/pch");
+
+        // on disk formats of builder
+        auto add_unit_test = [&builder](const String &name)
+        {
+            auto &t = builder.addTarget<ExecutableTarget>("test.unit." + name);
+            t += cpp17;
+            t += path("test/unit") / (name + ".cpp");
+            t += builder;
+            t += "org.sw.demo.catchorg.catch2-2"_dep;
+            builder.addTest(t);
+        };
+        add_unit_test("command_db");
+        add_unit_test("execution_plan_file");
     }
 
     auto &sp = sw.addProject("server");
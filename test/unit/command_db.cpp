@@ -0,0 +1,77 @@
+#include <sw/builder/command_db.h>
+#include <sw/builder/sw_context.h>
+
+#include <primitives/filesystem.h>
+
+#include <fstream>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+// base file of older version with the same layout
+static void write_old_db(const path &root, uint32_t version, detail::Storage &s)
+{
+    auto fn = root / "db" / std::to_string(version) / "commands.db";
+    CommandDb::write(fn, nullptr, s);
+    std::fstream f(fn, std::ios::in | std::ios::out | std::ios::binary);
+    f.seekp(offsetof(CommandDb::Header, version));
+    f.write((const char *)&version, sizeof(version));
+}
+
+TEST_CASE("Conversion of old command db", "[command_db]")
+{
+    for (uint32_t version = COMMAND_DB_OLDEST_CONVERTED_FORMAT_VERSION; version < COMMAND_DB_FORMAT_VERSION; version++)
+    {
+        auto root = temp_directory_path() / "sw_test_command_db" / unique_path();
+        Files deps{ root / "src" / "a.h", root / "src" / "b.h", root / "include" / "c.h" };
+        const size_t hash = 12345;
+        auto mtime = fs::file_time_type::clock::now();
+
+        {
+            detail::Storage s;
+            s.std_hashes = true;
+            auto &r = *s.storage.insert(hash).first;
+            r.hash = hash;
+            r.mtime = mtime;
+            r.inputs_hash = 1;
+            r.setImplicitInputs(deps, s);
+            r.addExecution({ 100, 1000, 0 });
+            write_old_db(root, version, s);
+        }
+
+        {
+            SwBuilderContext swctx;
+            auto &cs = swctx.getCommandStorage(root);
+            REQUIRE_FALSE(fs::exists(root / "db" / std::to_string(version)));
+            REQUIRE(fs::exists(root / "db" / std::to_string(COMMAND_DB_FORMAT_VERSION) / "commands.db"));
+
+            auto r = cs.find(hash);
+            REQUIRE(r);
+            CHECK(r->mtime == mtime);
+            // content hashes are dropped
+            CHECK(r->inputs_hash == 0);
+            REQUIRE(r->history.size() == 1);
+            CHECK(r->history[0].duration == 100);
+            CHECK(r->history[0].peak_rss == 1000);
+
+            // paths are found by new hashes
+            auto &s = cs.getInternalStorage();
+            CHECK(r->getImplicitInputs(s) == deps);
+            auto hashes = r->implicit_inputs.get();
+            for (auto &d : deps)
+                CHECK(std::count(hashes.begin(), hashes.end(), s.getPathHash(normalize_path(d))) == 1);
+        }
+
+        error_code ec;
+        fs::remove_all(root, ec);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <sw/builder/execution_plan_file.h>
+
+#include <primitives/filesystem.h>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+static Strings arguments(const builder::Command &c)
+{
+    Strings s;
+    for (auto &a : c.arguments)
+        s.push_back(a->toString());
+    return s;
+}
+
+TEST_CASE("Execution plan file", "[execution_plan]")
+{
+    auto dir = temp_directory_path() / "sw_test_execution_plan" / unique_path();
+    auto fn = dir / "plan.swb";
+    const path root = "/home/user/project";
+
+    std::vector<std::shared_ptr<builder::Command>> storage;
+    std::vector<builder::Command *> commands;
+    for (int i = 0; i < 3; i++)
+    {
+        auto c = std::make_shared<builder::Command>();
+        c->name = "command " + std::to_string(i);
+        c->working_directory = root / "build";
+        c->environment["LANG"] = "C";
+        c->arguments.push_back("/usr/bin/g++");
+        c->arguments.push_back("-c");
+        c->arguments.push_back((root / ("file" + std::to_string(i) + ".cpp")).u8string());
+        c->in.text = "input " + std::to_string(i);
+        c->always = i == 1;
+        c->strict_order = -i;
+        c->deps_processor = builder::Command::DepsProcessor::Gnu;
+        c->deps_file = root / "build" / ("file" + std::to_string(i) + ".d");
+        c->inputs.insert(root / ("file" + std::to_string(i) + ".cpp"));
+        c->outputs.insert(root / "build" / ("file" + std::to_string(i) + ".o"));
+        storage.push_back(c);
+        commands.push_back(c.get());
+    }
+    // last one links the others
+    commands[2]->dependencies.insert(storage[0]);
+    commands[2]->dependencies.insert(storage[1]);
+    // not in the plan, so not saved
+    commands[1]->dependencies.insert(std::make_shared<builder::Command>());
+
+    ExecutionPlanFile::write(fn, root, commands);
+    // nothing is left next to the plan
+    REQUIRE(std::distance(fs::directory_iterator(dir), fs::directory_iterator()) == 1);
+
+    {
+        ExecutionPlanFile f(fn);
+        REQUIRE(f.getNumberOfCommands() == commands.size());
+        CHECK(f.getWorkingDirectory() == root);
+        for (size_t i = 0; i < commands.size(); i++)
+        {
+            auto &c = *commands[i];
+            auto l = f.getCommand(i);
+            CHECK(l->name == c.name);
+            CHECK(l->working_directory == c.working_directory);
+            CHECK(l->environment == c.environment);
+            CHECK(arguments(*l) == arguments(c));
+            CHECK(l->in.text == c.in.text);
+            CHECK(l->always == c.always);
+            CHECK(l->strict_order == c.strict_order);
+            CHECK(l->deps_processor == c.deps_processor);
+            CHECK(l->deps_file == c.deps_file);
+            CHECK(l->inputs == c.inputs);
+            CHECK(l->outputs == c.outputs);
+        }
+
+        CHECK(f.getNumberOfDependencies(0) == 0);
+        CHECK(f.getNumberOfDependencies(1) == 0);
+        REQUIRE(f.getNumberOfDependencies(2) == 2);
+        CHECK(f.getDependencies(2)[0] == 0);
+        CHECK(f.getDependencies(2)[1] == 1);
+    }
+
+    // bad files are not loaded
+    write_file(fn, "not a plan");
+    CHECK_THROWS(ExecutionPlanFile(fn));
+
+    error_code ec;
+    fs::remove_all(dir, ec);
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}